@@ -3,11 +3,14 @@
 #include "OpenGLMarkerObjects.h"
 #include "OpenGLBgEffect.h"
 #include "OpenGLMesh.h"
+#include "OpenGLInstancedMesh.h"
 #include "OpenGLViewer.h"
 #include "OpenGLWindow.h"
 #include "TinyObjLoader.h"
 #include "OpenGLSkybox.h"
+#include "LSystem.h"
 #include <algorithm>
+#include <stack>
 #include <iostream>
 #include <random>
 #include <unordered_set>
@@ -36,121 +39,38 @@ public:
         OpenGLViewer::Initialize();
     }
 
+    //// The pine needles; the engine expands the rules depth-first and writes the segments straight into the arrays (see LSystem.h)
     std::pair<std::vector<Vector3>, std::vector<Vector3i>> generate_l_system(int iterations, vec3 p)
     {
-        float segment_length = 0.025f;
-        float segment_width = 0.02f;
+        LSystem l_system("VZ"); // VZFFF
+        l_system.Add_Rule('V', "[+++W][---W]F[++W][--W]F[+W][-W]YV");
+        l_system.Add_Rule('X', "-W[+X]Z[+F][-F]");
+        l_system.Add_Rule('W', "+X[-W]Z[+F][-F]");
+        l_system.Add_Rule('Y', "Y[++W][--W]Z[++W][--W]Z[++W][--W]Z");
+        l_system.Add_Rule('Z', "[-FFF][+FFF]F");
+
+        l_system.angle = 25.0 * M_PI / 180;
+        l_system.segment_length = 0.025;
+        l_system.segment_offset = Vector3(0.02, 0, 0); // width of the rectangle of each segment
+        l_system.draw_symbols = "FXWYVZ";
 
         std::vector<Vector3> vertices;
         std::vector<Vector3i> elements;
-
-        Vector3 pos = Vector3(p.x, p.y, p.z);
-        Vector3 dir = Vector3(0, 1, 0);
-
-        float angle = 25.0 * M_PI / 180;
-
-        std::string axiom = "VZ"; // VZFFF
-        std::string command = "";
-
-        // create command via iteration on first axiom
-        for (int i = 0; i < iterations; i++)
-        {
-            command = "";
-
-            for (char c : axiom)
-            {
-                if (c == 'V')
-                    command += "[+++W][---W]F[++W][--W]F[+W][-W]YV";
-                else if (c == 'X')
-                    command += "-W[+X]Z[+F][-F]";
-                else if (c == 'W')
-                    command += "+X[-W]Z[+F][-F]";
-                else if (c == 'Y')
-                    command += "Y[++W][--W]Z[++W][--W]Z[++W][--W]Z";
-                else if (c == 'Z')
-                    command += "[-FFF][+FFF]F";
-                else
-                    command += c;
-            }
-
-            axiom = command;
-        }
-
-        // create vertices and triangles
-        std::stack<std::pair<Vector3, Vector3>> buildStack; // hold direction and position
-        int vertex_count = 0;
-
-        for (char c : command)
-        {
-            switch (c)
-            {
-            case '-':
-                dir = Vector3(dir.x() * cos(-angle) - dir.y() * sin(-angle),
-                              dir.x() * sin(-angle) + dir.y() * cos(-angle), dir.z());
-                break;
-            case '+':
-                dir = Vector3(dir.x() * cos(angle) - dir.y() * sin(angle),
-                              dir.x() * sin(angle) + dir.y() * cos(angle), dir.z());
-                break;
-            case '[':
-                buildStack.push(std::make_pair(dir, pos));
-                break;
-            case ']':
-                {
-                    std::pair<Vector3, Vector3> dp = buildStack.top();
-                    buildStack.pop();
-                    dir = dp.first;
-                    pos = dp.second;
-                }
-
-                break;
-            default:
-
-                if (c == 'F' || c == 'X' || c == 'W' || c == 'Y' || c == 'V' || c == 'Z')
-                {
-                    
-
-                    // Create rectangle vertices
-                    Vector3 v0 = pos;
-                    Vector3 v1 = Vector3(pos.x() + segment_width, pos.y(),pos.z());
-
-                    Vector3 next_pos = pos + dir * segment_length;
-                    
-                    Vector3 v2 = next_pos;
-                    Vector3 v3 = Vector3(next_pos.x() + segment_width, next_pos.y(),next_pos.z());
-
-
-                    vertices.push_back(v0);
-                    vertices.push_back(v1);
-                    vertices.push_back(v2);
-                    vertices.push_back(v3);
-
-                    Vector3i tri1 = Vector3i(vertex_count, vertex_count + 1, vertex_count + 2);
-                    Vector3i tri2 = Vector3i(vertex_count + 1, vertex_count + 3, vertex_count + 2);
-
-                    elements.push_back(tri1);
-                    elements.push_back(tri2);
-
-                    pos = next_pos;
-                    vertex_count += 4;
-                }
-
-                break;
-            }
-        }
+        l_system.Generate(iterations, Vector3(p.x, p.y, p.z), Vector3(0, 1, 0), vertices, elements);
 
         return {vertices, elements};
     }
 
-    void placeTree(vec3 p)
+    //// Trunks and needles are built once at the origin; each tree is an instance translated to its position
+    void placeTrees(const std::vector<vec3> &positions)
     {
         // trunk
         {
-            std::vector<Vector3> vertices = {Vector3(p.x, p.y - 1, p.z), Vector3(p.x + 0.1, p.y - 1, p.z), Vector3(p.x, p.y + 1, p.z), Vector3(p.x + 0.05, p.y + 1, p.z)};
+            std::vector<Vector3> vertices = {Vector3(0, -1, 0), Vector3(0.1, -1, 0), Vector3(0, 1, 0), Vector3(0.05, 1, 0)};
             std::vector<Vector3i> elements = {Vector3i(0, 1, 2), Vector3i(1, 3, 2)};
-            auto trunk = Add_Tri_Mesh_Object(vertices, elements);
+            auto trunks = Add_Instanced_Tri_Mesh_Object(vertices, elements);
             // ! you can also set uvs
-            trunk->mesh.Uvs() = {Vector2(0, 0), Vector2(1, 0), Vector2(1, 1), Vector2(0, 1)};
+            trunks->mesh.Uvs() = {Vector2(0, 0), Vector2(1, 0), Vector2(1, 1), Vector2(0, 1)};
 
             Matrix4f t;
             t << 0.5, 0, 0, -0.05,
@@ -158,17 +78,18 @@ public:
                 0, 0, 0.5, -0.02,
                 0, 0, 0, 1;
 
-            trunk->Set_Model_Matrix(t);
+            for (const auto &p : positions)
+                trunks->Add_Instance(t * Translation(p));
 
-            trunk->Add_Texture("tex_color", OpenGLTextureLibrary::Get_Texture("brown"));
+            trunks->Add_Texture("tex_color", OpenGLTextureLibrary::Get_Texture("brown"));
 
-            trunk->Add_Shader_Program(OpenGLShaderLibrary::Get_Shader("basic"));
+            trunks->Add_Shader_Program(OpenGLShaderLibrary::Get_Shader("basic"));
         }
 
         // Pine needles
         {
-            auto [vertices, elements] = generate_l_system(9, p);
-            auto obj = Add_Tri_Mesh_Object(vertices, elements);
+            auto [vertices, elements] = generate_l_system(9, vec3(0, 0, 0));
+            auto needles = Add_Instanced_Tri_Mesh_Object(vertices, elements);
 
             Matrix4f t;
             t << 0.5, 0, 0, 0,
@@ -176,19 +97,24 @@ public:
                 0, 0, 0.5, 0,
                 0, 0, 0, 1;
 
-            obj->Set_Model_Matrix(t);
-
             // Add material properties
-            obj->Set_Ka(Vector3f(0.0f, 0.0f, 1.0f));
-            obj->Set_Kd(Vector3f(0.0f, 0.0f, 1.0f));
-            obj->Set_Ks(Vector3f(0.0f, 0.0f, 1.0f));
-            obj->Set_Shininess(32.0f);
+            for (const auto &p : positions)
+                needles->Add_Instance(t * Translation(p), Vector3f(0.0f, 0.0f, 1.0f), Vector3f(0.0f, 0.0f, 1.0f), Vector3f(0.0f, 0.0f, 1.0f), 32.0f);
 
-            obj->Add_Texture("tex_color", OpenGLTextureLibrary::Get_Texture("green"));
-            obj->Add_Shader_Program(OpenGLShaderLibrary::Get_Shader("basic"));
+            needles->Add_Texture("tex_color", OpenGLTextureLibrary::Get_Texture("green"));
+            needles->Add_Shader_Program(OpenGLShaderLibrary::Get_Shader("basic"));
         }
     }
 
+    Matrix4f Translation(const vec3 &p)
+    {
+        Matrix4f m = Matrix4f::Identity();
+        m(0, 3) = p.x;
+        m(1, 3) = p.y;
+        m(2, 3) = p.z;
+        return m;
+    }
+
     virtual void Initialize_Data()
     {
         //// Load all the shaders you need for the scene
@@ -267,84 +193,36 @@ public:
         
 
 
+        //// The three elks share one mesh and are drawn with a single instanced draw call
         {
-            //// create object by reading an obj mesh
-            auto elkOne = Add_Obj_Mesh_Object("obj/elk.obj");
+            auto elks = Add_Instanced_Obj_Mesh_Object("obj/elk.obj");
 
-            //// set object's transform
+            //// per-instance transform and material: ka, kd, ks, shininess
             Matrix4f t;
             t << 0, 0, 0.23, -0.5,
                 0, 0.23, 0, -1,
                 0.23, 0, 0, 3.4,
                 0, 0, 0, 1;
-            elkOne->Set_Model_Matrix(t);
-
-            //// set object's material
-            elkOne->Set_Ka(Vector3f(0.1, 0.1, 0.1));
-            elkOne->Set_Kd(Vector3f(0.7, 0.7, 0.7));
-            elkOne->Set_Ks(Vector3f(2, 2, 2));
-            elkOne->Set_Shininess(128);
-
-            //// bind texture to object
-            elkOne->Add_Texture("tex_color", OpenGLTextureLibrary::Get_Texture("Elk_color"));
-            elkOne->Add_Texture("tex_normal", OpenGLTextureLibrary::Get_Texture("Elk_Normal"));
-
-            //// bind shader to object
-            elkOne->Add_Shader_Program(OpenGLShaderLibrary::Get_Shader("basic"));
-        }
-
-        //// Here we load a elk object with the basic shader to show how to add an object into the scene
-        {
-            //// create object by reading an obj mesh
-            auto elkTwo = Add_Obj_Mesh_Object("obj/elk.obj");
+            elks->Add_Instance(t, Vector3f(0.1, 0.1, 0.1), Vector3f(0.7, 0.7, 0.7), Vector3f(2, 2, 2), 128);
 
-            //// set object's transform
-            Matrix4f t;
             t << 0, 0, 0.25, -0.2,
                 0, 0.25, 0, -1,
                 0.25, 0, 0, 1.6,
                 0, 0, 0, 1;
-            elkTwo->Set_Model_Matrix(t);
-
-            //// set object's material
-            elkTwo->Set_Ka(Vector3f(0.1, 0.1, 0.1));
-            elkTwo->Set_Kd(Vector3f(0.7, 0.7, 0.7));
-            elkTwo->Set_Ks(Vector3f(2, 2, 2));
-            elkTwo->Set_Shininess(128);
-
-            //// bind texture to object
-            elkTwo->Add_Texture("tex_color", OpenGLTextureLibrary::Get_Texture("Elk_color"));
-            elkTwo->Add_Texture("tex_normal", OpenGLTextureLibrary::Get_Texture("Elk_Normal"));
-
-            //// bind shader to object
-            elkTwo->Add_Shader_Program(OpenGLShaderLibrary::Get_Shader("basic"));
-        }
+            elks->Add_Instance(t, Vector3f(0.1, 0.1, 0.1), Vector3f(0.7, 0.7, 0.7), Vector3f(2, 2, 2), 128);
 
-        //// Here we load a elk object with the basic shader to show how to add an object into the scene
-        {
-            //// create object by reading an obj mesh
-            auto elkThree = Add_Obj_Mesh_Object("obj/elk.obj");
-
-            //// set object's transform
-            Matrix4f t;
             t << 0, 0, 0.3, 0.1,
                 0, 0.3, 0, -1,
                 0.3, 0, 0, 3,
                 0, 0, 0, 1;
-            elkThree->Set_Model_Matrix(t);
-
-            //// set object's material
-            elkThree->Set_Ka(Vector3f(0.1, 0.1, 0.1));
-            elkThree->Set_Kd(Vector3f(0.7, 0.7, 0.7));
-            elkThree->Set_Ks(Vector3f(2, 2, 2));
-            elkThree->Set_Shininess(128);
+            elks->Add_Instance(t, Vector3f(0.1, 0.1, 0.1), Vector3f(0.7, 0.7, 0.7), Vector3f(2, 2, 2), 128);
 
             //// bind texture to object
-            elkThree->Add_Texture("tex_color", OpenGLTextureLibrary::Get_Texture("Elk_color"));
-            elkThree->Add_Texture("tex_normal", OpenGLTextureLibrary::Get_Texture("Elk_Normal"));
+            elks->Add_Texture("tex_color", OpenGLTextureLibrary::Get_Texture("Elk_color"));
+            elks->Add_Texture("tex_normal", OpenGLTextureLibrary::Get_Texture("Elk_Normal"));
 
             //// bind shader to object
-            elkThree->Add_Shader_Program(OpenGLShaderLibrary::Get_Shader("basic"));
+            elks->Add_Shader_Program(OpenGLShaderLibrary::Get_Shader("basic"));
         }
 
         //// Here we show an example of adding a mesh with noise-terrain (A6)
@@ -376,6 +254,8 @@ public:
 
             //// bind shader to object (we do not bind texture for this object because we create noise for texture)
             terrain->Add_Shader_Program(OpenGLShaderLibrary::Get_Shader("terrain"));
+            //// the terrain shader lifts vertices by up to ~2 units, which the culling bounds must include
+            terrain->bounds_padding = 2.5f;
              //// create object by reading an obj mesh
         }
          {
@@ -406,6 +286,8 @@ public:
 
             //// bind shader to object (we do not bind texture for this object because we create noise for texture)
             terrain2->Add_Shader_Program(OpenGLShaderLibrary::Get_Shader("terrain2"));
+            //// the terrain shader lifts vertices by up to ~2 units, which the culling bounds must include
+            terrain2->bounds_padding = 2.5f;
              //// create object by reading an obj mesh
         }
         {
@@ -436,45 +318,74 @@ public:
 
             //// bind shader to object (we do not bind texture for this object because we create noise for texture)
             terrain3->Add_Shader_Program(OpenGLShaderLibrary::Get_Shader("terrain3"));
+            //// the terrain shader lifts vertices by up to ~2 units, which the culling bounds must include
+            terrain3->bounds_padding = 2.5f;
              //// create object by reading an obj mesh
         }
         //// Here we create a mesh object with two triangle specified using a vertex array and a triangle array.
         //// This is an example showing how to create a mesh object without reading an .obj file.
         //// If you are creating your own L-system, you may use this function to visualize your mesh.
 
-        placeTree(vec3(3.5, -1.5, 1.5));
-        placeTree(vec3(2, -1.5, 0));
-        placeTree(vec3(3.2, -1.5, -1.5));
-        placeTree(vec3(-1.5, -1.5, 0));
-        placeTree(vec3(-2.3, -1.5, -0.40));
-        placeTree(vec3(-0.7, -1.5, -1.5));
+        placeTrees({vec3(3.5, -1.5, 1.5), vec3(2, -1.5, 0), vec3(3.2, -1.5, -1.5),
+                    vec3(-1.5, -1.5, 0), vec3(-2.3, -1.5, -0.40), vec3(-0.7, -1.5, -1.5)});
 
         //// This for-loop updates the rendering model for each object on the list
         for (auto &mesh_obj : mesh_object_array)
         {
             Set_Polygon_Mode(mesh_obj, PolygonMode::Fill);
             Set_Shading_Mode(mesh_obj, ShadingMode::TexAlpha);
+            mesh_obj->use_geometry_pool = true; // static: suballocated from the shared buffers (instanced meshes opt out)
             mesh_obj->Set_Data_Refreshed();
             mesh_obj->Initialize();
         }
         Toggle_Play();
     }
 
-    //// add mesh object by reading an .obj file
+    //// read an .obj file through the geometry cache: objects loading the same file share one mesh and its GPU buffers
+    std::shared_ptr<OpenGLGeometry> Load_Obj_Geometry(const std::string &obj_file_name)
+    {
+        return OpenGLGeometryCache::Instance()->Get(obj_file_name, "obj_cached_optimized",
+            [](const std::string &file_name, Array<std::shared_ptr<TriangleMesh<3>>> &meshes) {
+                // Obj::Read_From_Obj_File(file_name, meshes);
+                // Obj::Read_From_Obj_File_Discrete_Triangles(file_name, meshes);
+                Obj::Read_From_Obj_File_Cached(file_name, meshes, /*optimize*/ true);
+                return !meshes.empty();
+            });
+    }
+
+    //// add mesh object by reading an .obj file; edit its mesh through Edit_Mesh(), which copies it if it is shared
     OpenGLTriangleMesh *Add_Obj_Mesh_Object(std::string obj_file_name)
     {
         auto mesh_obj = Add_Interactive_Object<OpenGLTriangleMesh>();
-        Array<std::shared_ptr<TriangleMesh<3>>> meshes;
-        // Obj::Read_From_Obj_File(obj_file_name, meshes);
-        Obj::Read_From_Obj_File_Discrete_Triangles(obj_file_name, meshes);
+        mesh_obj->Set_Geometry(Load_Obj_Geometry(obj_file_name));
+        std::cout << "load tri_mesh from obj file, #vtx: " << mesh_obj->mesh.Vertex_Num() << ", #ele: " << mesh_obj->mesh.Elements().size() << std::endl;
 
-        mesh_obj->mesh = *meshes[0];
-        std::cout << "load tri_mesh from obj file, #vtx: " << mesh_obj->mesh.Vertices().size() << ", #ele: " << mesh_obj->mesh.Elements().size() << std::endl;
+        mesh_object_array.push_back(mesh_obj);
+        return mesh_obj;
+    }
+
+    //// add an instanced mesh object by reading an .obj file; add its copies with Add_Instance()
+    OpenGLInstancedMesh *Add_Instanced_Obj_Mesh_Object(std::string obj_file_name)
+    {
+        auto mesh_obj = Add_Interactive_Object<OpenGLInstancedMesh>();
+        mesh_obj->Set_Geometry(Load_Obj_Geometry(obj_file_name));
+        std::cout << "load instanced tri_mesh from obj file, #vtx: " << mesh_obj->mesh.Vertex_Num() << ", #ele: " << mesh_obj->mesh.Elements().size() << std::endl;
 
         mesh_object_array.push_back(mesh_obj);
         return mesh_obj;
     }
 
+    //// add an instanced mesh object from an array of vertices and an array of elements
+    OpenGLInstancedMesh *Add_Instanced_Tri_Mesh_Object(const std::vector<Vector3> &vertices, const std::vector<Vector3i> &elements)
+    {
+        auto obj = Add_Interactive_Object<OpenGLInstancedMesh>();
+        mesh_object_array.push_back(obj);
+        obj->mesh.Vertices() = vertices;
+        obj->mesh.Elements() = elements;
+
+        return obj;
+    }
+
     //// add mesh object by reading an array of vertices and an array of elements
     OpenGLTriangleMesh *Add_Tri_Mesh_Object(const std::vector<Vector3> &vertices, const std::vector<Vector3i> &elements)
     {
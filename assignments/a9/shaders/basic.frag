@@ -36,11 +36,9 @@ in vec3 vtx_model_position; // vtx position in model space
 in vec4 vtx_color;
 in vec2 vtx_uv;
 in vec3 vtx_tangent;
-
-uniform vec3 ka;            /* object material ambient */
-uniform vec3 kd;            /* object material diffuse */
-uniform vec3 ks;            /* object material specular */
-uniform float shininess;    /* object material shininess */
+flat in vec4 vtx_ka; // material ambient, shininess in w; of the draw or the instance, see basic.vert
+flat in vec4 vtx_kd; // material diffuse
+flat in vec4 vtx_ks; // material specular
 
 uniform sampler2D tex_color;   /* texture sampler for color */
 uniform sampler2D tex_normal;   /* texture sampler for normal vector */
@@ -50,24 +48,25 @@ out vec4 frag_color;
 
 vec3 shading_texture_with_phong(light li, vec3 e, vec3 p, vec3 s, vec3 n)
 {
-    vec3 q = ka * vec3(li.amb.xyz);
+    vec3 q = vtx_ka.rgb * vec3(li.amb.xyz);
     //lambertian shading    
     vec3 l = normalize(s-p);
     vec3 nn = normalize(n);
-    vec3 d = kd * li.dif.xyz * max(0, dot(l,nn));
+    vec3 d = vtx_kd.rgb * li.dif.xyz * max(0, dot(l,nn));
     vec3 lambert = q + d;
 
     vec3 v = normalize(e-p);
     vec3 r = reflect(-l,nn);
-    vec3 fin = lambert + (ks * li.spec.xyz * (pow(max(0,dot(v,r)),shininess)));
+    vec3 fin = lambert + (vtx_ks.rgb * li.spec.xyz * (pow(max(0,dot(v,r)),vtx_ka.w)));
 
     return fin;
 }
 
 vec3 read_normal_texture()
 {
-    vec3 normal = texture(tex_normal, vtx_uv).rgb;
-    normal = normalize(normal * 2.0 - 1.0);
+    //// x and y only: block-compressed normal maps keep two channels, z is rebuilt from the unit length
+    vec2 xy = texture(tex_normal, vtx_uv).rg * 2.0 - 1.0;
+    vec3 normal = vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
     return normal;
 }
 
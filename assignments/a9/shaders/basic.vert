@@ -9,8 +9,6 @@ layout(std140) uniform camera {
     vec4 position;		/*camera's position in world space*/
 };
 
-uniform mat4 model;		/*model matrix*/
-
 /*input variables*/
 layout(location = 0) in vec4 pos;			/*vertex position*/
 layout(location = 1) in vec4 v_color;		/*vertex color*/
@@ -18,6 +16,16 @@ layout(location = 2) in vec4 normal;		/*vertex normal*/
 layout(location = 3) in vec4 uv; 			/*vertex uv*/
 layout(location = 4) in vec4 tangent;	    /*vertex tangent*/
 
+/*per-draw variables: a row of the instance stream of OpenGLInstancedMesh, of the geometry pool's per-draw stream,
+  or constant values set from the object, see OpenGLTriangleMesh::Set_Draw_Data*/
+layout(location = 8) in vec4 inst_model0;	/*model matrix, column by column*/
+layout(location = 9) in vec4 inst_model1;
+layout(location = 10) in vec4 inst_model2;
+layout(location = 11) in vec4 inst_model3;
+layout(location = 12) in vec4 inst_ka;		/*ambient, shininess in w*/
+layout(location = 13) in vec4 inst_kd;		/*diffuse*/
+layout(location = 14) in vec4 inst_ks;		/*specular*/
+
 /*output variables*/
 out vec4 vtx_color;
 out vec3 vtx_normal; // world space normal
@@ -25,8 +33,12 @@ out vec3 vtx_position; // world space position
 out vec3 vtx_model_position; // model space position
 out vec2 vtx_uv;
 out vec3 vtx_tangent;
+flat out vec4 vtx_ka; // material for basic.frag, shininess in w
+flat out vec4 vtx_kd;
+flat out vec4 vtx_ks;
 
 void main() {
+    mat4 model = mat4(inst_model0, inst_model1, inst_model2, inst_model3);
     vec4 worldPos = model * vec4(pos.xyz, 1.);
     // ! do not support non-uniform scale
     vec4 worldNormal = model * vec4(normal.xyz, 0.);
@@ -38,6 +50,9 @@ void main() {
     vtx_color = vec4(v_color.rgb, 1.);
     vtx_uv = uv.xy;
     vtx_tangent = worldTangent.xyz;
+    vtx_ka = inst_ka;
+    vtx_kd = inst_kd;
+    vtx_ks = inst_ks;
 
     gl_Position = pvm * worldPos;
 }
\ No newline at end of file
@@ -9,7 +9,15 @@ layout(std140) uniform camera {
     vec4 position;		/*camera's position in world space*/
 };
 
-uniform mat4 model;		/*model matrix*/
+/*per-object data, std140. do not modify.*/
+layout(std140) uniform object {
+    mat4 model;         /*model matrix*/
+    vec3 ka;            /* object material ambient */
+    float shininess;    /* object material shininess */
+    vec3 kd;            /* object material diffuse */
+    float iTime;        /* time in seconds */
+    vec3 ks;            /* object material specular */
+};
 
 /*input variables*/
 layout(location = 0) in vec4 pos;			/*vertex position*/
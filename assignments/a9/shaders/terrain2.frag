@@ -28,19 +28,20 @@ layout(std140) uniform lights
 	light lt[4];
 };
 
-uniform float iTime;
-uniform mat4 model;		/*model matrix*/
+/*per-object data, std140. do not modify.*/
+layout(std140) uniform object {
+    mat4 model;         /*model matrix*/
+    vec3 ka;            /* object material ambient */
+    float shininess;    /* object material shininess */
+    vec3 kd;            /* object material diffuse */
+    float iTime;        /* time in seconds */
+    vec3 ks;            /* object material specular */
+};
 
 in vec3 vtx_pos;
 
 out vec4 frag_color;
 
-
-uniform vec3 ka;            /* object material ambient */
-uniform vec3 kd;            /* object material diffuse */
-uniform vec3 ks;            /* object material specular */
-uniform float shininess;    /* object material shininess */
-
 vec2 hash2(vec2 v)
 {
 	vec2 rand = vec2(0,0);
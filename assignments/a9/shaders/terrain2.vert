@@ -58,7 +58,15 @@ float height(vec2 v){
 	return h * 2.25;
 }
 
-uniform mat4 model;		/*model matrix*/
+/*per-object data, std140. do not modify.*/
+layout(std140) uniform object {
+    mat4 model;         /*model matrix*/
+    vec3 ka;            /* object material ambient */
+    float shininess;    /* object material shininess */
+    vec3 kd;            /* object material diffuse */
+    float iTime;        /* time in seconds */
+    vec3 ks;            /* object material specular */
+};
 
 /*input variables*/
 layout(location = 0) in vec4 pos;
@@ -11,6 +11,8 @@
 
 namespace Stb{
 	void Set_Flip_Image_Rows(const int flip){stbi_set_flip_vertically_on_load(flip);}
+	void Set_Png_Compression_Level(const int level){stbi_write_png_compression_level=level;}
+	void Set_Png_Filter(const int filter){stbi_write_force_png_filter=filter;}
 
 	int Write_Png(char const *filename,int w,int h,int comp,const void *data,int stride_in_bytes)
 	{return stbi_write_png(filename,w,h,comp,data,stride_in_bytes);}
@@ -12,6 +12,8 @@ int Write_Png(char const *filename,int w,int h,int comp,const void *data,int str
 unsigned char* Read_Image_8(char const *filename,int *x,int *y,int *channels_in_file,int desired_channels);
 unsigned short* Read_Image_16(char const *filename,int *x,int *y,int *channels_in_file,int desired_channels);
 void Set_Flip_Image_Rows(const int flip);
+void Set_Png_Compression_Level(const int level);	////process-wide; default 8, lower is faster
+void Set_Png_Filter(const int filter);			////process-wide; 0-4 forces one row filter, -1 tries all five per row
 
 template<class T_VAL> void Read_Image(const std::string& name,int& width,int& height,int& channels,T_VAL* & image);
 };
@@ -6,6 +6,7 @@
 #include <memory>
 #include "Common.h"
 #include "Mesh.h"
+#include "MeshCache.h"
 #include "Skeleton.h"
 
 #define TINYGLTF_IMPLEMENTATION
@@ -46,6 +47,41 @@ T* GetPointer(tinygltf::Model& model, tinygltf::Primitive& prim, std::string nam
 	return data;
 }
 
+////The JSON of a .gltf, or of the first chunk of a .glb, read without tinygltf and without the buffers
+static bool Read_Json(const std::string& file_name, const bool binary, json& doc)
+{
+	std::ifstream input(file_name, std::ios::binary);
+	if (!input) return false;
+	std::string text;
+	if (binary) {
+		std::uint32_t header[5];	//// magic "glTF", version, length, then the length and type of the first chunk
+		if (!input.read((char*)header, sizeof(header)) || header[0] != 0x46546C67 || header[4] != 0x4E4F534A) return false;
+		if ((long long)header[3] > File::File_Size(file_name)) return false;
+		text.resize(header[3]);
+		if (!input.read(&text[0], header[3])) return false;
+	}
+	else text.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+	doc = json::parse(text.begin(), text.end(), nullptr, false);
+	return doc.is_object();
+}
+
+////Paths of the buffers stored in files next to the gltf; embedded data uris and the glb binary chunk are part of the file itself
+static Array<std::string> External_Buffer_Files(const json& doc, const std::string& file_name)
+{
+	Array<std::string> files;
+	size_t p = file_name.find_last_of("/\\");
+	std::string base_dir = p == std::string::npos ? "" : file_name.substr(0, p + 1);
+	auto buffers = doc.find("buffers");
+	if (buffers == doc.end() || !buffers->is_array()) return files;
+	for (const auto& buffer : *buffers) {
+		auto uri = buffer.find("uri");
+		if (uri == buffer.end() || !uri->is_string()) continue;
+		std::string u = uri->get<std::string>();
+		if (u.compare(0, 5, "data:") != 0) files.push_back(base_dir + u);
+	}
+	return files;
+}
+
 template<class T_SCENEGRAPH, class T_MESH, class T_SKELETON>
 void Read_From_Gltf_File(
 	const std::string& file_name,
@@ -60,9 +96,25 @@ void Read_From_Gltf_File(
 	std::string err;
 	std::string warn;
 	std::string ext = GetFilePathExtension(file_name);
+	bool binary = (ext.compare("glb") == 0);
+
+	////mesh primitives come from the binary cache next to the file when the gltf and its external buffers are unchanged; nodes, skins
+	////and animations are always read from the gltf. The cache is checked before tinygltf runs, so that on a hit a file without skins
+	////and animations, the only other readers of the buffers, is parsed without loading and decoding them.
+	json doc;
+	std::string cache_name = MeshCache::Cache_File_Name(file_name);
+	std::uint64_t cache_key = Read_Json(file_name, binary, doc) ? MeshCache::Key(file_name, "gltf", External_Buffer_Files(doc, file_name)) : 0;
+	Array<std::shared_ptr<T_MESH> > cached_meshes;
+	bool cached = (cache_key != 0 && MeshCache::Read(cache_name, cached_meshes, cache_key));
 
 	bool ret = false;
-	if (ext.compare("glb") == 0) {
+	if (cached && doc.find("skins") == doc.end() && doc.find("animations") == doc.end()) {
+		for (const char* section : { "buffers", "bufferViews", "accessors", "meshes", "materials", "images", "textures", "samplers" })
+			doc.erase(section);
+		std::string text = doc.dump();
+		ret = gltf_ctx.LoadASCIIFromString(&model, &err, &warn, text.c_str(), (unsigned int)text.size(), "", tinygltf::NO_REQUIRE);
+	}
+	else if (binary) {
 		std::cout << "Reading binary glTF" << std::endl;
 		// assume binary glTF.
 		ret = gltf_ctx.LoadBinaryFromFile(&model, &err, &warn, file_name.c_str());
@@ -206,6 +258,13 @@ void Read_From_Gltf_File(
 		skeletons.push_back(out_skin);
 	}
 
+	if (cached) {
+		std::cout << "Read gltf mesh cache: " << cache_name << ", #meshes=" << cached_meshes.size() << std::endl;
+		meshes.insert(meshes.end(), cached_meshes.begin(), cached_meshes.end());
+		return;
+	}
+	size_type mesh_begin = meshes.size();
+
 	for (int i = 0; i < model.meshes.size(); i++) {
 		auto& mesh = model.meshes[i];
 
@@ -287,6 +346,10 @@ void Read_From_Gltf_File(
 			meshes.push_back(out_mesh);
 		}
 	}
+
+	cached_meshes.assign(meshes.begin() + mesh_begin, meshes.end());
+	if (cache_key != 0 && !cached_meshes.empty() && !MeshCache::Write(cache_name, cached_meshes, cache_key))
+		std::cerr << "Error: [Gltf] Write mesh cache " << cache_name << " failed" << std::endl;
 }
 
 template void Read_From_Gltf_File<SceneGraph<3>, TriangleMesh<3>, Skeleton<3> >(
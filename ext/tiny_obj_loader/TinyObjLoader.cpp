@@ -2,10 +2,13 @@
 // Tiny obj loader
 // Bo Zhu
 //#####################################################################
+#include <cassert>
 #include <iostream>
 #include <memory>
 #include "Common.h"
 #include "Mesh.h"
+#include "MeshOptimizer.h"
+#include "MeshCache.h"
 #include "tiny_obj_loader.h"
 #include "TinyObjLoader.h"
 
@@ -120,6 +123,114 @@ template<class T_MESH> void Read_From_Obj_File_Discrete_Triangles(const std::str
 	}
 }
 
+////Hash of an obj (vertex,normal,texcoord) index triple
+struct Index_Triple_Hash
+{
+	std::size_t operator()(const Vector3i& k) const
+	{
+		unsigned long long h=(unsigned long long)(unsigned int)k[0]*0x9E3779B97F4A7C15ull;
+		h^=(unsigned long long)(unsigned int)k[1]*0xC2B2AE3D27D4EB4Full+(h<<6)+(h>>2);
+		h^=(unsigned long long)(unsigned int)k[2]*0x165667B19E3779F9ull+(h<<6)+(h>>2);
+		return (std::size_t)h;
+	}
+};
+
+template<class T_MESH> void Read_From_Obj_File_Welded(const std::string& file_name,Array<std::shared_ptr<T_MESH> >& meshes,WeldStats* stats,const bool optimize)
+{
+	auto file = std::ifstream(file_name);
+
+	std::string warn, err;
+	tinyobj::attrib_t attrib; 
+	Array<tinyobj::shape_t> shapes; 
+	Array<tinyobj::material_t> materials; 
+	
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &file)) {
+		std::cerr << "Read obj error: " << err << std::endl;
+		return;
+	}
+
+	bool has_normals=attrib.normals.size()>0;
+	bool has_uvs=attrib.texcoords.size()>0;
+	WeldStats total;
+
+	meshes.resize((int)shapes.size());
+	for(auto i=0;i<shapes.size();i++){
+		meshes[i]=std::make_shared<T_MESH>();
+		tinyobj::mesh_t& mesh=shapes[i].mesh;
+		int corner_num=(int)mesh.indices.size();
+
+		std::unordered_map<Vector3i,int,Index_Triple_Hash> vtx_map;vtx_map.reserve(corner_num);
+		Array<int> corner_vtx(corner_num);
+		Array<uchar> missing_normal;int missing_normal_num=0;	////vertices of corners without a normal index
+		auto& vertices=*meshes[i]->vertices;auto& normals=*meshes[i]->normals;auto& uvs=*meshes[i]->uvs;
+		vertices.reserve(corner_num);
+		if(has_normals)normals.reserve(corner_num);
+		if(has_uvs)uvs.reserve(corner_num);
+
+		for(int f=0;f<corner_num;f++){
+			const tinyobj::index_t& idx=mesh.indices[f];
+			Vector3i key(idx.vertex_index,has_normals?idx.normal_index:-1,has_uvs?idx.texcoord_index:-1);
+			auto ins=vtx_map.insert(std::make_pair(key,(int)vertices.size()));
+			corner_vtx[f]=ins.first->second;
+			if(!ins.second)continue;
+
+			vertices.push_back(Vector3((real)attrib.vertices[key[0]*3+0],(real)attrib.vertices[key[0]*3+1],(real)attrib.vertices[key[0]*3+2]));
+			if(has_normals){
+				if(key[1]>=0)normals.push_back(Vector3((real)attrib.normals[key[1]*3+0],(real)attrib.normals[key[1]*3+1],(real)attrib.normals[key[1]*3+2]));
+				else{normals.push_back(Vector3::Zero());missing_normal_num++;}
+				missing_normal.push_back(key[1]<0?1:0);}
+			if(has_uvs){
+				if(key[2]>=0)uvs.push_back(Vector2((real)attrib.texcoords[key[2]*2+0],1.0-(real)attrib.texcoords[key[2]*2+1]));
+				else uvs.push_back(Vector2::Zero());}
+		}
+
+		meshes[i]->elements.resize(corner_num/3);
+		for(int j=0;j<corner_num/3;j++)meshes[i]->elements[j]=Vector3i(corner_vtx[j*3],corner_vtx[j*3+1],corner_vtx[j*3+2]);
+
+		////the file has normals, but not for these corners: they are welded into vertices of their own, which get the normals of
+		////their faces, as if the file had none
+		if(missing_normal_num>0){
+			std::vector<Vector3> face_normals;Update_Normals(*meshes[i],face_normals);
+			for(size_type v=0;v<vertices.size();v++)if(missing_normal[v])normals[v]=face_normals[v];}
+
+		total.corner_num+=corner_num;total.vertex_num+=(int)vertices.size();
+
+		if(optimize){
+			assert(Optimize_Mesh_Is_Deterministic());
+			VertexCacheStats before,after;Optimize_Mesh(*meshes[i],16,&before,&after);
+			double tri_num=(double)(corner_num/3),vtx_num=(double)vertices.size();
+			total.acmr_before+=before.acmr*tri_num;total.acmr_after+=after.acmr*tri_num;
+			total.atvr_before+=before.atvr*vtx_num;total.atvr_after+=after.atvr*vtx_num;}
+	}
+	if(optimize&&total.corner_num>0&&total.vertex_num>0){
+		double tri_num=(double)(total.corner_num/3),vtx_num=(double)total.vertex_num;
+		total.acmr_before/=tri_num;total.acmr_after/=tri_num;total.atvr_before/=vtx_num;total.atvr_after/=vtx_num;}
+
+	std::cout<<"Read obj file: "<<file_name<<", #shapes="<<shapes.size()<<", #materials="<<materials.size()
+		<<", welded "<<total.corner_num<<" corners into "<<total.vertex_num<<" vertices, reuse ratio="<<total.Reuse_Ratio();
+	if(optimize)std::cout<<", ACMR "<<total.acmr_before<<" -> "<<total.acmr_after<<", ATVR "<<total.atvr_before<<" -> "<<total.atvr_after;
+	std::cout<<std::endl;
+	if(stats!=nullptr)*stats=total;
+}
+
+template<class T_MESH> void Read_From_Obj_File_Cached(const std::string& file_name,Array<std::shared_ptr<T_MESH> >& meshes,const bool optimize)
+{
+	std::string cache_name=MeshCache::Cache_File_Name(file_name);
+	std::uint64_t key=MeshCache::Key(file_name,optimize?"obj_welded_optimized_overdraw_seam_tangents_filled_normals":"obj_welded_seam_tangents_filled_normals");
+	if(key!=0&&MeshCache::Read(cache_name,meshes,key)){
+		std::cout<<"Read obj cache: "<<cache_name<<", #meshes="<<meshes.size()<<std::endl;return;}
+
+	Read_From_Obj_File_Welded(file_name,meshes,nullptr,optimize);
+	for(auto& mesh:meshes){
+		VertexElementAdjacency adj;adj.Initialize(mesh->Elements(),mesh->Vertices().size());
+		if(mesh->Normals().size()<mesh->Vertices().size())Update_Normals(*mesh,adj,mesh->Normals());
+		if(mesh->Uvs().size()==mesh->Vertices().size()&&!mesh->Elements().empty())Update_Tangents(*mesh,adj);}
+	if(key!=0&&!meshes.empty()&&!MeshCache::Write(cache_name,meshes,key))
+		std::cerr<<"Error: [Obj] Write mesh cache "<<cache_name<<" failed"<<std::endl;
+}
+
 template void Read_From_Obj_File<TriangleMesh<3> >(const std::string&,Array<std::shared_ptr<TriangleMesh<3> > >&);
 template void Read_From_Obj_File_Discrete_Triangles<TriangleMesh<3> >(const std::string&,Array<std::shared_ptr<TriangleMesh<3> > >&);
+template void Read_From_Obj_File_Welded<TriangleMesh<3> >(const std::string&,Array<std::shared_ptr<TriangleMesh<3> > >&,WeldStats*,const bool);
+template void Read_From_Obj_File_Cached<TriangleMesh<3> >(const std::string&,Array<std::shared_ptr<TriangleMesh<3> > >&,const bool);
 };
\ No newline at end of file
@@ -12,6 +12,22 @@ namespace Obj
 {
     template<class T_MESH> void Read_From_Obj_File(const std::string& file_name,std::vector<std::shared_ptr<T_MESH> >& meshes);
 	template<class T_MESH> void Read_From_Obj_File_Discrete_Triangles(const std::string&,Array<std::shared_ptr<T_MESH> >&);
+
+	////Welded loading: face corners sharing the same (position,normal,texcoord) index triple become one vertex
+	struct WeldStats
+	{
+		int corner_num=0;		////face corners read
+		int vertex_num=0;		////unique vertices emitted
+		double acmr_before=0.,acmr_after=0.;	////over all shapes, weighted by their triangles; only with optimize=true
+		double atvr_before=0.,atvr_after=0.;	////weighted by their vertices
+		double Reuse_Ratio() const {return vertex_num>0?(double)corner_num/(double)vertex_num:0.;}
+	};
+	////optimize=true reorders triangles and vertices for the post-transform cache, overdraw and vertex fetch, see MeshOptimizer.h
+	template<class T_MESH> void Read_From_Obj_File_Welded(const std::string&,Array<std::shared_ptr<T_MESH> >&,WeldStats* stats=nullptr,const bool optimize=false);
+
+	////Welded loading through a binary cache next to the source (see MeshCache.h). On a miss the obj is parsed, normals and tangents
+	////are generated, and the cache is written; on a hit with the same content hash the meshes are mapped from the cache instead.
+	template<class T_MESH> void Read_From_Obj_File_Cached(const std::string&,Array<std::shared_ptr<T_MESH> >&,const bool optimize=false);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,120 @@
+//#####################################################################
+// Block compression
+// BC1, BC3 and BC5 encoders for 4x4 blocks of 8-bit texels
+//#####################################################################
+#ifndef __BlockCompression_h__
+#define __BlockCompression_h__
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include "Common.h"
+#include "Parallel.h"
+
+////Formats as laid out by GL_COMPRESSED_RGB_S3TC_DXT1_EXT (BC1), GL_COMPRESSED_RGBA_S3TC_DXT5_EXT (BC3) and GL_COMPRESSED_RG_RGTC2 (BC5).
+////BC1 endpoints are the extremes of the block colors along their principal axis; BC4 channels, two of which make a BC5 block and one
+////the alpha of a BC3 block, use the channel minimum and maximum with six interpolated values.
+namespace BlockCompression{
+
+enum class Format : std::uint32_t {None=0,BC1=1,BC3=2,BC5=3};
+
+inline int Block_Bytes(const Format format){return format==Format::BC1?8:16;}
+inline size_type Level_Bytes(const Format format,const int width,const int height)
+{return (size_type)((width+3)/4)*(size_type)((height+3)/4)*(size_type)Block_Bytes(format);}
+
+inline std::uint16_t Pack_565(const float* c)
+{
+	int r=(int)(std::min(std::max(c[0],0.f),255.f)*31.f/255.f+.5f);
+	int g=(int)(std::min(std::max(c[1],0.f),255.f)*63.f/255.f+.5f);
+	int b=(int)(std::min(std::max(c[2],0.f),255.f)*31.f/255.f+.5f);
+	return (std::uint16_t)((r<<11)|(g<<5)|b);
+}
+
+inline void Unpack_565(const std::uint16_t c,int* rgb)
+{
+	int r=(c>>11)&31,g=(c>>5)&63,b=c&31;
+	rgb[0]=(r<<3)|(r>>2);rgb[1]=(g<<2)|(g>>4);rgb[2]=(b<<3)|(b>>2);
+}
+
+////rgba: 16 texels, 4 bytes each, row by row
+inline void Encode_BC1_Block(const std::uint8_t* rgba,std::uint8_t* out)
+{
+	float mean[3]={0.f,0.f,0.f};
+	for(int i=0;i<16;i++)for(int c=0;c<3;c++)mean[c]+=rgba[i*4+c];
+	for(int c=0;c<3;c++)mean[c]/=16.f;
+	float cov[6]={0.f,0.f,0.f,0.f,0.f,0.f};	////xx,xy,xz,yy,yz,zz
+	for(int i=0;i<16;i++){
+		float d[3]={rgba[i*4]-mean[0],rgba[i*4+1]-mean[1],rgba[i*4+2]-mean[2]};
+		cov[0]+=d[0]*d[0];cov[1]+=d[0]*d[1];cov[2]+=d[0]*d[2];cov[3]+=d[1]*d[1];cov[4]+=d[1]*d[2];cov[5]+=d[2]*d[2];}
+
+	////principal axis by power iteration
+	float axis[3]={1.f,1.f,1.f};
+	for(int k=0;k<8;k++){
+		float a[3]={cov[0]*axis[0]+cov[1]*axis[1]+cov[2]*axis[2],cov[1]*axis[0]+cov[3]*axis[1]+cov[4]*axis[2],cov[2]*axis[0]+cov[4]*axis[1]+cov[5]*axis[2]};
+		float n=std::max(std::abs(a[0]),std::max(std::abs(a[1]),std::abs(a[2])));
+		if(n<1e-6f)break;
+		for(int c=0;c<3;c++)axis[c]=a[c]/n;}
+	float t_min=0.f,t_max=0.f;
+	float len2=axis[0]*axis[0]+axis[1]*axis[1]+axis[2]*axis[2];
+	for(int i=0;i<16;i++){
+		float t=((rgba[i*4]-mean[0])*axis[0]+(rgba[i*4+1]-mean[1])*axis[1]+(rgba[i*4+2]-mean[2])*axis[2])/len2;
+		t_min=std::min(t_min,t);t_max=std::max(t_max,t);}
+	float e0[3],e1[3];
+	for(int c=0;c<3;c++){e0[c]=mean[c]+axis[c]*t_max;e1[c]=mean[c]+axis[c]*t_min;}
+
+	std::uint16_t c0=Pack_565(e0),c1=Pack_565(e1);
+	if(c0<c1)std::swap(c0,c1);
+	std::uint32_t indices=0;
+	if(c0!=c1){	////c0>c1 selects the four-color mode
+		int p[4][3];Unpack_565(c0,p[0]);Unpack_565(c1,p[1]);
+		for(int c=0;c<3;c++){p[2][c]=(2*p[0][c]+p[1][c])/3;p[3][c]=(p[0][c]+2*p[1][c])/3;}
+		for(int i=0;i<16;i++){
+			int best=0,best_d=INT_MAX;
+			for(int j=0;j<4;j++){
+				int dr=rgba[i*4]-p[j][0],dg=rgba[i*4+1]-p[j][1],db=rgba[i*4+2]-p[j][2];
+				int d=dr*dr+dg*dg+db*db;if(d<best_d){best_d=d;best=j;}}
+			indices|=(std::uint32_t)best<<(2*i);}}
+	out[0]=(std::uint8_t)(c0&255);out[1]=(std::uint8_t)(c0>>8);out[2]=(std::uint8_t)(c1&255);out[3]=(std::uint8_t)(c1>>8);
+	for(int k=0;k<4;k++)out[4+k]=(std::uint8_t)((indices>>(8*k))&255);
+}
+
+////values: 16 texels of one channel, read with the given stride
+inline void Encode_BC4_Block(const std::uint8_t* values,const int stride,std::uint8_t* out)
+{
+	int a0=0,a1=255;
+	for(int i=0;i<16;i++){int v=values[i*stride];a0=std::max(a0,v);a1=std::min(a1,v);}
+	std::uint64_t indices=0;
+	if(a0!=a1){	////a0>a1 selects the eight-value mode
+		int p[8]={a0,a1};
+		for(int k=1;k<=6;k++)p[k+1]=((7-k)*a0+k*a1)/7;
+		for(int i=0;i<16;i++){
+			int v=values[i*stride],best=0,best_d=INT_MAX;
+			for(int j=0;j<8;j++){int d=std::abs(v-p[j]);if(d<best_d){best_d=d;best=j;}}
+			indices|=(std::uint64_t)best<<(3*i);}}
+	out[0]=(std::uint8_t)a0;out[1]=(std::uint8_t)a1;
+	for(int k=0;k<6;k++)out[2+k]=(std::uint8_t)((indices>>(8*k))&255);
+}
+
+////Encodes a width x height RGBA8 image into out, which is resized to Level_Bytes. Edge blocks repeat the last row and column.
+inline void Encode(const Format format,const std::uint8_t* rgba,const int width,const int height,Array<std::uint8_t>& out)
+{
+	const int bw=(width+3)/4,bh=(height+3)/4,block_bytes=Block_Bytes(format);
+	out.resize(Level_Bytes(format,width,height));
+	Parallel::For(0,(size_type)bh,[&](const size_type by){
+		std::uint8_t block[64];
+		for(int bx=0;bx<bw;bx++){
+			for(int y=0;y<4;y++)for(int x=0;x<4;x++){
+				int sx=std::min(bx*4+x,width-1),sy=std::min((int)by*4+y,height-1);
+				std::memcpy(block+(y*4+x)*4,rgba+((size_type)sy*width+sx)*4,4);}
+			std::uint8_t* dst=out.data()+((size_type)by*bw+bx)*block_bytes;
+			switch(format){
+			case Format::BC1:Encode_BC1_Block(block,dst);break;
+			case Format::BC3:Encode_BC4_Block(block+3,4,dst);Encode_BC1_Block(block,dst+8);break;
+			case Format::BC5:Encode_BC4_Block(block,4,dst);Encode_BC4_Block(block+1,4,dst+8);break;
+			default:break;}}},16);
+}
+
+};
+
+#endif
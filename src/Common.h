@@ -87,6 +87,10 @@ template<class T_KEY> using Hashset=std::unordered_set<T_KEY>;
 template<class T1,class T2> using Pair=std::pair<T1,T2>;
 template<class T> using ArrayPtr=std::shared_ptr<Array<T> >;
 
+////Array with 16-byte aligned storage, for float streams consumed by SIMD code and GPU uploads
+template<class T> using AlignedArray=std::vector<T,Eigen::aligned_allocator<T> >;
+template<class T> using AlignedArrayPtr=std::shared_ptr<AlignedArray<T> >;
+
 using size_type=Array<int>::size_type;
 using uchar=unsigned char;
 using ushort=unsigned short;
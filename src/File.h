@@ -10,8 +10,13 @@
 #include <cstdio>
 #ifdef WIN32
 #include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #elif defined(__linux__) || defined(__APPLE__)
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 ////fix Windows compiling issues of min and max
@@ -161,5 +166,94 @@ inline bool File_Exists(const std::string& file_name)
 inline std::string File_Extension_Name(const std::string& file_name)
 {size_t p=file_name.rfind('.');if(p!=std::string::npos)return file_name.substr(p+1);else return "";}
 
+//////////////////////////////////////////////////////////////////////////
+////Hashing and memory-mapped reading
+
+////64-bit FNV-1a
+inline unsigned long long Hash_Bytes(const void* data,const size_t n,unsigned long long h=14695981039346656037ull)
+{const unsigned char* p=(const unsigned char*)data;for(size_t i=0;i<n;i++){h^=p[i];h*=1099511628211ull;}return h;}
+
+////Hash of the file content, 0 if the file cannot be read
+inline unsigned long long Hash_File(const std::string& file_name)
+{
+	std::ifstream input(file_name,std::ios::binary);if(!input)return 0;
+	unsigned long long h=14695981039346656037ull;char buffer[1<<16];
+	while(input){input.read(buffer,sizeof(buffer));std::streamsize n=input.gcount();if(n<=0)break;h=Hash_Bytes(buffer,(size_t)n,h);}
+	return h;
+}
+
+////Read-only view of a whole file. On Linux and macOS the file is mapped with mmap, so pages are only read when touched;
+////elsewhere the content is read into memory once.
+class MappedFile
+{
+public:
+	const char* data=nullptr;
+	size_t size=0;
+
+	MappedFile(){}
+	MappedFile(const std::string& file_name){Open(file_name);}
+	~MappedFile(){Close();}
+	MappedFile(const MappedFile&)=delete;
+	MappedFile& operator=(const MappedFile&)=delete;
+
+	bool Is_Open() const {return data!=nullptr;}
+
+#if defined(__linux__) || defined(__APPLE__)
+	bool Open(const std::string& file_name)
+	{
+		Close();
+		int fd=open(file_name.c_str(),O_RDONLY);if(fd<0)return false;
+		struct stat st;if(fstat(fd,&st)!=0||st.st_size<=0){close(fd);return false;}
+		void* ptr=mmap(nullptr,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);close(fd);
+		if(ptr==MAP_FAILED)return false;
+		data=(const char*)ptr;size=(size_t)st.st_size;
+		return true;
+	}
+	void Close(){if(data!=nullptr)munmap((void*)data,size);data=nullptr;size=0;}
+#else
+	Array<char> buffer;
+	bool Open(const std::string& file_name)
+	{
+		Close();
+		std::ifstream input(file_name,std::ios::binary|std::ios::ate);if(!input)return false;
+		std::streamsize n=input.tellg();if(n<=0)return false;
+		buffer.resize((size_t)n);input.seekg(0);input.read(buffer.data(),n);
+		data=buffer.data();size=(size_t)n;
+		return true;
+	}
+	void Close(){buffer.clear();data=nullptr;size=0;}
+#endif
+};
+
+////Modification time in seconds, 0 if the file does not exist
+inline long long File_Modified_Time(const std::string& file_name)
+{
+#if defined(__linux__) || defined(__APPLE__)
+	struct stat st;if(stat(file_name.c_str(),&st)!=0)return 0;return (long long)st.st_mtime;
+#else
+	struct _stat st;if(_stat(file_name.c_str(),&st)!=0)return 0;return (long long)st.st_mtime;
+#endif
+}
+
+////Size in bytes, 0 if the file does not exist
+inline long long File_Size(const std::string& file_name)
+{
+#if defined(__linux__) || defined(__APPLE__)
+	struct stat st;if(stat(file_name.c_str(),&st)!=0)return 0;return (long long)st.st_size;
+#else
+	struct _stat st;if(_stat(file_name.c_str(),&st)!=0)return 0;return (long long)st.st_size;
+#endif
+}
+
+////Moves src over dst in one step, so readers see either the old or the new dst and never a missing one
+inline bool Replace_File(const std::string& src,const std::string& dst)
+{
+#ifdef WIN32
+	return MoveFileExA(src.c_str(),dst.c_str(),MOVEFILE_REPLACE_EXISTING)!=0;
+#else
+	return std::rename(src.c_str(),dst.c_str())==0;
+#endif
+}
+
 };
 #endif
@@ -0,0 +1,159 @@
+//#####################################################################
+// Frame prefetcher
+// Background read-ahead of per-frame simulation files into a bounded ring
+//#####################################################################
+#ifndef __FramePrefetcher_h__
+#define __FramePrefetcher_h__
+#include <atomic>
+#include <memory>
+#include "Common.h"
+#include "File.h"
+#include "Parallel.h"
+
+////Bytes of decoded frames held by all prefetchers that share it
+class FrameMemoryBudget
+{public:
+	size_type limit;
+	std::atomic<size_type> used;
+	FrameMemoryBudget(const size_type _limit=(size_type)1<<30):limit(_limit),used(0){}
+};
+
+struct FramePrefetchStats
+{
+	size_type loaded=0;		////files decoded by the workers
+	size_type hits=0;		////frames that were ready when the renderer asked
+	size_type waits=0;		////frames the renderer blocked on
+	size_type dropped=0;	////frames that were not ready in real-time playback and were skipped
+	size_type evicted=0;	////decoded frames discarded unused, e.g., after a jump
+	size_type budget_stalls=0;	////read-ahead stopped early by the memory budget
+};
+
+////Non-templated interface, so the viewer can drive the prefetchers of all objects alike
+class FramePrefetcherBase
+{public:
+	int read_ahead=8;		////frames decoded ahead of the current one
+	bool realtime=false;	////never block the renderer; frames not ready in time are dropped
+
+	virtual ~FramePrefetcherBase(){}
+	////Queue the frames frame, frame+step, ..., frame+read_ahead*step that lie in [first_frame,last_frame]; last_frame=-1 is open-ended
+	virtual void Schedule(const int frame,const int step,const int first_frame,const int last_frame)=0;
+	////A copy of the counters, taken under the lock the workers update them with
+	virtual FramePrefetchStats Stats()=0;
+
+	////File readers block on disk, so they get their own small pool instead of the data-parallel one
+	static Parallel::ThreadPool& Io_Pool(){static Parallel::ThreadPool pool(2);return pool;}
+
+protected:
+	FramePrefetchStats stats;
+};
+
+////Ring of read_ahead+1 slots, each holding one decoded frame. Workers decode into a slot, the render thread takes it with Acquire.
+////The hand-off swaps buffers with the object's data instead of copying, so the slot keeps the previous frame's allocations
+////and the next read reuses them.
+template<class T_DATA> class FramePrefetcher : public FramePrefetcherBase
+{
+public:
+	////Reads one frame file into data; data holds an older frame whose buffers may be reused
+	std::function<bool(const std::string&,T_DATA&)> read=[](const std::string& file_name,T_DATA& data){return File::Read_Binary_From_File(file_name,data);};
+
+	FramePrefetcher(const std::string& _output_dir,const std::string& _name,const int _read_ahead,std::shared_ptr<FrameMemoryBudget> _budget)
+		:output_dir(_output_dir),name(_name),budget(_budget)
+	{
+		read_ahead=std::max(0,_read_ahead);
+		if(budget==nullptr)budget=std::make_shared<FrameMemoryBudget>();
+		slots.resize(read_ahead+1);for(auto& s:slots)s=std::make_shared<Slot>();
+	}
+
+	////In-flight reads reference the slots, so wait for them
+	~FramePrefetcher()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cv.wait(lock,[this](){for(auto& s:slots)if(s->state==State::Loading)return false;return true;});
+		for(auto& s:slots)if(s->state==State::Ready)budget->used-=s->bytes;
+	}
+
+	virtual void Schedule(const int frame,const int step,const int first_frame,const int last_frame)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		Schedule_Locked(frame,step,first_frame,last_frame,read_ahead);
+	}
+
+	////Hands frame over to target with handoff(loaded,target), which must leave the new frame in target.
+	////Returns false, leaving target untouched, if the file does not exist or, in real-time mode, if the frame is not decoded yet.
+	bool Acquire(const int frame,T_DATA& target,const std::function<void(T_DATA&,T_DATA&)>& handoff)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		std::shared_ptr<Slot> s=Find(frame);
+		if(s==nullptr||s->state==State::Loading){
+			if(realtime){stats.dropped++;return false;}
+			if(s==nullptr){Schedule_Locked(frame,1,frame,frame,0);s=Find(frame);if(s==nullptr)return false;}
+			stats.waits++;
+			cv.wait(lock,[&s](){return s->state!=State::Loading;});}
+		else stats.hits++;
+
+		bool ready=(s->state==State::Ready);
+		if(ready){handoff(s->data,target);budget->used-=s->bytes;}
+		s->state=State::Empty;s->frame=-1;s->bytes=0;
+		return ready;
+	}
+
+	virtual FramePrefetchStats Stats(){std::lock_guard<std::mutex> lock(mtx);return stats;}
+
+	size_type Memory_Used() const {return budget->used;}
+
+protected:
+	enum class State : int {Empty=0,Loading,Ready,Failed};
+	struct Slot
+	{
+		int frame=-1;
+		State state=State::Empty;
+		size_type bytes=0;
+		T_DATA data;
+	};
+
+	std::string output_dir;
+	std::string name;
+	std::shared_ptr<FrameMemoryBudget> budget;
+	Array<std::shared_ptr<Slot> > slots;
+	size_type last_bytes=0;		////size of the last decoded frame, the estimate for the next one
+	std::mutex mtx;
+	std::condition_variable cv;
+
+	std::shared_ptr<Slot> Find(const int frame) const
+	{for(auto& s:slots)if(s->frame==frame&&s->state!=State::Empty)return s;return nullptr;}
+
+	////A slot that may be overwritten: empty, failed or holding a frame outside the window; never one that is being read
+	std::shared_ptr<Slot> Free_Slot(const int frame,const int step,const int ahead) const
+	{
+		std::shared_ptr<Slot> candidate=nullptr;
+		for(auto& s:slots){
+			if(s->state==State::Loading)continue;
+			if(s->state==State::Empty||s->state==State::Failed)return s;
+			int k=(s->frame-frame)*step;
+			if((k<0||k>ahead)&&candidate==nullptr)candidate=s;}
+		return candidate;
+	}
+
+	void Schedule_Locked(const int frame,const int step,const int first_frame,const int last_frame,const int ahead)
+	{
+		for(int k=0;k<=ahead;k++){int f=frame+k*step;
+			if(f<first_frame||(last_frame!=-1&&f>last_frame))break;
+			if(Find(f)!=nullptr)continue;
+			////the frame asked for is always read; read-ahead stops at the budget
+			if(k>0&&budget->used+last_bytes>budget->limit){stats.budget_stalls++;break;}
+			std::shared_ptr<Slot> s=Free_Slot(frame,step,ahead);if(s==nullptr)break;
+			if(s->state==State::Ready){budget->used-=s->bytes;stats.evicted++;}
+			s->frame=f;s->state=State::Loading;s->bytes=0;
+			std::string file_name=output_dir+"/"+std::to_string(f)+"/"+name;
+			Io_Pool().Enqueue([this,s,file_name](){
+				bool success=read(file_name,s->data);
+				size_type bytes=success?(size_type)File::File_Size(file_name):0;
+				////notify under the lock: once it is released the destructor may run
+				std::lock_guard<std::mutex> lock(mtx);
+				s->state=success?State::Ready:State::Failed;s->bytes=bytes;
+				if(success){budget->used+=bytes;last_bytes=bytes;stats.loaded++;}
+				cv.notify_all();});}
+	}
+};
+
+#endif
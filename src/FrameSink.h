@@ -0,0 +1,235 @@
+//#####################################################################
+// Frame sinks
+// Output formats for captured RGB8 frames: PNG and QOI files, raw RGB and Y4M streams into one file or an encoder pipe
+//#####################################################################
+#ifndef __FrameSink_h__
+#define __FrameSink_h__
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <iostream>
+#include "Common.h"
+#ifdef USE_STB
+#include "StbImage.h"
+#endif
+
+////Write runs on capture workers, concurrently and in any frame order; index counts the frames given to the sink from 0.
+////File sinks write one file per frame named file_name plus Extension(); stream sinks ignore the name and append frames in index order.
+class FrameSink
+{
+public:
+	size_type frame_num=0;		////frames given to the sink so far; the next index, advanced by the capturing thread
+
+	virtual ~FrameSink(){}
+	virtual bool Write(const size_type index,const std::string& file_name,const int w,const int h,const unsigned char* rgb)=0;
+	virtual void Skip(const size_type index){}	////a frame that could not be read back
+	virtual std::string Extension() const {return "";}
+	virtual bool Is_Stream() const {return false;}
+	virtual void Flush(){}
+	virtual void Close(){}
+};
+
+////stb's deflate, one frame per worker. stb keeps the level and filter in globals, so writes with the same settings run concurrently
+////and a write with other settings waits until those in flight finish, then switches them; the defaults are stb's own.
+class PngSink : public FrameSink
+{
+public:
+	int level=8;
+	int filter=-1;
+
+	PngSink(){}
+	PngSink(const int _level,const int _filter=-1):level(_level),filter(_filter){}
+
+	virtual bool Write(const size_type index,const std::string& file_name,const int w,const int h,const unsigned char* rgb)
+	{
+#ifdef USE_STB
+		Settings& settings=Settings::Instance();
+		{std::unique_lock<std::mutex> lock(settings.mtx);
+		settings.cv.wait(lock,[&](){return settings.writing==0||(settings.level==level&&settings.filter==filter);});
+		if(settings.writing==0){Stb::Set_Png_Compression_Level(level);Stb::Set_Png_Filter(filter);settings.level=level;settings.filter=filter;}
+		settings.writing++;}
+		bool ok=Stb::Write_Png((file_name+Extension()).c_str(),w,h,3,rgb,0)!=0;
+		{std::lock_guard<std::mutex> lock(settings.mtx);settings.writing--;}
+		settings.cv.notify_all();
+		return ok;
+#else
+		std::cerr<<"Error: [PngSink] stb is required for image io"<<std::endl;return false;
+#endif
+	}
+
+	virtual std::string Extension() const {return ".png";}
+
+protected:
+	////The stb globals of the writes in flight
+	struct Settings
+	{
+		std::mutex mtx;
+		std::condition_variable cv;
+		int level=8,filter=-1,writing=0;
+		static Settings& Instance(){static Settings settings;return settings;}
+	};
+};
+
+////The Quite OK Image format (qoiformat.org): lossless, a single pass with a 64-entry color cache, runs and small deltas;
+////several times faster to encode than PNG at a somewhat larger size
+class QoiSink : public FrameSink
+{
+public:
+	static void Encode(const unsigned char* rgb,const int w,const int h,Array<std::uint8_t>& out)
+	{
+		out.clear();out.reserve((size_type)w*h*4+22);
+		const char magic[4]={'q','o','i','f'};out.insert(out.end(),magic,magic+4);
+		auto put32=[&out](const std::uint32_t v){for(int k=3;k>=0;k--)out.push_back((std::uint8_t)(v>>(8*k)));};
+		put32((std::uint32_t)w);put32((std::uint32_t)h);out.push_back(3);out.push_back(0);	////RGB, sRGB
+
+		std::uint8_t index[64][3];std::uint64_t cached=0;	////the cache starts as transparent black, which no opaque texel matches
+		std::uint8_t prev[3]={0,0,0};int run=0;
+		const size_type n=(size_type)w*h;
+		for(size_type i=0;i<n;i++){const std::uint8_t* p=rgb+i*3;
+			if(p[0]==prev[0]&&p[1]==prev[1]&&p[2]==prev[2]){
+				run++;if(run==62||i==n-1){out.push_back((std::uint8_t)(0xc0|(run-1)));run=0;}
+				continue;}
+			if(run>0){out.push_back((std::uint8_t)(0xc0|(run-1)));run=0;}
+			int h_i=(p[0]*3+p[1]*5+p[2]*7+255*11)%64;
+			if((cached>>h_i&1)&&index[h_i][0]==p[0]&&index[h_i][1]==p[1]&&index[h_i][2]==p[2])out.push_back((std::uint8_t)h_i);
+			else{
+				std::memcpy(index[h_i],p,3);cached|=(std::uint64_t)1<<h_i;
+				signed char vr=(signed char)(p[0]-prev[0]),vg=(signed char)(p[1]-prev[1]),vb=(signed char)(p[2]-prev[2]);
+				int vg_r=vr-vg,vg_b=vb-vg;
+				if(vr>-3&&vr<2&&vg>-3&&vg<2&&vb>-3&&vb<2)out.push_back((std::uint8_t)(0x40|(vr+2)<<4|(vg+2)<<2|(vb+2)));
+				else if(vg_r>-9&&vg_r<8&&vg>-33&&vg<32&&vg_b>-9&&vg_b<8){out.push_back((std::uint8_t)(0x80|(vg+32)));out.push_back((std::uint8_t)((vg_r+8)<<4|(vg_b+8)));}
+				else{out.push_back(0xfe);out.push_back(p[0]);out.push_back(p[1]);out.push_back(p[2]);}}
+			std::memcpy(prev,p,3);}
+		for(int k=0;k<7;k++)out.push_back(0);
+		out.push_back(1);
+	}
+
+	virtual bool Write(const size_type index,const std::string& file_name,const int w,const int h,const unsigned char* rgb)
+	{
+		Array<std::uint8_t> bytes;Encode(rgb,w,h,bytes);
+		std::FILE* file=std::fopen((file_name+Extension()).c_str(),"wb");if(file==nullptr)return false;
+		bool ok=std::fwrite(bytes.data(),1,bytes.size(),file)==bytes.size();
+		return std::fclose(file)==0&&ok;
+	}
+
+	virtual std::string Extension() const {return ".qoi";}
+};
+
+////Frames appended to one growing file, or written into the standard input of a command when pipe is set, e.g.,
+////"ffmpeg -f rawvideo -pix_fmt rgb24 -s 1280x960 -r 30 -i - out.mp4" for Raw or "ffmpeg -i - out.mp4" for Y4m.
+////Raw is headerless top-down RGB24 and lossless; Y4m carries the size and rate and stores BT.601 YCbCr 4:4:4.
+////Frames finishing out of order wait in pending until their predecessors are written; all frames must have the first frame's size.
+class StreamSink : public FrameSink
+{
+public:
+	enum class Format{Raw,Y4m};
+
+	StreamSink(const std::string& _path,const Format _format,const int _fps=30,const bool _pipe=false)
+		:path(_path),format(_format),fps(_fps),pipe(_pipe){}
+	virtual ~StreamSink(){Close();}
+
+	virtual bool Write(const size_type index,const std::string& file_name,const int w,const int h,const unsigned char* rgb)
+	{
+		Array<std::uint8_t> bytes;
+		if(format==Format::Y4m)To_Y4m_Frame(rgb,w,h,bytes);
+		std::lock_guard<std::mutex> lock(mtx);
+		if(!Open(w,h)||w!=width||h!=height){
+			if(file!=nullptr)std::cerr<<"Error: [StreamSink] Frame "<<index<<" is "<<w<<"x"<<h<<", the stream "<<width<<"x"<<height<<std::endl;
+			pending[index]=Array<std::uint8_t>();Write_Pending();return false;}
+		if(index==next){	////in order, written from the worker's image without a copy
+			bool ok=Put(format==Format::Raw?rgb:bytes.data(),format==Format::Raw?(size_type)w*h*3:bytes.size());
+			next++;Write_Pending();return ok;}
+		if(format==Format::Raw)bytes.assign(rgb,rgb+(size_type)w*h*3);
+		pending[index]=std::move(bytes);
+		return true;
+	}
+
+	virtual void Skip(const size_type index)
+	{std::lock_guard<std::mutex> lock(mtx);pending[index]=Array<std::uint8_t>();Write_Pending();}
+
+	virtual bool Is_Stream() const {return true;}
+	virtual void Flush(){std::lock_guard<std::mutex> lock(mtx);if(file!=nullptr)std::fflush(file);}
+
+	virtual void Close()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if(!pending.empty())std::cerr<<"Error: [StreamSink] "<<pending.size()<<" frames after a missing one are not written to "<<path<<std::endl;
+		pending.clear();
+		if(file==nullptr)return;
+#ifndef _WIN32
+		if(pipe)pclose(file);else
+#endif
+		std::fclose(file);
+		file=nullptr;
+	}
+
+	////BT.601 studio range, planar Y, Cb, Cr after the frame header
+	static void To_Y4m_Frame(const unsigned char* rgb,const int w,const int h,Array<std::uint8_t>& out)
+	{
+		const char header[]="FRAME\n";const size_type n=(size_type)w*h,header_size=sizeof(header)-1;
+		out.resize(header_size+n*3);std::memcpy(out.data(),header,header_size);
+		std::uint8_t* y=out.data()+header_size;std::uint8_t* cb=y+n;std::uint8_t* cr=cb+n;
+		for(size_type i=0;i<n;i++){int r=rgb[i*3],g=rgb[i*3+1],b=rgb[i*3+2];
+			y[i]=(std::uint8_t)(((66*r+129*g+25*b+128)>>8)+16);
+			cb[i]=(std::uint8_t)(((-38*r-74*g+112*b+128)>>8)+128);
+			cr[i]=(std::uint8_t)(((112*r-94*g-18*b+128)>>8)+128);}
+	}
+
+protected:
+	std::string path;
+	Format format;
+	int fps;
+	bool pipe;
+	std::FILE* file=nullptr;
+	bool failed=false;
+	int width=0,height=0;
+	size_type next=0;
+	Hashtable<size_type,Array<std::uint8_t> > pending;		////finished frames waiting for an earlier one; empty for skipped frames
+	std::mutex mtx;
+
+	////Under mtx; opens the stream at the first frame
+	bool Open(const int w,const int h)
+	{
+		if(file!=nullptr)return true;
+		if(failed)return false;
+#ifndef _WIN32
+		file=pipe?popen(path.c_str(),"w"):std::fopen(path.c_str(),"wb");
+#else
+		file=pipe?nullptr:std::fopen(path.c_str(),"wb");
+#endif
+		if(file==nullptr){failed=true;std::cerr<<"Error: [StreamSink] Cannot open "<<path<<std::endl;return false;}
+		width=w;height=h;
+		if(format==Format::Y4m)std::fprintf(file,"YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",w,h,fps);
+		return true;
+	}
+
+	////Under mtx
+	bool Put(const std::uint8_t* data,const size_type size)
+	{return file!=nullptr&&std::fwrite(data,1,size,file)==size;}
+
+	////Under mtx; writes the frames that follow the written ones
+	void Write_Pending()
+	{
+		for(auto iter=pending.find(next);iter!=pending.end();iter=pending.find(next)){
+			if(!iter->second.empty())Put(iter->second.data(),iter->second.size());
+			pending.erase(iter);next++;}
+	}
+};
+
+////"png", "qoi", "raw" or "y4m"; file sinks are returned without a path, stream sinks write to path or, with pipe, into that command
+inline std::shared_ptr<FrameSink> Create_Frame_Sink(const std::string& format,const std::string& path="",const bool pipe=false,
+	const int fps=30,const int png_level=8)
+{
+	if(format=="png")return std::make_shared<PngSink>(png_level);
+	if(format=="qoi")return std::make_shared<QoiSink>();
+	if(format=="raw")return std::make_shared<StreamSink>(path,StreamSink::Format::Raw,fps,pipe);
+	if(format=="y4m")return std::make_shared<StreamSink>(path,StreamSink::Format::Y4m,fps,pipe);
+	std::cerr<<"Error: [FrameSink] Unknown format "<<format<<", using png"<<std::endl;
+	return std::make_shared<PngSink>(png_level);
+}
+
+#endif
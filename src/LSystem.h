@@ -0,0 +1,197 @@
+//#####################################################################
+// L-system
+// Rule-table L-systems expanded depth-first and interpreted by a turtle into ribbon segments
+//#####################################################################
+#ifndef __LSystem_h__
+#define __LSystem_h__
+#include <string>
+#include <cstdio>
+#include <climits>
+#include "Common.h"
+#include "Parallel.h"
+
+////The expanded string is never built: a stack of (production, position, remaining iterations) frames, at most iterations+1 deep,
+////walks the derivation tree depth-first and hands each leaf symbol to the turtle.
+////Turtle commands, with rotations about the world axes:
+////	+ -		rotate the heading by +/-angle about z
+////	& ^		rotate the heading by +/-angle about x
+////	[ ]		push/pop position and heading
+////	draw_symbols	emit a segment of segment_length along the heading and move to its end
+////	move_symbols	move without drawing
+////Every segment is a quad of 4 vertices: its two ends and the same points shifted by segment_offset, split into 2 triangles.
+////
+////Per symbol and iteration count the tables hold the number of segments of its expansion, its bracket depth and its effect on the
+////turtle, which is linear in the heading h: pos+=S*h, h=M*h. Generate uses them to size the output exactly and to hand
+////subtrees with their start state and output offset to threads, which then fill disjoint ranges of the arrays.
+class LSystem
+{public:
+	std::string axiom;
+	real angle=(real)25*(real)M_PI/(real)180;
+	real segment_length=(real).025;
+	Vector3 segment_offset=Vector3((real).02,(real)0,(real)0);
+	std::string draw_symbols="F";
+	std::string move_symbols="f";
+	size_type min_task_segments=1<<12;	////subtrees smaller than this are not split among threads
+
+	LSystem(const std::string& _axiom=""):axiom(_axiom){}
+
+	////A symbol has at most one rule; adding another replaces it
+	void Add_Rule(const char symbol,const std::string& production){rules[symbol]=production;compiled_iterations=-1;}
+	void Clear_Rules(){rules.clear();compiled_iterations=-1;}
+
+	////Number of segments after the given iterations, without expanding
+	size_type Segment_Num(const int iterations)
+	{Compile(iterations);size_type n=0;for(char c:axiom)n+=Table(c,iterations).segment_num;return n;}
+
+	////Writes the segments into vertices and elements, which are resized once to their final sizes
+	bool Generate(const int iterations,const Vector3& origin,const Vector3& heading,Array<Vector3>& vertices,Array<Vector3i>& elements)
+	{
+		size_type segment_num=Segment_Num(iterations);
+		if(segment_num>(size_type)INT_MAX/4){std::cerr<<"Error: [LSystem] "<<segment_num<<" segments exceed the index range"<<std::endl;return false;}
+		vertices.resize(segment_num*4);elements.resize(segment_num*2);
+		Turtle turtle;turtle.pos=origin;turtle.heading=heading;
+
+		if(!balanced){	////unbalanced brackets leave the state of a subtree to its context, so it runs serially
+			Interpret(axiom.data(),axiom.data()+axiom.size(),iterations,turtle,0,vertices,elements);return true;}
+
+		Array<Task> tasks;size_type offset=0;Array<Turtle> stack;
+		size_type grain=std::max(min_task_segments,segment_num/(size_type)(4*Parallel::Thread_Num())+1);
+		Split(axiom.data(),axiom.data()+axiom.size(),iterations,grain,turtle,stack,offset,tasks,vertices,elements);
+		Parallel::For(0,tasks.size(),[&](const size_type i){
+			const Task& t=tasks[i];Turtle turtle=t.turtle;
+			Interpret(&t.symbol,&t.symbol+1,t.iterations,turtle,t.offset,vertices,elements);},1);
+		return true;
+	}
+
+protected:
+	struct Turtle{Vector3 pos;Vector3 heading;};
+	struct Frame{const char* ptr;const char* end;int iterations;};
+	struct Task{char symbol;int iterations;Turtle turtle;size_type offset;};
+	struct Entry
+	{
+		size_type segment_num=0;
+		int bracket_net=0;		////pushes minus pops
+		int bracket_max=0;		////deepest stack reached, relative to the start
+		Matrix3 M=Matrix3::Identity();	////heading change
+		Matrix3 S=Matrix3::Zero();		////position change per unit heading
+	};
+
+	Hashtable<char,std::string> rules;
+	int rule_begin[256];	////rules compiled into one string, indexed by symbol
+	int rule_size[256];		////-1 if the symbol has no rule
+	std::string productions;
+	Array<Entry> table;		////[iterations*256+symbol]
+	int compiled_iterations=-1;
+	std::string compiled_key;	////turtle parameters the table was built with
+	int stack_size=0;		////turtle stack bound over the whole axiom
+	bool balanced=true;		////every production pushes as often as it pops and never pops below its own start
+
+	static int Idx(const char c){return (int)(unsigned char)c;}
+	bool Has_Rule(const char c) const {return rule_size[Idx(c)]>=0;}
+	const Entry& Table(const char c,const int iterations) const {return table[iterations*256+Idx(c)];}
+
+	Matrix3 Rotation(const char c) const
+	{
+		switch(c){
+		case '+':return AngleAxis(angle,Vector3::UnitZ()).toRotationMatrix();
+		case '-':return AngleAxis(-angle,Vector3::UnitZ()).toRotationMatrix();
+		case '&':return AngleAxis(angle,Vector3::UnitX()).toRotationMatrix();
+		case '^':return AngleAxis(-angle,Vector3::UnitX()).toRotationMatrix();
+		default:return Matrix3::Identity();}
+	}
+
+	////Round-trips the value, so a change in the last bit recompiles the tables
+	static std::string Exact_String(const real v){char s[32];std::snprintf(s,sizeof(s),"%.17g",(double)v);return s;}
+
+	bool Is_Draw(const char c) const {return draw_symbols.find(c)!=std::string::npos;}
+	bool Is_Move(const char c) const {return move_symbols.find(c)!=std::string::npos;}
+
+	////Entries of all symbols for 0..iterations, each level from the one below: a production is the composition of its symbols
+	void Compile(const int iterations)
+	{
+		std::string key=Exact_String(angle)+"|"+Exact_String(segment_length)+"|"+draw_symbols+"|"+move_symbols+"|"+axiom;
+		if(compiled_iterations>=iterations&&key==compiled_key)return;
+		productions.clear();for(int i=0;i<256;i++){rule_begin[i]=0;rule_size[i]=-1;}
+		for(const auto& r:rules){rule_begin[Idx(r.first)]=(int)productions.size();rule_size[Idx(r.first)]=(int)r.second.size();productions+=r.second;}
+		table.assign((size_type)(iterations+1)*256,Entry());
+		for(int i=0;i<256;i++){char c=(char)i;Entry& e=table[i];
+			if(c=='['){e.bracket_net=1;e.bracket_max=1;}
+			else if(c==']')e.bracket_net=-1;
+			else if(c=='+'||c=='-'||c=='&'||c=='^')e.M=Rotation(c);
+			else if(Is_Draw(c)||Is_Move(c)){e.segment_num=Is_Draw(c)?1:0;e.S=Matrix3::Identity()*segment_length;}}
+
+		////a production that closes a bracket it did not open, e.g., "][", pops its context's state even if it nets to zero
+		balanced=true;
+		for(int i=0;i<256;i++)if(rule_size[i]>=0){int net=0;
+			for(int k=0;k<rule_size[i];k++){char s=productions[rule_begin[i]+k];net+=(s=='[')?1:(s==']')?-1:0;
+				if(net<0)balanced=false;}
+			if(net!=0)balanced=false;}
+
+		for(int n=1;n<=iterations;n++)for(int i=0;i<256;i++){
+			Entry& e=table[n*256+i];
+			if(rule_size[i]<0){e=table[i];continue;}
+			Array<std::pair<Matrix3,Matrix3> > saved;	////turtle effects at the open brackets, restored at the closing ones
+			for(int k=0;k<rule_size[i];k++){char c=productions[rule_begin[i]+k];const Entry& s=Table(c,n-1);
+				e.segment_num+=s.segment_num;
+				e.bracket_max=std::max(e.bracket_max,e.bracket_net+s.bracket_max);e.bracket_net+=s.bracket_net;
+				if(c=='['){saved.push_back(std::make_pair(e.M,e.S));continue;}
+				if(c==']'){if(!saved.empty()){e.M=saved.back().first;e.S=saved.back().second;saved.pop_back();}continue;}
+				////pos+=S_e*h; h=M_e*h; then pos+=S_s*h; h=M_s*h
+				e.S+=s.S*e.M;e.M=s.M*e.M;}}
+
+		stack_size=0;int net=0;
+		for(char c:axiom){stack_size=std::max(stack_size,net+Table(c,iterations).bracket_max);net+=Table(c,iterations).bracket_net;}
+		compiled_iterations=iterations;compiled_key=key;
+	}
+
+	void Apply(const char c,Turtle& turtle,Array<Turtle>& stack,size_type& offset,Array<Vector3>& vertices,Array<Vector3i>& elements) const
+	{
+		if(c=='['){stack.push_back(turtle);return;}
+		if(c==']'){if(!stack.empty()){turtle=stack.back();stack.pop_back();}return;}
+		if(Is_Draw(c)){Emit(turtle,offset++,vertices,elements);return;}
+		const Entry& e=Table(c,0);
+		turtle.pos+=e.S*turtle.heading;turtle.heading=e.M*turtle.heading;
+	}
+
+	void Emit(Turtle& turtle,const size_type offset,Array<Vector3>& vertices,Array<Vector3i>& elements) const
+	{
+		Vector3 next_pos=turtle.pos+turtle.heading*segment_length;
+		int v=(int)offset*4;
+		vertices[v]=turtle.pos;vertices[v+1]=turtle.pos+segment_offset;
+		vertices[v+2]=next_pos;vertices[v+3]=next_pos+segment_offset;
+		elements[offset*2]=Vector3i(v,v+1,v+2);elements[offset*2+1]=Vector3i(v+1,v+3,v+2);
+		turtle.pos=next_pos;
+	}
+
+	////Depth-first expansion of [begin,end) with the given iterations; segments are written from offset on
+	void Interpret(const char* begin,const char* end,const int iterations,Turtle& turtle,size_type offset,Array<Vector3>& vertices,Array<Vector3i>& elements) const
+	{
+		Array<Frame> frames;frames.reserve(iterations+1);frames.push_back(Frame{begin,end,iterations});
+		Array<Turtle> stack;stack.reserve(stack_size);
+		while(!frames.empty()){
+			Frame& f=frames.back();
+			if(f.ptr==f.end){frames.pop_back();continue;}
+			char c=*f.ptr++;
+			if(f.iterations>0&&Has_Rule(c)){int r=Idx(c);
+				frames.push_back(Frame{productions.data()+rule_begin[r],productions.data()+rule_begin[r]+rule_size[r],f.iterations-1});}
+			else Apply(c,turtle,stack,offset,vertices,elements);}
+	}
+
+	////Walks the top of the derivation tree serially: subtrees with at most grain segments become tasks started from the current
+	////turtle, larger ones are split further, and the turtle skips over each task with the tabulated effect
+	void Split(const char* begin,const char* end,const int iterations,const size_type grain,Turtle& turtle,Array<Turtle>& stack,
+		size_type& offset,Array<Task>& tasks,Array<Vector3>& vertices,Array<Vector3i>& elements) const
+	{
+		for(const char* p=begin;p!=end;p++){char c=*p;
+			if(iterations==0||!Has_Rule(c)){Apply(c,turtle,stack,offset,vertices,elements);continue;}
+			const Entry& e=Table(c,iterations);
+			if(e.segment_num>grain){int r=Idx(c);
+				Split(productions.data()+rule_begin[r],productions.data()+rule_begin[r]+rule_size[r],iterations-1,grain,turtle,stack,offset,tasks,vertices,elements);
+				continue;}
+			if(e.segment_num>0)tasks.push_back(Task{c,iterations,turtle,offset});
+			turtle.pos+=e.S*turtle.heading;turtle.heading=e.M*turtle.heading;
+			offset+=e.segment_num;}
+	}
+};
+
+#endif
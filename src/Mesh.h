@@ -1,8 +1,12 @@
 #ifndef __Mesh_h__
 #define __Mesh_h__
 #include <fstream>
+#include <atomic>
+#include <cassert>
 #include "Common.h"
 #include "File.h"
+#include "MeshAttributes.h"
+#include "Parallel.h"
 #include "mikktspace.h"
 
 ////Simplicial mesh
@@ -24,6 +28,12 @@ public:
 
 	std::vector<VectorEi> elements;
 
+	////Optional float32 attribute store, see MeshAttributes.h
+	std::shared_ptr<MeshAttributes<d> > attributes_f=nullptr;
+
+	////Attributes and vertex range changed since the last upload
+	MeshDirtyState dirty;
+
 	////Constructors
 	SimplicialMesh(
 		const ArrayPtr<VectorD> _vertices=nullptr, 
@@ -54,9 +64,10 @@ public:
 
 	////Copy constructor
 	SimplicialMesh(const SimplicialMesh<d,e_d>& copy){*this=copy;}
+	////Arrays aliased by other meshes (see Share) are replaced, not written through
 	SimplicialMesh<d,e_d>& operator=(const SimplicialMesh<d,e_d>& copy)
 	{
-		if(vertices==nullptr)vertices=std::make_shared<std::vector<VectorD> >();
+		Make_Owned(vertices);Make_Owned(normals);Make_Owned(uvs);Make_Owned(tangents);Make_Owned(weights);Make_Owned(joints);
 		*vertices=*(copy.vertices);
 		*normals=*(copy.normals);
 		*uvs=*(copy.uvs);
@@ -65,41 +76,134 @@ public:
 		*joints =*(copy.joints);
 
 		elements=copy.elements;
+		if(copy.attributes_f!=nullptr)attributes_f=std::make_shared<MeshAttributes<d> >(*copy.attributes_f);
+		else attributes_f=nullptr;
+		dirty.Set();
 		return *this;
 	}
 
 	////Access attributes
 	static constexpr int Dim() {return d;}
 	static constexpr int Element_Dim() {return e_d;}
-	virtual std::vector<VectorD>& Vertices(){return *vertices.get();}
-	virtual const std::vector<VectorD>& Vertices() const {return *vertices.get();}
-	virtual std::vector<VectorD>& Normals() { return *normals.get(); }
-	virtual const std::vector<VectorD>& Normals() const { return *normals.get(); }
-	virtual std::vector<Vector2>& Uvs() { return *uvs.get(); }
-	virtual const std::vector<Vector2>& Uvs() const { return *uvs.get(); }
-	virtual std::vector<Vector4>& Tangents() { return *tangents.get(); }
-	virtual const std::vector<Vector4>& Tangents() const { return *tangents.get(); }
-	virtual std::vector<Vector4>& Weights() { return *weights.get(); }
-	virtual const std::vector<Vector4>& Weights() const { return *weights.get(); }
-	virtual std::vector<Vector4i>& Joints() { return *joints.get(); }
-	virtual const std::vector<Vector4i>& Joints() const { return *joints.get(); }
+	////The accessors hand out the arrays as they are, also when they are aliased by other meshes (see Share): reads keep the mesh
+	////shared, and writes through them reach every mesh aliasing the array. Edit a shared array through the Edit_* accessors below.
+	////After Release_Real_Attributes they return empty arrays, which is reported as an error (see Real_Attributes_Released).
+	virtual std::vector<VectorD>& Vertices(){Check_Real_Attributes();return *vertices.get();}
+	virtual const std::vector<VectorD>& Vertices() const {Check_Real_Attributes();return *vertices.get();}
+	virtual std::vector<VectorD>& Normals() {Check_Real_Attributes();return *normals.get();}
+	virtual const std::vector<VectorD>& Normals() const {Check_Real_Attributes();return *normals.get();}
+	virtual std::vector<Vector2>& Uvs() {Check_Real_Attributes();return *uvs.get();}
+	virtual const std::vector<Vector2>& Uvs() const {Check_Real_Attributes();return *uvs.get();}
+	virtual std::vector<Vector4>& Tangents() {Check_Real_Attributes();return *tangents.get();}
+	virtual const std::vector<Vector4>& Tangents() const {Check_Real_Attributes();return *tangents.get();}
+	virtual std::vector<Vector4>& Weights() {Check_Real_Attributes();return *weights.get();}
+	virtual const std::vector<Vector4>& Weights() const {Check_Real_Attributes();return *weights.get();}
+	virtual std::vector<Vector4i>& Joints() {Check_Real_Attributes();return *joints.get();}
+	virtual const std::vector<Vector4i>& Joints() const {Check_Real_Attributes();return *joints.get();}
 	virtual std::vector<VectorEi>& Elements(){return elements;}
 	virtual const std::vector<VectorEi>& Elements() const {return elements;}
 
+	////Arrays aliased by other meshes are replaced by empty ones, not cleared
 	virtual void Clear()
 	{
-		if (vertices)vertices->clear();
-		if (normals)normals->clear();
-		if (uvs)uvs->clear();
-		if (tangents)tangents->clear();
-		if (weights)weights->clear();
-		if (joints)joints->clear();
+		Make_Owned(vertices);vertices->clear();
+		Make_Owned(normals);normals->clear();
+		Make_Owned(uvs);uvs->clear();
+		Make_Owned(tangents);tangents->clear();
+		Make_Owned(weights);weights->clear();
+		Make_Owned(joints);joints->clear();
 		elements.clear();
+		if (attributes_f){if(attributes_f.use_count()>1)attributes_f=std::make_shared<MeshAttributes<d> >();else attributes_f->Clear();}
+		dirty.Set();
+	}
+
+	////Mark attributes (bits of MeshAttributeFlag) as changed in the vertex range [begin,end)
+	void Set_Dirty(const unsigned int attributes=MeshAttributeFlag::All,const size_type begin=0,const size_type end=MeshDirtyState::max_end)
+	{dirty.Set(attributes,begin,end);}
+
+	////Shared attributes
+	////Share aliases the attribute arrays of src instead of copying them; only the elements are copied.
+	void Share(const SimplicialMesh<d,e_d>& src)
+	{
+		vertices=src.vertices;normals=src.normals;uvs=src.uvs;tangents=src.tangents;weights=src.weights;joints=src.joints;
+		elements=src.elements;attributes_f=src.attributes_f;
+		dirty.Set();
+	}
+
+	////True while every attribute array is still the one of src, i.e., no array was detached since Share
+	bool Aliases(const SimplicialMesh<d,e_d>& src) const
+	{
+		return vertices==src.vertices&&normals==src.normals&&uvs==src.uvs&&tangents==src.tangents&&
+			weights==src.weights&&joints==src.joints;
+	}
+
+	bool Is_Shared() const
+	{
+		return vertices.use_count()>1||normals.use_count()>1||uvs.use_count()>1||tangents.use_count()>1||
+			weights.use_count()>1||joints.use_count()>1||(attributes_f!=nullptr&&attributes_f.use_count()>1);
+	}
+
+	////Copy-on-write: deep-copies the arrays that are aliased by other meshes
+	void Make_Unique()
+	{
+		Make_Unique(vertices);Make_Unique(normals);Make_Unique(uvs);Make_Unique(tangents);Make_Unique(weights);Make_Unique(joints);
+		if(attributes_f!=nullptr)Make_Unique(attributes_f);
+	}
+	template<class T> static void Make_Unique(std::shared_ptr<T>& ptr){if(ptr.use_count()>1)ptr=std::make_shared<T>(*ptr);}
+	template<class T> static void Make_Owned(std::shared_ptr<T>& ptr){if(ptr==nullptr||ptr.use_count()>1)ptr=std::make_shared<T>();}
+
+	////Write access with copy-on-write: an array aliased by other meshes is copied first, so the edit stays in this mesh
+	std::vector<VectorD>& Edit_Vertices(){Make_Unique(vertices);return *vertices.get();}
+	std::vector<VectorD>& Edit_Normals(){Make_Unique(normals);return *normals.get();}
+	std::vector<Vector2>& Edit_Uvs(){Make_Unique(uvs);return *uvs.get();}
+	std::vector<Vector4>& Edit_Tangents(){Make_Unique(tangents);return *tangents.get();}
+	std::vector<Vector4>& Edit_Weights(){Make_Unique(weights);return *weights.get();}
+	std::vector<Vector4i>& Edit_Joints(){Make_Unique(joints);return *joints.get();}
+
+	////Float32 attributes
+	////Once enabled, renderers read the float streams instead of converting the real-typed arrays on every upload.
+	////With release_real=true the real-typed arrays are freed after conversion, and the float store becomes the only copy of the vertex data.
+	void Enable_Float_Attributes(const bool release_real=false)
+	{
+		if(attributes_f==nullptr)attributes_f=std::make_shared<MeshAttributes<d> >();
+		attributes_f->From_Mesh(*this);
+		if(release_real)Release_Real_Attributes();
 	}
 
+	bool Use_Float_Attributes() const {return attributes_f!=nullptr;}
+
+	////Sync the dirty streams of the float store after the real-typed attributes were edited; a no-op if no vertex stream is dirty
+	////or the real arrays were released
+	void Update_Float_Attributes()
+	{if(attributes_f!=nullptr&&!vertices->empty()&&dirty.Has(MeshAttributeFlag::Vertex))attributes_f->From_Mesh(*this,dirty.flags,dirty.begin,dirty.end);}
+
+	////The float store is the only copy of the vertices. Invalid until Restore_Real_Attributes, and reported as errors at run time:
+	////  Vertices(), Normals(), Uvs(), Tangents(), Weights(), Joints()   return empty arrays
+	////  Update_Normals, Update_Tangents, Update_Tangents_MikkTSpace     leave their outputs unchanged
+	////Still valid: Elements(), Vertex_Num(), attributes_f, the Edit_* accessors (they refill the real arrays) and Write_*,
+	////which convert the float store back.
+	bool Real_Attributes_Released() const {return vertices->empty()&&attributes_f!=nullptr&&!attributes_f->positions.empty();}
+
+	////Rebuilds the real-typed arrays from the float store; a no-op unless they were released
+	void Restore_Real_Attributes(){if(Real_Attributes_Released())attributes_f->To_Mesh(*this);}
+
+	void Release_Real_Attributes()
+	{
+		vertices=std::make_shared<std::vector<VectorD> >();
+		normals=std::make_shared<std::vector<VectorD> >();
+		uvs=std::make_shared<std::vector<Vector2> >();
+		tangents=std::make_shared<std::vector<Vector4> >();
+		weights=std::make_shared<std::vector<Vector4> >();
+		joints=std::make_shared<std::vector<Vector4i> >();
+	}
+
+	size_type Vertex_Num() const
+	{return (vertices->empty()&&attributes_f!=nullptr)?attributes_f->Size():vertices->size();}
+
 	////IO
 	virtual void Write_Binary(std::ostream& output) const
 	{
+		if(Real_Attributes_Released()){Real_Copy().Write_Binary(output);return;}
 		int vtx_n=(int)(*vertices).size();
 		File::Write_Binary(output,vtx_n);
 		File::Write_Binary_Array(output,&(*vertices)[0],vtx_n);
@@ -111,7 +215,7 @@ public:
 	virtual void Read_Binary(std::istream& input)
 	{
 		int vtx_n=0;File::Read_Binary(input,vtx_n);
-		(*vertices).resize(vtx_n);
+		Make_Owned(vertices);(*vertices).resize(vtx_n);
 		File::Read_Binary_Array(input,&(*vertices)[0],vtx_n);
 		int e_n=0;File::Read_Binary(input,e_n);
 		if(e_n>0){
@@ -121,6 +225,7 @@ public:
 
 	virtual void Write_To_File_3d(const std::string& file_name) const
 	{
+		if(Real_Attributes_Released()){Real_Copy().Write_To_File_3d(file_name);return;}
 		SimplicialMesh<3,e_d> s3;Dim_Conversion(*this,s3);
 		File::Write_Binary_To_File(file_name,s3);
 	}
@@ -129,7 +234,7 @@ public:
 	{
 		int vtx_n=0;File::Read_Text(input,vtx_n);
 		if(vtx_n>0){
-			(*vertices).resize(vtx_n);
+			Make_Owned(vertices);(*vertices).resize(vtx_n);
 			for(int i=0;i<vtx_n;i++)File::Read_Text_Array(input,(*vertices)[i],d);}
 		int e_n=0;File::Read_Text(input,e_n);
 		if(e_n>0){
@@ -139,12 +244,26 @@ public:
 
 	virtual void Write_Text(std::ostream& output) const
 	{
+		if(Real_Attributes_Released()){Real_Copy().Write_Text(output);return;}
 		int vtx_n=(int)(*vertices).size();File::Write_Text(output,vtx_n);File::Write_Text(output,'\n');
 		if(vtx_n>0){for(int i=0;i<vtx_n;i++){File::Write_Text_Array(output,(*vertices)[i],d,' ');File::Write_Text(output,'\n');}}
 		int e_n=(int)elements.size();
 		File::Write_Text(output,'\n');File::Write_Text(output,e_n);File::Write_Text(output,'\n');
 		if(e_n>0){for(int i=0;i<e_n;i++){File::Write_Text_Array(output,elements[i],e_d,' ');File::Write_Text(output,'\n');}}
 	}
+
+protected:
+	////A copy with the real-typed arrays converted back from the float store
+	SimplicialMesh<d,e_d> Real_Copy() const {SimplicialMesh<d,e_d> copy=*this;copy.attributes_f->To_Mesh(copy);return copy;}
+
+	////Reported once per process: a reader of released arrays usually reads them in a loop
+	void Check_Real_Attributes() const
+	{
+		if(!vertices->empty()||!Real_Attributes_Released())return;
+		static std::atomic<bool> reported{false};
+		if(!reported.exchange(true))std::cerr<<"Error: [SimplicialMesh] Real-typed attributes read after Release_Real_Attributes; "
+			<<"read attributes_f or call Restore_Real_Attributes first"<<std::endl;
+	}
 };
 
 
@@ -202,82 +321,220 @@ template<> struct hash<Vector4i>
 
 inline Vector3 Normal(const Vector3& p1,const Vector3& p2,const Vector3& p3){return (p2-p1).cross(p3-p1).normalized();}
 
-inline void Update_Normals(const TriangleMesh<3>& mesh,std::vector<Vector3>& normals)
+////Vertex-to-element adjacency in compressed sparse row form.
+////The elements incident to vertex i are incident_elements[offsets[i]..offsets[i+1]), and incident_corners holds the corner of i in each of them.
+////It only depends on the topology, so it is built once and reused until the elements change.
+class VertexElementAdjacency
+{public:
+	Array<int> offsets;
+	Array<int> incident_elements;
+	Array<uchar> incident_corners;
+
+	template<int e_d> void Initialize(const Array<Vector<int,e_d> >& elements,const size_type vtx_num)
+	{
+		offsets.assign(vtx_num+1,0);
+		for(const auto& e:elements)for(int j=0;j<e_d;j++)offsets[e[j]+1]++;
+		for(size_type i=0;i<vtx_num;i++)offsets[i+1]+=offsets[i];
+		incident_elements.resize(offsets[vtx_num]);incident_corners.resize(offsets[vtx_num]);
+		Array<int> fill(offsets.begin(),offsets.end()-1);
+		for(size_type i=0;i<elements.size();i++)for(int j=0;j<e_d;j++){
+			int p=fill[elements[i][j]]++;incident_elements[p]=(int)i;incident_corners[p]=(uchar)j;}
+	}
+
+	bool Empty() const {return offsets.empty();}
+	size_type Vertex_Num() const {return offsets.empty()?0:offsets.size()-1;}
+	size_type Incidence_Num() const {return incident_elements.size();}
+};
+
+////How face normals are weighted when accumulated at a vertex
+enum class NormalWeighting : int {Uniform=0,Area,Angle};
+
+////Vertex normals from incident face normals.
+////Face normals are computed in parallel over faces, then each vertex gathers its own incident faces in parallel over vertices,
+////so no two threads write to the same normal.
+inline void Update_Normals(const TriangleMesh<3>& mesh,const VertexElementAdjacency& adj,std::vector<Vector3>& normals,const NormalWeighting weighting=NormalWeighting::Uniform)
+{
+	if(mesh.Real_Attributes_Released()){
+		std::cerr<<"Error: [Update_Normals] The real-typed attributes were released, call Restore_Real_Attributes first"<<std::endl;return;}
+	const auto& vertices=mesh.Vertices();const auto& elements=mesh.Elements();
+	normals.resize(vertices.size());
+
+	////unnormalized cross products; their length is twice the face area
+	Array<Vector3> face_normals(elements.size());
+	Parallel::For(0,elements.size(),[&](const size_type i){
+		const Vector3i& e=elements[i];
+		face_normals[i]=(vertices[e[1]]-vertices[e[0]]).cross(vertices[e[2]]-vertices[e[0]]);});
+
+	Parallel::For(0,vertices.size(),[&](const size_type v){
+		Vector3 n=Vector3::Zero();
+		if(v<adj.Vertex_Num())for(int k=adj.offsets[v];k<adj.offsets[v+1];k++){
+			const Vector3& fn=face_normals[adj.incident_elements[k]];real length=fn.norm();
+			if(length==(real)0)continue;
+			switch(weighting){
+			case NormalWeighting::Uniform:n+=fn/length;break;
+			case NormalWeighting::Area:n+=fn;break;
+			case NormalWeighting::Angle:{
+				const Vector3i& e=elements[adj.incident_elements[k]];int c=adj.incident_corners[k];
+				Vector3 e0=vertices[e[(c+1)%3]]-vertices[e[c]];Vector3 e1=vertices[e[(c+2)%3]]-vertices[e[c]];
+				real angle=std::atan2(e0.cross(e1).norm(),e0.dot(e1));
+				n+=fn*(angle/length);}break;}}
+		real length=n.norm();
+		normals[v]=length>(real)0?Vector3(n/length):n;});
+}
+
+inline void Update_Normals(const TriangleMesh<3>& mesh,std::vector<Vector3>& normals,const NormalWeighting weighting=NormalWeighting::Uniform)
 {
-    normals.resize(mesh.Vertices().size(),Vector3::Zero());
-    for(const auto& v:mesh.elements){Vector3 n=Normal(mesh.Vertices()[v[0]],mesh.Vertices()[v[1]],mesh.Vertices()[v[2]]);for(int j=0;j<3;j++){normals[v[j]]+=n;}}
-    for(auto& n:normals){n.normalize();}
+	if(mesh.Real_Attributes_Released()){
+		std::cerr<<"Error: [Update_Normals] The real-typed attributes were released, call Restore_Real_Attributes first"<<std::endl;return;}
+	VertexElementAdjacency adj;adj.Initialize(mesh.Elements(),mesh.Vertices().size());
+	Update_Normals(mesh,adj,normals,weighting);
 }
 
-inline void Update_Tangents(TriangleMesh<3>& mesh)
+////Reference tangents from genTangSpaceDefault of mikktspace.cpp, one per corner (3 per element) since MikkTSpace splits vertices
+////that Update_Tangents cannot; used to check Update_Tangents, see Compare_Tangents_To_MikkTSpace
+inline bool Update_Tangents_MikkTSpace(const TriangleMesh<3>& mesh,Array<Vector4>& corner_tangents)
 {
-	mesh.Tangents().resize(mesh.Vertices().size());
+	if(mesh.Real_Attributes_Released()){
+		std::cerr<<"Error: [Update_Tangents_MikkTSpace] The real-typed attributes were released, call Restore_Real_Attributes first"<<std::endl;return false;}
+	corner_tangents.assign(mesh.Elements().size()*3,Vector4::Zero());
+	struct Context{const TriangleMesh<3>* mesh;Array<Vector4>* corner_tangents;} data={&mesh,&corner_tangents};
 
 	SMikkTSpaceInterface iTSpace;
 	iTSpace.m_getNumFaces=[](const SMikkTSpaceContext * pContext) -> int {
-		TriangleMesh<3>* mesh=(TriangleMesh<3>*)pContext->m_pUserData;
-		return (int)mesh->Elements().size();
+		const Context* data=(const Context*)pContext->m_pUserData;
+		return (int)data->mesh->Elements().size();
 	};
 
 	iTSpace.m_getNumVerticesOfFace=[](const SMikkTSpaceContext * pContext, const int iFace) -> int {
-		TriangleMesh<3>* mesh=(TriangleMesh<3>*)pContext->m_pUserData;
-		return (int)mesh->Elements()[iFace].size();
+		return 3;
 	};
 
 	iTSpace.m_getPosition=[](const SMikkTSpaceContext * pContext, float fvPosOut[], const int iFace, const int iVert) -> void {
-		TriangleMesh<3>* mesh=(TriangleMesh<3>*)pContext->m_pUserData;
-
-		auto& face=mesh->Elements()[iFace];
-		auto& vert=mesh->Vertices()[face(iVert)];
-
-		fvPosOut[0]=(float)vert(0);
-		fvPosOut[1]=(float)vert(1);
-		fvPosOut[2]=(float)vert(2);
+		const Context* data=(const Context*)pContext->m_pUserData;
+		const Vector3& vert=data->mesh->Vertices()[data->mesh->Elements()[iFace][iVert]];
+		for(int i=0;i<3;i++)fvPosOut[i]=(float)vert(i);
 	};
 
 	iTSpace.m_getNormal=[](const SMikkTSpaceContext * pContext, float fvNormOut[], const int iFace, const int iVert) -> void {
-		TriangleMesh<3>* mesh=(TriangleMesh<3>*)pContext->m_pUserData;
-
-		auto& face=mesh->Elements()[iFace];
-		auto& norm=mesh->Normals()[face(iVert)];
-
-		fvNormOut[0]=(float)norm(0);
-		fvNormOut[1]=(float)norm(1);
-		fvNormOut[2]=(float)norm(2);
+		const Context* data=(const Context*)pContext->m_pUserData;
+		const Vector3& norm=data->mesh->Normals()[data->mesh->Elements()[iFace][iVert]];
+		for(int i=0;i<3;i++)fvNormOut[i]=(float)norm(i);
 	};
 
 	iTSpace.m_getTexCoord=[](const SMikkTSpaceContext * pContext, float fvTexcOut[], const int iFace, const int iVert) -> void {
-		TriangleMesh<3>* mesh=(TriangleMesh<3>*)pContext->m_pUserData;
-
-		auto& face=mesh->Elements()[iFace];
-		auto& uv=mesh->Uvs()[face(iVert)];
-
-		fvTexcOut[0]=(float)uv(0);
-		fvTexcOut[1]=(float)uv(1);
+		const Context* data=(const Context*)pContext->m_pUserData;
+		const Vector2& uv=data->mesh->Uvs()[data->mesh->Elements()[iFace][iVert]];
+		fvTexcOut[0]=(float)uv(0);fvTexcOut[1]=(float)uv(1);
 	};
 
 	iTSpace.m_setTSpaceBasic=[](const SMikkTSpaceContext * pContext, const float fvTangent[], const float fSign, const int iFace, const int iVert) -> void {
-		TriangleMesh<3>* mesh=(TriangleMesh<3>*)pContext->m_pUserData;
-
-		auto& face=mesh->Elements()[iFace];
-		auto& tangent=mesh->Tangents()[face(iVert)];
-
-		tangent(0)=fvTangent[0];
-		tangent(1)=fvTangent[1];
-		tangent(2)=fvTangent[2];
-		tangent(3)=fSign;
+		const Context* data=(const Context*)pContext->m_pUserData;
+		(*data->corner_tangents)[iFace*3+iVert]=Vector4(fvTangent[0],fvTangent[1],fvTangent[2],fSign);
 	};
 
 	iTSpace.m_setTSpace=nullptr;
 
-
 	SMikkTSpaceContext ctx;
 	ctx.m_pInterface=&iTSpace;
-	ctx.m_pUserData=&mesh;
+	ctx.m_pUserData=&data;
 
-	if (!genTangSpaceDefault(&ctx)) {
-		std::cerr << "Failed to generate tangents." << std::endl;
-	}
+	if(!genTangSpaceDefault(&ctx)){std::cerr<<"Error: [Update_Tangents_MikkTSpace] genTangSpaceDefault failed"<<std::endl;return false;}
+	return true;
+}
+
+////Parallel tangent generation following the MikkTSpace construction without its callbacks and welding step.
+////Each face contributes its uv-space tangent, projected onto the tangent plane of the vertex normal and weighted by the corner angle;
+////the sign is the uv orientation of the incident faces. Faces are processed in parallel, then every vertex gathers its incident faces.
+////MikkTSpace splits a vertex whose incident faces disagree in uv orientation; this mesh keeps one tangent per vertex, so such a
+////vertex takes the sign of the majority of its faces and averages only those. Its corners on the other side of the mirror seam do
+////not match MikkTSpace; all others do, see Compare_Tangents_To_MikkTSpace.
+inline void Update_Tangents(TriangleMesh<3>& mesh,const VertexElementAdjacency& adj)
+{
+	if(mesh.Real_Attributes_Released()){
+		std::cerr<<"Error: [Update_Tangents] The real-typed attributes were released, call Restore_Real_Attributes first"<<std::endl;return;}
+	const auto& vertices=mesh.Vertices();const auto& normals=mesh.Normals();const auto& uvs=mesh.Uvs();const auto& elements=mesh.Elements();
+	auto& tangents=mesh.Tangents();tangents.resize(vertices.size());
+	if(normals.size()<vertices.size()||uvs.size()<vertices.size()){
+		std::cerr<<"Error: [Update_Tangents] normals and uvs are required"<<std::endl;return;}
+
+	////per face: unnormalized uv-space tangent and the uv orientation
+	Array<Vector3> face_tangents(elements.size());Array<signed char> face_orient(elements.size());
+	Parallel::For(0,elements.size(),[&](const size_type i){
+		const Vector3i& e=elements[i];
+		Vector3 d1=vertices[e[1]]-vertices[e[0]];Vector3 d2=vertices[e[2]]-vertices[e[0]];
+		Vector2 t21=uvs[e[1]]-uvs[e[0]];Vector2 t31=uvs[e[2]]-uvs[e[0]];
+		real signed_area=t21[0]*t31[1]-t21[1]*t31[0];
+		face_orient[i]=signed_area>(real)0?1:(signed_area<(real)0?-1:0);
+		////eq. 18 of the MikkTSpace thesis, flipped on mirrored faces; degenerate uv triangles contribute nothing
+		face_tangents[i]=signed_area==(real)0?Vector3::Zero():Vector3((real)face_orient[i]*(t31[1]*d1-t21[1]*d2));});
+
+	Parallel::For(0,vertices.size(),[&](const size_type v){
+		const Vector3& n=normals[v];Vector3 t=Vector3::Zero();int orient=0;
+		const int begin=v<adj.Vertex_Num()?adj.offsets[v]:0,end=v<adj.Vertex_Num()?adj.offsets[v+1]:0;
+		for(int k=begin;k<end;k++)orient+=face_orient[adj.incident_elements[k]];
+		const signed char sign=orient>=0?1:-1;
+		for(int k=begin;k<end;k++){
+			int f=adj.incident_elements[k];int c=adj.incident_corners[k];const Vector3i& e=elements[f];
+			if(face_orient[f]==-sign)continue;	////the other side of a mirror seam
+			Vector3 ft=face_tangents[f]-n*n.dot(face_tangents[f]);real length=ft.norm();
+			if(length==(real)0)continue;
+			Vector3 e0=vertices[e[(c+1)%3]]-vertices[e[c]];Vector3 e1=vertices[e[(c+2)%3]]-vertices[e[c]];
+			e0-=n*n.dot(e0);e1-=n*n.dot(e1);
+			real l0=e0.norm(),l1=e1.norm();
+			real cos_angle=(l0>(real)0&&l1>(real)0)?std::max((real)-1,std::min((real)1,e0.dot(e1)/(l0*l1))):(real)1;
+			t+=ft*(std::acos(cos_angle)/length);}
+		real length=t.norm();
+		if(length>(real)0)t/=length;
+		else{	////no usable uv gradient: any unit vector orthogonal to the normal
+			t=n.unitOrthogonal();}
+		tangents[v]=Vector4(t[0],t[1],t[2],(real)sign);});
+}
+
+////Deviation of the tangents of mesh from Update_Tangents_MikkTSpace, corner by corner, in degrees. Corners with the sign of their
+////vertex are compared by angle; the others lie on a mirror seam Update_Tangents does not split and are only counted. MikkTSpace also
+////splits the faces of one orientation around a vertex if they do not form a connected fan, and leaves zero tangents on some
+////degenerate faces; such corners are the ones over the tolerance.
+struct TangentDeviation
+{
+	real max_angle=(real)0;			////over the corners with matching signs
+	size_type corner_num=0;			////corners compared
+	size_type over_tolerance_num=0;	////compared corners off by more than the tolerance
+	size_type seam_corner_num=0;	////corners whose sign differs from their vertex
+};
+
+inline TangentDeviation Compare_Tangents_To_MikkTSpace(const TriangleMesh<3>& mesh,const real tolerance=(real).01)
+{
+	TangentDeviation deviation;Array<Vector4> corner_tangents;
+	if(mesh.Tangents().size()<mesh.Vertices().size()||!Update_Tangents_MikkTSpace(mesh,corner_tangents))return deviation;
+	for(size_type i=0;i<mesh.Elements().size();i++)for(int j=0;j<3;j++){
+		const Vector4& t=mesh.Tangents()[mesh.Elements()[i][j]];const Vector4& r=corner_tangents[i*3+j];
+		if(t[3]!=r[3]){deviation.seam_corner_num++;continue;}
+		real cos_angle=t.head<3>().normalized().dot(r.head<3>().normalized());
+		real angle=std::acos(std::max((real)-1,std::min((real)1,cos_angle)))*(real)180/(real)3.14159265358979;
+		deviation.max_angle=std::max(deviation.max_angle,angle);deviation.corner_num++;
+		if(angle>tolerance)deviation.over_tolerance_num++;}
+	return deviation;
+}
+
+////Update_Tangents on a grid whose u is mirrored at x=0 (u=|x|) must match MikkTSpace within .01 degrees at every corner off the mirror
+////seam; the result is computed on the first call. OpenGLTriangleMesh asserts it before its first tangent update.
+inline bool Tangents_Match_MikkTSpace()
+{
+	static const bool match=[](){
+		const real tolerance=(real).01;
+		TriangleMesh<3> mesh;const int n=16;
+		for(int j=0;j<=n;j++)for(int i=0;i<=n;i++){real x=(real)i/(real)n*2-1,y=(real)j/(real)n;
+			mesh.Vertices().push_back(Vector3(x,y,(real).1*std::sin(3*x)*std::cos(2*y)));mesh.Uvs().push_back(Vector2(std::abs(x),y));}
+		for(int j=0;j<n;j++)for(int i=0;i<n;i++){int a=j*(n+1)+i,b=a+1,c=a+n+1,d=c+1;
+			mesh.Elements().push_back(Vector3i(a,b,d));mesh.Elements().push_back(Vector3i(a,d,c));}
+		VertexElementAdjacency adj;adj.Initialize(mesh.Elements(),mesh.Vertices().size());
+		Update_Normals(mesh,adj,mesh.Normals());Update_Tangents(mesh,adj);
+		TangentDeviation deviation=Compare_Tangents_To_MikkTSpace(mesh,tolerance);
+		if(deviation.corner_num==0||deviation.over_tolerance_num>0){
+			std::cerr<<"Error: [Tangents_Match_MikkTSpace] "<<deviation.over_tolerance_num<<" of "<<deviation.corner_num
+				<<" corners over "<<tolerance<<" degrees, max "<<deviation.max_angle<<std::endl;return false;}
+		return true;}();
+	return match;
 }
 
 inline void Update_Uvs(const TriangleMesh<3>& mesh, std::vector<Vector2>& uvs)
@@ -290,34 +547,62 @@ inline int Element_Edges(const Vector3i& v,std::vector<Vector2i>& edges)
 
 inline Vector2i Sorted(const Vector2i& v){return v[0]>v[1]?v:Vector2i(v[1],v[0]);}
 
+////Unique undirected edges of a triangle mesh and the edge index of every element side.
+////Each side becomes a 64-bit key (larger index, smaller index) that is radix sorted together with its side id;
+////equal keys are then adjacent, so the edges come out without hashing, in ascending key order, and stored as Sorted() does.
+class EdgeTopology
+{public:
+	Array<Vector2i> edges;
+	Array<Vector3i> element_edges;		////edge index of the sides (v0,v1), (v1,v2), (v2,v0)
+
+	void Initialize(const Array<Vector3i>& elements,const size_type vtx_num)
+	{
+		const size_type side_num=elements.size()*3;
+		Array<std::uint64_t> keys(side_num);Array<std::uint32_t> sides(side_num);
+		Parallel::For(0,elements.size(),[&](const size_type i){const Vector3i& v=elements[i];
+			for(int j=0;j<3;j++){Vector2i e=Sorted(Vector2i(v[j],v[(j+1)%3]));
+				keys[i*3+j]=(std::uint64_t)e[0]*(std::uint64_t)vtx_num+(std::uint64_t)e[1];sides[i*3+j]=(std::uint32_t)(i*3+j);}});
+		int key_bits=0;while(key_bits<64&&((std::uint64_t)vtx_num*(std::uint64_t)vtx_num>>key_bits)!=0)key_bits++;
+		Parallel::Radix_Sort(keys,sides,key_bits);
+
+		size_type edge_num=0;for(size_type i=0;i<side_num;i++)if(i==0||keys[i]!=keys[i-1])edge_num++;
+		edges.resize(edge_num);element_edges.resize(elements.size());
+		int edge=-1;
+		for(size_type i=0;i<side_num;i++){
+			if(i==0||keys[i]!=keys[i-1]){edge++;edges[edge]=Vector2i((int)(keys[i]/vtx_num),(int)(keys[i]%vtx_num));}
+			element_edges[sides[i]/3][sides[i]%3]=edge;}
+	}
+
+	size_type Edge_Num() const {return edges.size();}
+};
+
 template<int d> void Get_Edges(const TriangleMesh<d>& mesh,std::vector<Vector2i>& edges)
 {
-	Hashset<Vector2i> edge_hashset;std::vector<Vector2i> element_edges(3);
-	for(const auto& vtx:mesh.elements){
-		int n=Element_Edges(vtx,element_edges);
-		for(int i=0;i<n;i++)edge_hashset.insert(Sorted(element_edges[i]));}
-	for(const auto& edge:edge_hashset)edges.push_back(edge);
+	EdgeTopology topology;topology.Initialize(mesh.elements,mesh.Vertices().size());
+	edges.insert(edges.end(),topology.edges.begin(),topology.edges.end());
 }
 
+////One level of midpoint subdivision: every edge gets a new vertex, appended after the existing ones in edge order,
+////and every triangle becomes four, the center one in place and the corner ones appended in element order.
+////Both arrays are resized once and filled in parallel.
 template<int d> void Subdivide(TriangleMesh<d>* mesh)
 {
-	std::vector<Vector2i> edges;Get_Edges(*mesh,edges);
-	Hashtable<Vector2i,int> edge_vtx_hashtable;
-	for(const auto& e:edges){
-		Vector<real,d> pos=(real).5*(mesh->Vertices()[e[0]]+mesh->Vertices()[e[1]]);
-		mesh->Vertices().push_back(pos);
-		int i=(int)mesh->Vertices().size()-1;
-		edge_vtx_hashtable.insert(std::make_pair(e,i));}
-
-	auto n=mesh->elements.size();
-	for(auto i=0;i<n;i++){const Vector3i v=mesh->elements[i];int v3,v4,v5;
-		{auto search=edge_vtx_hashtable.find(Sorted(Vector2i(v[0],v[1])));if(search==edge_vtx_hashtable.end())continue;v3=search->second;}
-		{auto search=edge_vtx_hashtable.find(Sorted(Vector2i(v[1],v[2])));if(search==edge_vtx_hashtable.end())continue;v4=search->second;}
-		{auto search=edge_vtx_hashtable.find(Sorted(Vector2i(v[2],v[0])));if(search==edge_vtx_hashtable.end())continue;v5=search->second;}
-		mesh->elements.push_back(Vector3i(v[0],v3,v5));
-		mesh->elements.push_back(Vector3i(v3,v[1],v4));
-		mesh->elements.push_back(Vector3i(v5,v4,v[2]));
-		mesh->elements[i]=Vector3i(v3,v4,v5);}
+	auto& vertices=mesh->Vertices();auto& elements=mesh->elements;
+	const size_type vtx_num=vertices.size();const size_type ele_num=elements.size();
+	EdgeTopology topology;topology.Initialize(elements,vtx_num);
+
+	vertices.resize(vtx_num+topology.Edge_Num());
+	Parallel::For(0,topology.Edge_Num(),[&](const size_type i){const Vector2i& e=topology.edges[i];
+		vertices[vtx_num+i]=(real).5*(vertices[e[0]]+vertices[e[1]]);});
+
+	elements.resize(ele_num*4);
+	Parallel::For(0,ele_num,[&](const size_type i){const Vector3i v=elements[i];const Vector3i& s=topology.element_edges[i];
+		int v3=(int)vtx_num+s[0];int v4=(int)vtx_num+s[1];int v5=(int)vtx_num+s[2];
+		elements[ele_num+i*3]=Vector3i(v[0],v3,v5);
+		elements[ele_num+i*3+1]=Vector3i(v3,v[1],v4);
+		elements[ele_num+i*3+2]=Vector3i(v5,v4,v[2]);
+		elements[i]=Vector3i(v3,v4,v5);});
+	mesh->Set_Dirty(MeshAttributeFlag::All);
 }
 
 inline void Initialize_Icosahedron_Mesh(const real scale,TriangleMesh<3>* mesh)
@@ -334,8 +619,13 @@ inline void Initialize_Icosahedron_Mesh(const real scale,TriangleMesh<3>* mesh)
 
 inline void Initialize_Sphere_Mesh(const real r,TriangleMesh<3>* mesh,const int sub=2)
 {
-	Initialize_Icosahedron_Mesh(r,mesh);for(int i=0;i<sub;i++)Subdivide(mesh);
-	for(auto& v:mesh->Vertices()){real length=v.norm();real rs=r/length;v*=rs;}
+	Initialize_Icosahedron_Mesh(r,mesh);
+	////each level quadruples the faces and adds one vertex per edge, so the final sizes are known up front
+	size_type ele_num=20;for(int i=0;i<sub;i++)ele_num*=4;
+	mesh->Vertices().reserve(ele_num/2+2);mesh->elements.reserve(ele_num);
+	for(int i=0;i<sub;i++)Subdivide(mesh);
+	auto& vertices=mesh->Vertices();
+	Parallel::For(0,vertices.size(),[&](const size_type i){real length=vertices[i].norm();vertices[i]*=r/length;});
 }
 
 #endif
@@ -0,0 +1,145 @@
+//#####################################################################
+// Mesh attributes
+// Float32 structure-of-arrays vertex storage
+//#####################################################################
+#ifndef __MeshAttributes_h__
+#define __MeshAttributes_h__
+#include <limits>
+#include <algorithm>
+#include "Common.h"
+#include "File.h"
+
+////Attribute bits for dirty tracking
+namespace MeshAttributeFlag{
+enum : unsigned int {Position=1,Normal=2,Uv=4,Tangent=8,Weight=16,Joint=32,Topology=64,
+	Vertex=Position|Normal|Uv|Tangent|Weight|Joint,All=Vertex|Topology};}
+
+////Attributes changed since the last upload, together with the vertex range [begin,end) they were changed in.
+////Renderers consume and clear it; a mesh starts fully dirty.
+class MeshDirtyState
+{public:
+	static constexpr size_type max_end=std::numeric_limits<size_type>::max();
+	unsigned int flags=MeshAttributeFlag::All;
+	size_type begin=0;
+	size_type end=max_end;
+
+	void Set(const unsigned int _flags=MeshAttributeFlag::All,const size_type _begin=0,const size_type _end=max_end)
+	{
+		if(_flags&MeshAttributeFlag::Vertex){
+			if(flags&MeshAttributeFlag::Vertex){begin=std::min(begin,_begin);end=std::max(end,_end);}
+			else{begin=_begin;end=_end;}}
+		flags|=_flags;
+	}
+	bool Has(const unsigned int _flags) const {return (flags&_flags)!=0;}
+	bool Is_Clean() const {return flags==0;}
+	void Clear(){flags=0;begin=0;end=0;}
+	////Dirty vertex range clamped to n vertices
+	size_type Begin(const size_type n) const {return std::min(begin,n);}
+	size_type End(const size_type n) const {return std::min(end,n);}
+};
+
+////Cast an attribute stream element-wise into another scalar type, e.g., Vector3d -> Vector3f
+template<class T1,class A1,class T2,class A2> void Cast_Attribute_Array(const std::vector<T1,A1>& input,/*result*/std::vector<T2,A2>& output)
+{
+	output.resize(input.size());
+	for(size_type i=0;i<input.size();i++)output[i]=input[i].template cast<typename T2::Scalar>();
+}
+
+////Cast only the range [begin,end); falls back to a full cast if the stream was resized
+template<class T1,class A1,class T2,class A2> void Cast_Attribute_Array(const std::vector<T1,A1>& input,/*result*/std::vector<T2,A2>& output,const size_type begin,const size_type end)
+{
+	if(output.size()!=input.size()){Cast_Attribute_Array(input,output);return;}
+	size_type e=std::min(end,input.size());
+	for(size_type i=begin;i<e;i++)output[i]=input[i].template cast<typename T2::Scalar>();
+}
+
+template<class T,class A> void Write_Attribute_Array(std::ostream& output,const std::vector<T,A>& array)
+{
+	int n=(int)array.size();File::Write_Binary(output,n);
+	if(n>0)File::Write_Binary_Array(output,&array[0],n);
+}
+
+template<class T,class A> void Read_Attribute_Array(std::istream& input,std::vector<T,A>& array)
+{
+	int n=0;File::Read_Binary(input,n);array.resize(n);
+	if(n>0)File::Read_Binary_Array(input,&array[0],n);
+}
+
+////Each attribute lives in its own contiguous, 16-byte aligned float32 stream.
+////Positions and normals take half the memory of the real-typed arrays in SimplicialMesh and can be copied to the GPU without conversion.
+template<int d> class MeshAttributes
+{using VectorDf=Vector<float,d>;
+public:
+	AlignedArray<VectorDf> positions;
+	AlignedArray<VectorDf> normals;
+	AlignedArray<Vector2f> uvs;
+	AlignedArray<Vector4f> tangents;
+
+	////Skinning
+	AlignedArray<Vector4f> weights;
+	AlignedArray<Vector4i> joints;
+
+	size_type Size() const {return positions.size();}
+
+	void Clear()
+	{
+		positions.clear();normals.clear();uvs.clear();
+		tangents.clear();weights.clear();joints.clear();
+	}
+
+	////Bytes held by all streams
+	size_type Memory_Size() const
+	{
+		return positions.size()*sizeof(VectorDf)+normals.size()*sizeof(VectorDf)+uvs.size()*sizeof(Vector2f)
+			+tangents.size()*sizeof(Vector4f)+weights.size()*sizeof(Vector4f)+joints.size()*sizeof(Vector4i);
+	}
+
+	////Conversion from and to the real-typed attributes of a SimplicialMesh
+	template<class T_MESH> void From_Mesh(const T_MESH& mesh)
+	{
+		Cast_Attribute_Array(mesh.Vertices(),positions);
+		Cast_Attribute_Array(mesh.Normals(),normals);
+		Cast_Attribute_Array(mesh.Uvs(),uvs);
+		Cast_Attribute_Array(mesh.Tangents(),tangents);
+		Cast_Attribute_Array(mesh.Weights(),weights);
+		joints.assign(mesh.Joints().begin(),mesh.Joints().end());
+	}
+
+	////Convert only the streams flagged in MeshAttributeFlag, over the vertex range [begin,end)
+	template<class T_MESH> void From_Mesh(const T_MESH& mesh,const unsigned int flags,const size_type begin,const size_type end)
+	{
+		namespace F=MeshAttributeFlag;
+		if(flags&F::Position)Cast_Attribute_Array(mesh.Vertices(),positions,begin,end);
+		if(flags&F::Normal)Cast_Attribute_Array(mesh.Normals(),normals,begin,end);
+		if(flags&F::Uv)Cast_Attribute_Array(mesh.Uvs(),uvs,begin,end);
+		if(flags&F::Tangent)Cast_Attribute_Array(mesh.Tangents(),tangents,begin,end);
+		if(flags&F::Weight)Cast_Attribute_Array(mesh.Weights(),weights,begin,end);
+		if(flags&F::Joint)joints.assign(mesh.Joints().begin(),mesh.Joints().end());
+	}
+
+	////Writes through the Edit_* accessors, which are valid while the real-typed arrays are released
+	template<class T_MESH> void To_Mesh(T_MESH& mesh) const
+	{
+		Cast_Attribute_Array(positions,mesh.Edit_Vertices());
+		Cast_Attribute_Array(normals,mesh.Edit_Normals());
+		Cast_Attribute_Array(uvs,mesh.Edit_Uvs());
+		Cast_Attribute_Array(tangents,mesh.Edit_Tangents());
+		Cast_Attribute_Array(weights,mesh.Edit_Weights());
+		mesh.Edit_Joints().assign(joints.begin(),joints.end());
+	}
+
+	////IO
+	void Write_Binary(std::ostream& output) const
+	{
+		Write_Attribute_Array(output,positions);Write_Attribute_Array(output,normals);Write_Attribute_Array(output,uvs);
+		Write_Attribute_Array(output,tangents);Write_Attribute_Array(output,weights);Write_Attribute_Array(output,joints);
+	}
+
+	void Read_Binary(std::istream& input)
+	{
+		Read_Attribute_Array(input,positions);Read_Attribute_Array(input,normals);Read_Attribute_Array(input,uvs);
+		Read_Attribute_Array(input,tangents);Read_Attribute_Array(input,weights);Read_Attribute_Array(input,joints);
+	}
+};
+
+#endif
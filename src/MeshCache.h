@@ -0,0 +1,177 @@
+//#####################################################################
+// Mesh cache
+// Versioned, chunked binary mesh format loaded through mmap
+//#####################################################################
+#ifndef __MeshCache_h__
+#define __MeshCache_h__
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "Mesh.h"
+
+////Layout, in the byte order of the machine that wrote it:
+////  Header                      magic "MSHC", version, key of the source content and loader options, mesh and chunk counts, byte order mark
+////  Chunk[chunk_num]            one per non-empty attribute array of each mesh
+////  payload                     raw float32/int32 arrays, each 16-byte aligned, addressed by Chunk::offset
+////Chunk tags reuse the MeshAttributeFlag bits; MeshAttributeFlag::Topology tags the element indices.
+////A cache written with the other byte order fails the byte order check and is rebuilt from the source.
+namespace MeshCache{
+
+const std::uint32_t version=2;
+const std::uint32_t byte_order_mark=0x01020304;
+
+struct Header
+{
+	char magic[4]={'M','S','H','C'};
+	std::uint32_t version=MeshCache::version;
+	std::uint64_t key=0;
+	std::uint32_t mesh_num=0;
+	std::uint32_t chunk_num=0;
+	std::uint32_t byte_order=byte_order_mark;
+	std::uint32_t pad=0;
+};
+
+struct Chunk
+{
+	std::uint32_t tag=0;			////MeshAttributeFlag bit
+	std::uint32_t mesh_idx=0;
+	std::uint32_t components=0;		////scalars per entry
+	std::uint32_t is_int=0;			////0: float32, 1: int32
+	std::uint64_t count=0;			////entries
+	std::uint64_t offset=0;			////byte offset of the payload from the file start
+};
+
+inline std::string Cache_File_Name(const std::string& source_file){return source_file+".mcache";}
+
+////Key of a source file: its content hash combined with the names and contents of the files it references, e.g., the external
+////buffers of a glTF, and the loader options that shaped the cached meshes; 0 if any of the files cannot be read
+inline std::uint64_t Key(const std::string& source_file,const std::string& options="",const Array<std::string>& dependencies=Array<std::string>())
+{
+	std::uint64_t h=File::Hash_File(source_file);if(h==0)return 0;
+	for(const auto& dependency:dependencies){
+		std::uint64_t content=File::Hash_File(dependency);if(content==0)return 0;
+		h=File::Hash_Bytes(dependency.data(),dependency.size(),h);
+		h=File::Hash_Bytes(&content,sizeof(content),h);}
+	h=File::Hash_Bytes(options.data(),options.size(),h);
+	return File::Hash_Bytes(&version,sizeof(version),h);
+}
+
+////Scalars per entry and scalar type (0: float32, 1: int32) of the arrays tagged tag; false for a tag Write never uses
+inline bool Chunk_Format(const std::uint32_t tag,const int d,const int e_d,std::uint32_t& components,std::uint32_t& is_int)
+{
+	namespace F=MeshAttributeFlag;
+	switch(tag){
+	case F::Position:case F::Normal:components=(std::uint32_t)d;is_int=0;return true;
+	case F::Uv:components=2;is_int=0;return true;
+	case F::Tangent:case F::Weight:components=4;is_int=0;return true;
+	case F::Joint:components=4;is_int=1;return true;
+	case F::Topology:components=(std::uint32_t)e_d;is_int=1;return true;
+	default:return false;}
+}
+
+template<class T_MESH> bool Write(const std::string& file_name,const Array<std::shared_ptr<T_MESH> >& meshes,const std::uint64_t key)
+{
+	const int d=T_MESH::Dim();const int e_d=T_MESH::Element_Dim();
+	Array<MeshAttributes<d> > attrs(meshes.size());
+	for(size_type i=0;i<meshes.size();i++){
+		if(meshes[i]->Use_Float_Attributes()&&meshes[i]->Vertices().empty())attrs[i]=*meshes[i]->attributes_f;
+		else attrs[i].From_Mesh(*meshes[i]);}
+
+	Array<Chunk> chunks;Array<const void*> payloads;
+	auto add=[&](const std::uint32_t tag,const std::uint32_t mesh_idx,const size_type count,const void* data)
+	{if(count==0)return;Chunk c;c.tag=tag;c.mesh_idx=mesh_idx;Chunk_Format(tag,d,e_d,c.components,c.is_int);c.count=count;chunks.push_back(c);payloads.push_back(data);};
+	for(size_type i=0;i<meshes.size();i++){const auto& a=attrs[i];std::uint32_t m=(std::uint32_t)i;
+		namespace F=MeshAttributeFlag;
+		add(F::Position,m,a.positions.size(),a.positions.data());
+		add(F::Normal,m,a.normals.size(),a.normals.data());
+		add(F::Uv,m,a.uvs.size(),a.uvs.data());
+		add(F::Tangent,m,a.tangents.size(),a.tangents.data());
+		add(F::Weight,m,a.weights.size(),a.weights.data());
+		add(F::Joint,m,a.joints.size(),a.joints.data());
+		add(F::Topology,m,meshes[i]->elements.size(),meshes[i]->elements.data());}
+
+	Header header;header.key=key;header.mesh_num=(std::uint32_t)meshes.size();header.chunk_num=(std::uint32_t)chunks.size();
+	auto align=[](const std::uint64_t x){return (x+15)&~(std::uint64_t)15;};
+	std::uint64_t offset=align(sizeof(Header)+chunks.size()*sizeof(Chunk));
+	for(auto& c:chunks){c.offset=offset;offset=align(offset+c.count*c.components*4);}
+
+	std::string tmp_name=file_name+".tmp";
+	{std::ofstream output(tmp_name,std::ios::binary);if(!output)return false;
+	output.write((const char*)&header,sizeof(Header));
+	output.write((const char*)chunks.data(),chunks.size()*sizeof(Chunk));
+	const char zeros[16]={0};std::uint64_t pos=sizeof(Header)+chunks.size()*sizeof(Chunk);
+	for(size_type i=0;i<chunks.size();i++){
+		output.write(zeros,(std::streamsize)(chunks[i].offset-pos));
+		std::uint64_t bytes=chunks[i].count*chunks[i].components*4;
+		output.write((const char*)payloads[i],(std::streamsize)bytes);pos=chunks[i].offset+bytes;}
+	output.close();
+	if(!output){std::remove(tmp_name.c_str());return false;}}
+	////write to a temporary file first and move it over the old cache, so a reader never maps a partially written or missing one
+	if(!File::Replace_File(tmp_name,file_name)){std::remove(tmp_name.c_str());return false;}
+	return true;
+}
+
+////The entries of a chunk have the layout of T, as checked by Read
+template<class T,class A> void Copy_Chunk(const char* src,const Chunk& c,std::vector<T,A>& array)
+{const T* p=(const T*)src;array.assign(p,p+c.count);}
+
+////Float32 payload into an array of fixed-size vectors: one bulk copy if the scalars are float, e.g., with USE_FLOAT,
+////otherwise one cast over the scalars of the whole chunk, which lie contiguously in both
+template<class T,class A> void Convert_Chunk(const char* src,const Chunk& c,std::vector<T,A>& array)
+{
+	typedef typename T::Scalar Scalar;
+	static_assert(sizeof(T)==T::SizeAtCompileTime*sizeof(Scalar),"vector entries are not packed");
+	if(std::is_same<Scalar,float>::value){Copy_Chunk(src,c,array);return;}
+	array.resize((size_type)c.count);if(array.empty())return;
+	const float* p=(const float*)src;Scalar* q=array.data()->data();
+	const size_type n=(size_type)c.count*c.components;
+	for(size_type k=0;k<n;k++)q[k]=(Scalar)p[k];
+}
+
+////Returns false, leaving meshes untouched, if the file is missing, corrupt, of another version or built from another source.
+////With float_only the payload goes into each mesh's float32 store with one bulk copy per chunk and the real-typed arrays stay empty;
+////otherwise the real-typed arrays are filled.
+template<class T_MESH> bool Read(const std::string& file_name,Array<std::shared_ptr<T_MESH> >& meshes,const std::uint64_t key,const bool float_only=false)
+{
+	const int d=T_MESH::Dim();const int e_d=T_MESH::Element_Dim();
+	File::MappedFile file(file_name);if(!file.Is_Open()||file.size<sizeof(Header))return false;
+	Header header;std::memcpy(&header,file.data,sizeof(Header));
+	if(std::memcmp(header.magic,"MSHC",4)!=0||header.version!=version||header.byte_order!=byte_order_mark||header.key!=key)return false;
+	////every mesh Write stores with data has a chunk, which bounds the meshes allocated below
+	if(header.chunk_num>(file.size-sizeof(Header))/sizeof(Chunk)||header.mesh_num>header.chunk_num)return false;
+	const Chunk* chunks=(const Chunk*)(file.data+sizeof(Header));
+
+	////validate all chunks before touching the output; sizes are compared by division so that no product can overflow
+	for(std::uint32_t i=0;i<header.chunk_num;i++){const Chunk& c=chunks[i];
+		std::uint32_t components=0,is_int=0;
+		if(!Chunk_Format(c.tag,d,e_d,components,is_int)||c.components!=components||c.is_int!=is_int)return false;
+		if(c.mesh_idx>=header.mesh_num||c.offset%16!=0||c.offset>file.size||c.count>(file.size-c.offset)/(components*4))return false;}
+
+	meshes.resize(header.mesh_num);
+	for(auto& mesh:meshes){mesh=std::make_shared<T_MESH>();if(float_only)mesh->attributes_f=std::make_shared<MeshAttributes<d> >();}
+	for(std::uint32_t i=0;i<header.chunk_num;i++){const Chunk& c=chunks[i];const char* src=file.data+c.offset;
+		T_MESH& mesh=*meshes[c.mesh_idx];
+		namespace F=MeshAttributeFlag;
+		if(c.tag==F::Topology){Copy_Chunk(src,c,mesh.elements);continue;}
+		if(float_only){auto& a=*mesh.attributes_f;
+			switch(c.tag){
+			case F::Position:Copy_Chunk(src,c,a.positions);break;
+			case F::Normal:Copy_Chunk(src,c,a.normals);break;
+			case F::Uv:Copy_Chunk(src,c,a.uvs);break;
+			case F::Tangent:Copy_Chunk(src,c,a.tangents);break;
+			case F::Weight:Copy_Chunk(src,c,a.weights);break;
+			case F::Joint:Copy_Chunk(src,c,a.joints);break;}}
+		else{
+			switch(c.tag){
+			case F::Position:Convert_Chunk(src,c,mesh.Vertices());break;
+			case F::Normal:Convert_Chunk(src,c,mesh.Normals());break;
+			case F::Uv:Convert_Chunk(src,c,mesh.Uvs());break;
+			case F::Tangent:Convert_Chunk(src,c,mesh.Tangents());break;
+			case F::Weight:Convert_Chunk(src,c,mesh.Weights());break;
+			case F::Joint:Copy_Chunk(src,c,mesh.Joints());break;}}}
+	return true;
+}
+
+};
+
+#endif
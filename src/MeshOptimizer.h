@@ -0,0 +1,199 @@
+//#####################################################################
+// Mesh optimizer
+// Triangle reordering for post-transform vertex-cache locality and reduced overdraw (Tipsify, Sander et al. 2007)
+// and vertex reordering for fetch locality
+//#####################################################################
+#ifndef __MeshOptimizer_h__
+#define __MeshOptimizer_h__
+#include "Mesh.h"
+
+////Cache efficiency of an index buffer under a simulated FIFO post-transform cache
+////ACMR: average cache miss ratio, vertex transforms per triangle (0.5 is ideal for large regular meshes, 3 is the worst case)
+////ATVR: average transform to vertex ratio, vertex transforms per referenced vertex (1 is ideal)
+struct VertexCacheStats
+{
+	real acmr=(real)0;
+	real atvr=(real)0;
+};
+
+inline VertexCacheStats Vertex_Cache_Stats(const TriangleMesh<3>& mesh,const int cache_size=16)
+{
+	VertexCacheStats stats;
+	const auto& elements=mesh.Elements();
+	size_type vtx_num=0;for(const auto& e:elements)for(int j=0;j<3;j++)vtx_num=std::max(vtx_num,(size_type)e[j]+1);
+	if(elements.empty())return stats;
+
+	////a vertex is in the cache if fewer than cache_size misses happened since it was loaded
+	Array<int> time_stamps(vtx_num,-cache_size-1);Array<uchar> referenced(vtx_num,0);
+	int misses=0;size_type referenced_num=0;
+	for(const auto& e:elements)for(int j=0;j<3;j++){int v=e[j];
+		if(!referenced[v]){referenced[v]=1;referenced_num++;}
+		if(misses-time_stamps[v]>cache_size){time_stamps[v]=misses;misses++;}}
+	stats.acmr=(real)misses/(real)elements.size();
+	stats.atvr=(real)misses/(real)referenced_num;
+	return stats;
+}
+
+////Tipsify: fans around the most recently used vertex that will still be in the cache, and falls back to a dead-end stack.
+////The output only depends on the input index order, so it is deterministic.
+inline void Optimize_Vertex_Cache(TriangleMesh<3>& mesh,const int cache_size=16)
+{
+	auto& elements=mesh.Elements();
+	if(elements.empty())return;
+	size_type vtx_num=mesh.Vertex_Num();
+	for(const auto& e:elements)for(int j=0;j<3;j++)vtx_num=std::max(vtx_num,(size_type)e[j]+1);
+
+	VertexElementAdjacency adj;adj.Initialize(elements,vtx_num);
+	Array<int> live(vtx_num);for(size_type v=0;v<vtx_num;v++)live[v]=adj.offsets[v+1]-adj.offsets[v];
+	Array<int> time_stamps(vtx_num,0);
+	Array<uchar> emitted(elements.size(),0);
+	Array<int> dead_end;dead_end.reserve(elements.size()*3);
+	Array<int> candidates;candidates.reserve(64);
+	Array<Vector3i> output;output.reserve(elements.size());
+
+	int time=cache_size+1;size_type cursor=0;
+	int fan=0;while(fan<(int)vtx_num&&live[fan]==0)fan++;
+	while(fan>=0&&fan<(int)vtx_num){
+		candidates.clear();
+		for(int k=adj.offsets[fan];k<adj.offsets[fan+1];k++){int t=adj.incident_elements[k];
+			if(emitted[t])continue;
+			const Vector3i& e=elements[t];output.push_back(e);emitted[t]=1;
+			for(int j=0;j<3;j++){int v=e[j];
+				dead_end.push_back(v);candidates.push_back(v);live[v]--;
+				if(time-time_stamps[v]>cache_size){time_stamps[v]=time;time++;}}}
+
+		////next fanning vertex: the candidate with live triangles that stays in the cache longest after fanning
+		int next=-1;int best_priority=-1;
+		for(int v:candidates){if(live[v]<=0)continue;
+			int priority=0;
+			if(time-time_stamps[v]+2*live[v]<=cache_size)priority=time-time_stamps[v];
+			if(priority>best_priority){best_priority=priority;next=v;}}
+		if(next==-1){
+			while(!dead_end.empty()){int v=dead_end.back();dead_end.pop_back();if(live[v]>0){next=v;break;}}
+			if(next==-1){while(cursor<vtx_num&&live[cursor]<=0)cursor++;if(cursor<vtx_num)next=(int)cursor;}}
+		fan=next;
+	}
+	elements.swap(output);
+	mesh.Set_Dirty(MeshAttributeFlag::Topology);
+}
+
+////Overdraw: the triangle order of Optimize_Vertex_Cache is cut into clusters where the cache is cold (a triangle with three misses)
+////and again where a cluster's running ACMR falls to threshold times that of the cold-cache cluster it was cut from. The clusters are
+////drawn in decreasing order of how far they face away from the mesh centroid, so outer surfaces come first and hide the inner ones
+////from most views. A larger threshold gives more clusters, less overdraw and more cache misses; the order is deterministic.
+inline void Optimize_Overdraw(TriangleMesh<3>& mesh,const real threshold=(real)1.05,const int cache_size=16)
+{
+	auto& elements=mesh.Elements();const auto& vertices=mesh.Vertices();
+	const size_type tri_num=elements.size();
+	if(tri_num<2||vertices.empty())return;
+	for(const auto& e:elements)for(int j=0;j<3;j++)if((size_type)e[j]>=vertices.size())return;
+
+	////FIFO cache as in Vertex_Cache_Stats; advancing the clock by cache_size+1 misses empties it
+	Array<int> time_stamps(vertices.size(),-cache_size-1);int clock=0;
+	auto misses=[&](const Vector3i& e){int m=0;
+		for(int j=0;j<3;j++)if(clock-time_stamps[e[j]]>cache_size){time_stamps[e[j]]=clock;clock++;m++;}
+		return m;};
+	auto flush=[&](){clock+=cache_size+1;};
+
+	Array<size_type> hard;
+	for(size_type t=0;t<tri_num;t++)if(misses(elements[t])==3)hard.push_back(t);
+	if(hard.empty()||hard[0]!=0)hard.insert(hard.begin(),0);
+	hard.push_back(tri_num);
+
+	Array<size_type> clusters;		////start of each cluster, followed by tri_num
+	for(size_type c=0;c+1<hard.size();c++){const size_type begin=hard[c],end=hard[c+1];
+		flush();int cluster_misses=0;for(size_type t=begin;t<end;t++)cluster_misses+=misses(elements[t]);
+		const real limit=threshold*(real)cluster_misses/(real)(end-begin);
+		flush();clusters.push_back(begin);int running=0;size_type start=begin;
+		for(size_type t=begin;t<end;t++){running+=misses(elements[t]);
+			if(t+1<end&&(real)running<=limit*(real)(t+1-start)){clusters.push_back(t+1);flush();running=0;start=t+1;}}}
+	clusters.push_back(tri_num);
+
+	////area-weighted centroid and normal of each cluster and of the mesh
+	const size_type cluster_num=clusters.size()-1;
+	Array<Vector3> centroids(cluster_num,Vector3::Zero());Array<Vector3> normals(cluster_num,Vector3::Zero());
+	Vector3 mesh_centroid=Vector3::Zero();real mesh_area=(real)0;
+	for(size_type c=0;c<cluster_num;c++){real area=(real)0;
+		for(size_type t=clusters[c];t<clusters[c+1];t++){const Vector3i& e=elements[t];
+			Vector3 n=(vertices[e[1]]-vertices[e[0]]).cross(vertices[e[2]]-vertices[e[0]]);real a=n.norm();
+			centroids[c]+=a*(vertices[e[0]]+vertices[e[1]]+vertices[e[2]])/(real)3;normals[c]+=n;area+=a;}
+		mesh_centroid+=centroids[c];mesh_area+=area;
+		if(area>(real)0)centroids[c]/=area;}
+	if(mesh_area>(real)0)mesh_centroid/=mesh_area;
+
+	Array<real> keys(cluster_num);Array<size_type> order(cluster_num);
+	for(size_type c=0;c<cluster_num;c++){order[c]=c;
+		real n=normals[c].norm();keys[c]=n>(real)0?(centroids[c]-mesh_centroid).dot(normals[c])/n:(real)0;}
+	std::stable_sort(order.begin(),order.end(),[&keys](const size_type a,const size_type b){return keys[a]>keys[b];});
+
+	Array<Vector3i> output;output.reserve(tri_num);
+	for(size_type c:order)output.insert(output.end(),elements.begin()+clusters[c],elements.begin()+clusters[c+1]);
+	elements.swap(output);
+	mesh.Set_Dirty(MeshAttributeFlag::Topology);
+}
+
+template<class T,class A> void Remap_Vertex_Array(std::vector<T,A>& array,const Array<int>& new_index)
+{
+	if(array.size()!=new_index.size())return;
+	std::vector<T,A> remapped(array.size());
+	for(size_type i=0;i<array.size();i++)remapped[new_index[i]]=array[i];
+	array.swap(remapped);
+}
+
+////Renumbers vertices in the order the index buffer first references them, so vertex fetches walk memory forward.
+////Every per-vertex attribute array, including the float32 store, is permuted; unreferenced vertices are moved to the end.
+inline void Optimize_Vertex_Fetch(TriangleMesh<3>& mesh)
+{
+	size_type vtx_num=mesh.Vertex_Num();
+	if(vtx_num==0)return;
+	////the attribute arrays have vtx_num entries, so an index past them cannot be given a new position
+	for(const auto& e:mesh.Elements())for(int j=0;j<3;j++)if(e[j]<0||(size_type)e[j]>=vtx_num){
+		std::cerr<<"Error: [Optimize_Vertex_Fetch] element index "<<e[j]<<" out of "<<vtx_num<<" vertices, vertex order kept"<<std::endl;return;}
+	Array<int> new_index(vtx_num,-1);int count=0;
+	for(auto& e:mesh.Elements())for(int j=0;j<3;j++){
+		if(new_index[e[j]]==-1)new_index[e[j]]=count++;
+		e[j]=new_index[e[j]];}
+	for(size_type v=0;v<vtx_num;v++)if(new_index[v]==-1)new_index[v]=count++;
+
+	Remap_Vertex_Array(mesh.Vertices(),new_index);Remap_Vertex_Array(mesh.Normals(),new_index);
+	Remap_Vertex_Array(mesh.Uvs(),new_index);Remap_Vertex_Array(mesh.Tangents(),new_index);
+	Remap_Vertex_Array(mesh.Weights(),new_index);Remap_Vertex_Array(mesh.Joints(),new_index);
+	if(mesh.attributes_f!=nullptr){auto& attr=*mesh.attributes_f;
+		Remap_Vertex_Array(attr.positions,new_index);Remap_Vertex_Array(attr.normals,new_index);
+		Remap_Vertex_Array(attr.uvs,new_index);Remap_Vertex_Array(attr.tangents,new_index);
+		Remap_Vertex_Array(attr.weights,new_index);Remap_Vertex_Array(attr.joints,new_index);}
+	mesh.Set_Dirty(MeshAttributeFlag::All);
+}
+
+////Full pass: triangle order for the vertex cache and overdraw, then vertex order for fetch; before/after stats are returned if requested.
+////An overdraw_threshold of 0 keeps the pure vertex-cache order.
+inline void Optimize_Mesh(TriangleMesh<3>& mesh,const int cache_size=16,VertexCacheStats* before=nullptr,VertexCacheStats* after=nullptr,
+	const real overdraw_threshold=(real)1.05)
+{
+	if(before!=nullptr)*before=Vertex_Cache_Stats(mesh,cache_size);
+	Optimize_Vertex_Cache(mesh,cache_size);
+	if(overdraw_threshold>(real)0)Optimize_Overdraw(mesh,overdraw_threshold,cache_size);
+	Optimize_Vertex_Fetch(mesh);
+	if(after!=nullptr)*after=Vertex_Cache_Stats(mesh,cache_size);
+}
+
+////Optimize_Mesh on two copies of a subdivided sphere with shuffled triangles must give the same vertices and indices, and lower
+////both ACMR and ATVR; the result is computed on the first call. The OBJ loader asserts it before its first optimization.
+inline bool Optimize_Mesh_Is_Deterministic()
+{
+	static const bool deterministic=[](){
+		TriangleMesh<3> mesh;Initialize_Sphere_Mesh((real)1,&mesh,3);
+		auto& elements=mesh.Elements();unsigned int seed=12345u;	////Fisher-Yates with a fixed LCG, the same on every platform
+		for(size_type i=elements.size();i>1;i--){seed=seed*1664525u+1013904223u;std::swap(elements[i-1],elements[seed%i]);}
+		TriangleMesh<3> copy=mesh;
+		VertexCacheStats before,after,copy_after;
+		Optimize_Mesh(mesh,16,&before,&after);Optimize_Mesh(copy,16,nullptr,&copy_after);
+		bool same=mesh.Elements()==copy.Elements()&&mesh.Vertices()==copy.Vertices()&&after.acmr==copy_after.acmr;
+		if(!same||after.acmr>=before.acmr||after.atvr>=before.atvr){
+			std::cerr<<"Error: [Optimize_Mesh_Is_Deterministic] same result "<<same<<", ACMR "<<before.acmr<<" -> "<<after.acmr
+				<<", ATVR "<<before.atvr<<" -> "<<after.atvr<<std::endl;return false;}
+		return true;}();
+	return deterministic;
+}
+
+#endif
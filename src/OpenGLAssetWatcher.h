@@ -0,0 +1,219 @@
+//#####################################################################
+// OpenGL Asset Watcher
+// Background file watching and reload preparation for shaders, textures and meshes
+//#####################################################################
+#ifndef __OpenGLAssetWatcher_h__
+#define __OpenGLAssetWatcher_h__
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include "Common.h"
+#include "File.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+struct OpenGLAssetWatcherStats
+{
+	size_type events=0;			////file events received
+	size_type reloads=0;		////assets prepared after their events settled
+	size_type applied=0;		////reloads finished on the render thread
+	size_type deferred=0;		////frames that left prepared reloads for the next frame
+};
+
+////Files are grouped under keys, e.g., the vertex and fragment files of a program. A change of any file of a key starts a reload once
+////the key has seen no event for debounce_ms, so the write bursts of an editor save cause one reload.
+////A reload has two steps: Prepare runs on the watcher thread and does the file work (read, parse, decode, load), then returns the
+////step that needs the context, which Apply runs on the render thread within a time budget. Until then the old asset stays in use.
+////On Linux the thread sleeps on inotify watches of the parent directories, which also see editors that save by renaming a temporary
+////file; elsewhere it compares modification times every poll_ms. Either way the render thread does not touch the file system.
+class OpenGLAssetWatcher
+{
+public:
+	typedef std::function<void()> Step;
+	typedef std::function<Step()> Prepare;	////returns the render-thread step, empty if there is nothing to apply
+
+	int debounce_ms=100;
+	int poll_ms=250;				////without inotify
+	double apply_budget_ms=4.;		////render-thread time per frame; at least one step runs
+	OpenGLAssetWatcherStats stats;
+
+	static OpenGLAssetWatcher* Instance(){static OpenGLAssetWatcher instance;return &instance;}
+
+	////Files registered under an existing key are added to it; the last prepare is kept
+	void Watch(const std::string& file_name,const std::string& key,const Prepare& prepare)
+	{
+		if(file_name.empty())return;
+		std::lock_guard<std::mutex> lock(mtx);
+		WatchKey& k=keys[key];k.prepare=prepare;
+		for(const auto& f:k.files)if(f==file_name)return;
+		k.files.push_back(file_name);
+		WatchFile wf;wf.key=key;wf.file_name=file_name;wf.modified_time=File::File_Modified_Time(file_name);
+		Add_Watch(wf);
+		files.push_back(wf);
+		if(!thread.joinable())thread=std::thread(&OpenGLAssetWatcher::Run,this);
+	}
+
+	////The files stay watched, but their events are ignored
+	void Unwatch(const std::string& key)
+	{std::lock_guard<std::mutex> lock(mtx);keys.erase(key);pending.erase(key);}
+
+	////Render thread: runs prepared steps in the order they became ready; returns their number
+	int Apply()
+	{
+		using namespace std::chrono;
+		int n=0;steady_clock::time_point start=steady_clock::now();
+		while(true){
+			Step step;
+			{std::lock_guard<std::mutex> lock(mtx);
+			if(ready.empty())break;
+			if(n>0&&duration<double,std::milli>(steady_clock::now()-start).count()>apply_budget_ms){stats.deferred++;break;}
+			step=ready.front().second;ready.pop_front();}
+			step();n++;stats.applied++;}
+		return n;
+	}
+
+	void Stop()
+	{
+		if(!thread.joinable())return;
+		stop=true;
+#ifdef __linux__
+		if(wake_fds[1]>=0){char c=0;if(write(wake_fds[1],&c,1)<0){}}
+#endif
+		thread.join();
+	}
+
+	~OpenGLAssetWatcher()
+	{
+		Stop();
+#ifdef __linux__
+		if(inotify_fd>=0)close(inotify_fd);
+		for(int i=0;i<2;i++)if(wake_fds[i]>=0)close(wake_fds[i]);
+#endif
+	}
+
+protected:
+	typedef std::chrono::steady_clock Clock;
+	struct WatchKey{Array<std::string> files;Prepare prepare;};
+	struct WatchFile{std::string key;std::string file_name;std::string dir_name;std::string base_name;int wd=-1;long long modified_time=0;};
+
+	Hashtable<std::string,WatchKey> keys;
+	Array<WatchFile> files;
+	Hashtable<std::string,Clock::time_point> pending;		////keys with events, by the time of the last one
+	std::deque<std::pair<std::string,Step> > ready;		////prepared steps, at most one per key
+	std::mutex mtx;
+	std::thread thread;
+	std::atomic<bool> stop{false};
+	int inotify_fd=-1;
+	int wake_fds[2]={-1,-1};
+
+	OpenGLAssetWatcher()
+	{
+#ifdef __linux__
+		inotify_fd=inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+		if(inotify_fd<0)std::cerr<<"Error: [OpenGLAssetWatcher] inotify unavailable, polling modification times"<<std::endl;
+		if(pipe(wake_fds)!=0){wake_fds[0]=wake_fds[1]=-1;}
+		else for(int i=0;i<2;i++)fcntl(wake_fds[i],F_SETFL,O_NONBLOCK);
+#endif
+	}
+
+	////Watches the parent directory, since an editor that saves by renaming replaces the file and its inode
+	void Add_Watch(WatchFile& wf)
+	{
+		size_type p=wf.file_name.find_last_of("/\\");
+		wf.dir_name=(p==std::string::npos)?".":(p==0?"/":wf.file_name.substr(0,p));
+		wf.base_name=(p==std::string::npos)?wf.file_name:wf.file_name.substr(p+1);
+#ifdef __linux__
+		if(inotify_fd>=0){
+			wf.wd=inotify_add_watch(inotify_fd,wf.dir_name.c_str(),IN_CLOSE_WRITE|IN_MOVED_TO|IN_ATTRIB);
+			if(wf.wd<0)std::cerr<<"Error: [OpenGLAssetWatcher] Cannot watch "<<wf.dir_name<<std::endl;}
+#endif
+	}
+
+	////Under mtx
+	void Touch(const std::string& key,const Clock::time_point& t)
+	{if(keys.find(key)!=keys.end()){pending[key]=t;stats.events++;}}
+
+	void Run()
+	{
+		while(!stop){
+			int wait_ms=Wait_Time();
+#ifdef __linux__
+			if(inotify_fd>=0){Wait_Events(wait_ms);Prepare_Settled();continue;}
+#endif
+			std::this_thread::sleep_for(std::chrono::milliseconds(std::min(wait_ms<0?poll_ms:wait_ms,poll_ms)));
+			Poll_Modified_Times();
+			Prepare_Settled();}
+	}
+
+	////Milliseconds until the earliest pending key settles, -1 if none is pending
+	int Wait_Time()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if(pending.empty())return -1;
+		Clock::time_point now=Clock::now();long long wait=debounce_ms;
+		for(const auto& p:pending){
+			long long left=debounce_ms-std::chrono::duration_cast<std::chrono::milliseconds>(now-p.second).count();
+			wait=std::min(wait,std::max(left,0ll));}
+		return (int)wait;
+	}
+
+#ifdef __linux__
+	void Wait_Events(const int wait_ms)
+	{
+		pollfd fds[2]={{inotify_fd,POLLIN,0},{wake_fds[0],POLLIN,0}};
+		if(poll(fds,wake_fds[0]>=0?2:1,wait_ms)<=0||!(fds[0].revents&POLLIN))return;
+		alignas(inotify_event) char buffer[4096];
+		Clock::time_point now=Clock::now();
+		std::lock_guard<std::mutex> lock(mtx);
+		ssize_t len;
+		while((len=read(inotify_fd,buffer,sizeof(buffer)))>0){
+			for(char* p=buffer;p<buffer+len;){
+				const inotify_event* e=(const inotify_event*)p;p+=sizeof(inotify_event)+e->len;
+				if(e->len==0)continue;
+				for(const auto& wf:files)if(wf.wd==e->wd&&wf.base_name==e->name)Touch(wf.key,now);}}
+	}
+#endif
+
+	void Poll_Modified_Times()
+	{
+		Array<std::pair<size_type,std::string> > to_check;
+		{std::lock_guard<std::mutex> lock(mtx);for(size_type i=0;i<files.size();i++)to_check.push_back(std::make_pair(i,files[i].file_name));}
+		Array<std::pair<size_type,long long> > times;
+		for(const auto& f:to_check)times.push_back(std::make_pair(f.first,File::File_Modified_Time(f.second)));
+		Clock::time_point now=Clock::now();
+		std::lock_guard<std::mutex> lock(mtx);
+		for(const auto& t:times){WatchFile& wf=files[t.first];
+			if(t.second!=0&&t.second!=wf.modified_time){wf.modified_time=t.second;Touch(wf.key,now);}}
+	}
+
+	////Runs the prepare of every key that settled, outside the lock, and queues its step
+	void Prepare_Settled()
+	{
+		Array<std::pair<std::string,Prepare> > settled;
+		{std::lock_guard<std::mutex> lock(mtx);
+		Clock::time_point now=Clock::now();
+		for(auto iter=pending.begin();iter!=pending.end();){
+			if(std::chrono::duration_cast<std::chrono::milliseconds>(now-iter->second).count()<debounce_ms){iter++;continue;}
+			auto k=keys.find(iter->first);
+			if(k!=keys.end())settled.push_back(std::make_pair(iter->first,k->second.prepare));
+			iter=pending.erase(iter);}}
+
+		for(const auto& s:settled){
+			Step step=s.second?s.second():Step();
+			std::lock_guard<std::mutex> lock(mtx);
+			stats.reloads++;
+			if(!step)continue;
+			for(auto iter=ready.begin();iter!=ready.end();iter++)if(iter->first==s.first){ready.erase(iter);break;}
+			ready.push_back(std::make_pair(s.first,step));}
+	}
+};
+
+#endif
@@ -0,0 +1,60 @@
+//#####################################################################
+// OpenGL Bounds
+// World-space bounding volumes and view-frustum tests for culling
+//#####################################################################
+#ifndef __OpenGLBounds_h__
+#define __OpenGLBounds_h__
+#include "Common.h"
+
+using Box3f=Eigen::AlignedBox<float,3>;
+
+////Axis-aligned box with its enclosing sphere; the sphere rejects most objects with one dot product per plane
+class OpenGLBounds
+{public:
+	Box3f box;
+	Vector3f center=Vector3f::Zero();
+	float radius=0.f;
+
+	OpenGLBounds(){box.setEmpty();}
+
+	bool Empty() const {return box.isEmpty();}
+
+	////World bounds of a local box under an affine model matrix, from its eight transformed corners
+	void Initialize(const Box3f& local_box,const Matrix4f& model)
+	{
+		box.setEmpty();
+		if(!local_box.isEmpty())for(int i=0;i<8;i++){
+			Vector3f p=local_box.corner((Box3f::CornerType)i);
+			box.extend((model*Vector4f(p[0],p[1],p[2],1.f)).head<3>());}
+		if(box.isEmpty()){center=Vector3f::Zero();radius=0.f;}
+		else{center=box.center();radius=.5f*box.diagonal().norm();}
+	}
+};
+
+////Six planes n.x+d>=0 of the clip volume of a projection*view matrix (Gribb and Hartmann)
+class OpenGLFrustum
+{public:
+	Vector4f planes[6];
+
+	void Initialize(const Matrix4f& pv)
+	{
+		for(int i=0;i<3;i++){
+			planes[i*2]=pv.row(3).transpose()+pv.row(i).transpose();
+			planes[i*2+1]=pv.row(3).transpose()-pv.row(i).transpose();}
+		for(int i=0;i<6;i++){float n=planes[i].head<3>().norm();if(n>0.f)planes[i]/=n;}
+	}
+
+	////Conservative: false only if the bounds are entirely outside one plane
+	bool Intersect(const OpenGLBounds& bounds) const
+	{
+		for(int i=0;i<6;i++){
+			const Vector4f& p=planes[i];
+			if(p.head<3>().dot(bounds.center)+p[3]<-bounds.radius)return false;
+			////the box corner farthest along the plane normal
+			Vector3f v;for(int j=0;j<3;j++)v[j]=p[j]>=0.f?bounds.box.max()[j]:bounds.box.min()[j];
+			if(p.head<3>().dot(v)+p[3]<0.f)return false;}
+		return true;
+	}
+};
+
+#endif
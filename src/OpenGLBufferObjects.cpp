@@ -3,8 +3,11 @@
 // Copyright (c) (2018-), Bo Zhu
 //#####################################################################
 #include <iostream>
+#include <cstring>
+#include <algorithm>
 #include "OpenGLWindow.h"
 #include "OpenGLBufferObjects.h"
+#include "OpenGLFrameCapture.h"
 #ifdef USE_STB
 #include "StbImage.h"
 #endif
@@ -43,44 +46,32 @@ void OpenGLFboInstance::Resize_To_Window()
 
 void OpenGLFboInstance::Write_To_File(const std::string& file_name)
 {
-#ifndef USE_STB
-	std::cerr<<"Error: [OpenGLFbo] stb is required for image io"<<std::endl;
-#else
+	if(width==0||height==0)return;
+	////the pixels are read back asynchronously and written by the capture workers
 	glBindFramebuffer(GL_FRAMEBUFFER,buffer_index);
 	switch(type){
-	case Color:{
-		int num_pixel=width*height;int num_comp=3;if(num_pixel==0)return;
-		GLubyte* pixels=new GLubyte[num_comp*num_pixel];
-		GLubyte* pixels_flipped_y=new GLubyte[num_comp*num_pixel];
-		glReadPixels(0,0,width,height,GL_RGB,GL_UNSIGNED_BYTE,pixels);
-		for(int i=0;i<height;i++){int offset=width*num_comp*(height-i-1);
-			std::memcpy(pixels_flipped_y+offset,pixels+width*num_comp*i,width*num_comp);}
-		std::stringstream ss;ss<<file_name<<".png";
-		Stb::Write_Png(ss.str().c_str(),width,height,num_comp,pixels_flipped_y,0);
-		delete pixels;delete pixels_flipped_y;		
+	case Color:case Position:{		////position buffers are written clamped to RGB8, as color
+		OpenGLFrameCapture::Instance()->Capture(0,0,width,height,file_name);
 	}break;
 	case Depth:{
-		int num_pixel=width*height;int num_comp=3;if(num_pixel==0)return;
-		GLfloat* pixels=new GLfloat[num_pixel];
-		GLubyte* pixels_flipped_y=new GLubyte[num_comp*num_pixel];
-		glReadPixels(0,0,width,height,GL_DEPTH_COMPONENT,GL_FLOAT,pixels);
-		for(int ii=0;ii<height;ii++){int i=height-ii-1;for(int j=0;j<width;j++){
-			float depth=pixels[width*ii+j];
-			if(use_linearize_plane)depth=Linearize_Depth(depth,near_plane,far_plane)/far_plane;
-			int p=(int)(depth*255.);
-			for(int k=0;k<num_comp;k++)pixels_flipped_y[width*num_comp*i+j*num_comp+k]=(GLubyte)p;}}
-		std::stringstream ss;ss<<file_name<<".png";
-		Stb::Write_Png(ss.str().c_str(),width,height,num_comp,pixels_flipped_y,0);
-		delete pixels;delete pixels_flipped_y;			
-	}break;}
-	glBindFramebuffer(GL_FRAMEBUFFER,0);
-#endif
+		bool linearize=use_linearize_plane;float near_p=near_plane,far_p=far_plane;
+		OpenGLFrameCapture::Instance()->Capture(0,0,width,height,file_name,nullptr,GL_DEPTH_COMPONENT,GL_FLOAT,(int)sizeof(GLfloat),
+			[=](const unsigned char* src,const int w,const int h,unsigned char* dst){
+			const GLfloat* pixels=(const GLfloat*)src;int num_comp=3;
+			for(int ii=0;ii<h;ii++){int i=h-ii-1;for(int j=0;j<w;j++){
+				float depth=pixels[w*ii+j];
+				if(linearize)depth=Linearize_Depth(depth,near_p,far_p)/far_p;
+				int p=(int)(depth*255.);
+				for(int k=0;k<num_comp;k++)dst[w*num_comp*i+j*num_comp+k]=(unsigned char)p;}}});
+	}break;
+	default:std::cerr<<"Error: [OpenGLFbo] Cannot write a stencil buffer to "<<file_name<<std::endl;break;}
+	glBindFramebuffer(GL_FRAMEBUFFER,Default_Framebuffer());
 }
 
 void OpenGLFboInstance::Bind_As_Texture(GLuint idx){glActiveTexture(GL_TEXTURE0+idx);glBindTexture(GL_TEXTURE_2D,tex_index);}
 void OpenGLFboInstance::Set_Near_And_Far_Plane(float _near,float _far){near_plane=_near;far_plane=_far;use_linearize_plane=true;}
 void OpenGLFboInstance::Bind(){glBindFramebuffer(GL_FRAMEBUFFER,buffer_index);}
-void OpenGLFboInstance::Unbind(){glBindFramebuffer(GL_FRAMEBUFFER,0);}
+void OpenGLFboInstance::Unbind(){glBindFramebuffer(GL_FRAMEBUFFER,Default_Framebuffer());}
 
 GLuint OpenGLFboInstance::Generate_Attachment_Texture(const AttachmentType& att_type,GLuint width,GLuint height)
 {
@@ -116,7 +107,7 @@ void OpenGLFboInstance::Bind_Texture_Color()
 	glBindRenderbuffer(GL_RENDERBUFFER,0);
 	glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_STENCIL_ATTACHMENT,GL_RENDERBUFFER,rbo_index);
 	if(glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE)std::cerr<<"Error: [OpenGLFboInstance] framebuffer not complete"<<std::endl;
-	glBindFramebuffer(GL_FRAMEBUFFER,0);	
+	glBindFramebuffer(GL_FRAMEBUFFER,Default_Framebuffer());	
 }
 
 void OpenGLFboInstance::Bind_Texture_Depth()
@@ -125,7 +116,7 @@ void OpenGLFboInstance::Bind_Texture_Depth()
 	if(tex_index!=0)glDeleteTextures(1,&tex_index);
 	tex_index=Generate_Attachment_Texture(Depth,width,height);
 	glFramebufferTexture2D(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_TEXTURE_2D,tex_index,0);
-	glBindFramebuffer(GL_FRAMEBUFFER,0);		
+	glBindFramebuffer(GL_FRAMEBUFFER,Default_Framebuffer());		
 }
 
 float OpenGLFboInstance::Linearize_Depth(float depth,float near_plane,float far_plane)
@@ -163,7 +154,7 @@ void Bind_Fbo(const std::string& name,const int init_type)
 std::shared_ptr<OpenGLFbo> Get_And_Bind_Fbo(const std::string& name,const int init_type)
 {auto fbo=Get_Fbo(name,init_type);if(fbo!=nullptr)glBindFramebuffer(GL_FRAMEBUFFER,fbo->buffer_index);return fbo;}
 
-void Unbind_Fbo(){glBindFramebuffer(GL_FRAMEBUFFER,0);}
+void Unbind_Fbo(){glBindFramebuffer(GL_FRAMEBUFFER,Default_Framebuffer());}
 
 void Clear_Fbo(const std::string& name,const int init_type)
 {
@@ -182,6 +173,7 @@ void Bind_Shader_Ubo_Headers(Hashtable<std::string,std::string>& shader_header_h
 	shader_header_hashtable.insert(std::make_pair("camera",camera));
 	//shader_header_hashtable.insert(std::make_pair("lighting",lighting));
 	shader_header_hashtable.insert(std::make_pair("lights",lights));
+	shader_header_hashtable.insert(std::make_pair("object",object));
 }
 
 template<class T_UBO> void OpenGLUboInstance<T_UBO>::Initialize(const std::string& _uniform_block_name,GLuint _binding_point,GLuint _ubo,GLint _block_offset)
@@ -199,41 +191,109 @@ template<class T_UBO> void OpenGLUboInstance<T_UBO>::Initialize(const std::strin
 		", block_offset: "<<block_offset<<", block_size: "<<block_size<<std::endl;
 }
 
-template<class T_UBO> void OpenGLUboInstance<T_UBO>::Set_Block_Attributes(){Set_Block_Attributes_Helper(object,block_offset);}
+template<class T_UBO> void OpenGLUboInstance<T_UBO>::Set_Block_Attributes()
+{
+	glBindBuffer(GL_UNIFORM_BUFFER,buffer_index);
+	glBufferSubData(GL_UNIFORM_BUFFER,block_offset,sizeof(T_UBO),&object);
+	glBindBuffer(GL_UNIFORM_BUFFER,0);
+}
 
 template<class T_UBO> void OpenGLUboInstance<T_UBO>::Bind_Block(){Bind_Block(binding_point,block_offset,block_size);}
 
 template<class T_UBO> void OpenGLUboInstance<T_UBO>::Bind_Block(GLuint binding_point,GLint block_offset,size_type block_size)
 {glBindBufferRange(GL_UNIFORM_BUFFER,binding_point,buffer_index,block_offset,block_size);}
 
-template<class T_UBO> void OpenGLUboInstance<T_UBO>::Set_Block_Attributes_Helper(const Camera& obj,GLint block_offset)
+template class OpenGLUboInstance<Camera>;
+template class OpenGLUboInstance<Lights>;
+template class OpenGLUboInstance<ObjectBlock>;
+
+//////////////////////////////////////////////////////////////////////////
+////Per-frame ring
+
+void OpenGLUboRing::Begin_Frame()
 {
-	GLint offset=block_offset;
-	offset=Set_Block_Attribute(obj.projection,offset);
-	offset=Set_Block_Attribute(obj.view,offset);
-	offset=Set_Block_Attribute(obj.pvm,offset);
-	offset=Set_Block_Attribute(obj.ortho,offset);
-	offset=Set_Block_Attribute(obj.position,offset);
+	if(alignment==0){glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT,&alignment);if(alignment<=0)alignment=256;}
+	frame_count++;section=(int)(frame_count%frame_num);
+	Wait(section);
+	staging.clear();writing=true;flushed=false;
 }
 
-template<class T_UBO> void OpenGLUboInstance<T_UBO>::Set_Block_Attributes_Helper(const Lights& obj,GLint block_offset)
+bool OpenGLUboRing::Write(const void* data,const size_type size,OpenGLUboRange& range)
 {
-	GLint offset=block_offset;
-	offset=Set_Block_Attribute(obj.amb,offset);
-	offset=Set_Block_Attribute(obj.lt_att,offset);
-	for(int i=0;i<obj.lt_att[0];i++){
-		offset=Set_Block_Attribute(obj.lt[i].att,offset);
-		offset=Set_Block_Attribute(obj.lt[i].pos,offset);
-		offset=Set_Block_Attribute(obj.lt[i].dir,offset);
-		offset=Set_Block_Attribute(obj.lt[i].amb,offset);
-		offset=Set_Block_Attribute(obj.lt[i].dif,offset);
-		offset=Set_Block_Attribute(obj.lt[i].spec,offset);
-		offset=Set_Block_Attribute(obj.lt[i].atten,offset);
-		offset=Set_Block_Attribute(obj.lt[i].r,offset);}
+	if(!writing)return false;
+	size_type offset=(staging.size()+alignment-1)/alignment*alignment;
+	staging.resize(offset+size);
+	std::memcpy(&staging[offset],data,size);
+	range.offset=(GLint)offset;range.size=size;range.frame=frame_count;
+	return true;
 }
 
-template class OpenGLUboInstance<Camera>;
-template class OpenGLUboInstance<Lights>;
+void OpenGLUboRing::Flush()
+{
+	writing=false;flushed=true;
+	if(staging.empty())return;
+	if(staging.size()>section_size)Resize(staging.size());
+	if(mapped!=nullptr){std::memcpy(mapped+section*section_size,staging.data(),staging.size());return;}	////coherent, seen by the next draw
+	glBindBuffer(GL_UNIFORM_BUFFER,buffer_index);
+	void* ptr=glMapBufferRange(GL_UNIFORM_BUFFER,section*section_size,staging.size(),
+		GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_RANGE_BIT|GL_MAP_UNSYNCHRONIZED_BIT);
+	if(ptr!=nullptr){std::memcpy(ptr,staging.data(),staging.size());glUnmapBuffer(GL_UNIFORM_BUFFER);}
+	else{std::cerr<<"Error: [OpenGLUboRing] Map section "<<section<<" failed"<<std::endl;flushed=false;}
+	glBindBuffer(GL_UNIFORM_BUFFER,0);
+}
+
+bool OpenGLUboRing::Bind_Range(const GLuint binding_point,const OpenGLUboRange& range) const
+{
+	if(!flushed||range.frame!=frame_count||range.offset<0)return false;
+	glBindBufferRange(GL_UNIFORM_BUFFER,binding_point,buffer_index,section*section_size+range.offset,range.size);
+	return true;
+}
+
+void OpenGLUboRing::End_Frame()
+{
+	writing=false;flushed=false;
+	if(fences[section]!=0)glDeleteSync(fences[section]);
+	fences[section]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+}
+
+void OpenGLUboRing::Wait(const int i)
+{
+	if(fences[i]==0)return;
+	while(true){GLenum result=glClientWaitSync(fences[i],GL_SYNC_FLUSH_COMMANDS_BIT,1000000000);
+		if(result==GL_ALREADY_SIGNALED||result==GL_CONDITION_SATISFIED||result==GL_WAIT_FAILED)break;}
+	glDeleteSync(fences[i]);fences[i]=0;
+}
+
+////A larger buffer replaces the old one, which the driver keeps alive for the frames still reading it. Immutable storage cannot be
+////respecified, so the persistent buffer is unmapped and deleted and a new one is mapped.
+void OpenGLUboRing::Resize(const size_type size)
+{
+	section_size=std::max(size*2,(size_type)(1<<16));
+	section_size=(section_size+alignment-1)/alignment*alignment;
+	if(Persistent()){
+		if(buffer_index!=0){
+			glBindBuffer(GL_UNIFORM_BUFFER,buffer_index);glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER,0);glDeleteBuffers(1,&buffer_index);mapped=nullptr;}
+		const GLbitfield flags=GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT;
+		glGenBuffers(1,&buffer_index);
+		glBindBuffer(GL_UNIFORM_BUFFER,buffer_index);
+		glBufferStorage(GL_UNIFORM_BUFFER,section_size*frame_num,nullptr,flags);
+		mapped=(char*)glMapBufferRange(GL_UNIFORM_BUFFER,0,section_size*frame_num,flags);
+		if(mapped==nullptr){std::cerr<<"Error: [OpenGLUboRing] Persistent map failed, mapping per frame"<<std::endl;
+			glDeleteBuffers(1,&buffer_index);buffer_index=0;persistent=0;}}
+	if(!Persistent()){
+		if(buffer_index==0)glGenBuffers(1,&buffer_index);
+		glBindBuffer(GL_UNIFORM_BUFFER,buffer_index);
+		glBufferData(GL_UNIFORM_BUFFER,section_size*frame_num,nullptr,GL_STREAM_DRAW);}
+	glBindBuffer(GL_UNIFORM_BUFFER,0);
+	for(int i=0;i<frame_num;i++)if(fences[i]!=0){glDeleteSync(fences[i]);fences[i]=0;}
+}
+
+bool OpenGLUboRing::Persistent()
+{
+	if(persistent<0)persistent=OpenGL_Has_Buffer_Storage()?1:0;
+	return persistent==1;
+}
 
 //////////////////////////////////////////////////////////////////////////
 ////OpenGL UBO classes and library
@@ -262,6 +322,10 @@ void Ubo_Library::Initialize_Ubos()
 	{OpenGLUboInstance<Lights>* ubo=new OpenGLUboInstance<Lights>();
 	ubo->Initialize("lights",binding_point++);ubo->Set_Block_Attributes();
 	ubo_hashtable.insert(std::make_pair(ubo->name,std::shared_ptr<OpenGLUbo>(ubo)));}
+	////per-object data, normally bound to a range of the ring for each draw
+	{OpenGLUboInstance<ObjectBlock>* ubo=new OpenGLUboInstance<ObjectBlock>();
+	ubo->Initialize("object",binding_point++);ubo->Set_Block_Attributes();
+	ubo_hashtable.insert(std::make_pair(ubo->name,std::shared_ptr<OpenGLUbo>(ubo)));}
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -299,6 +363,28 @@ Vector3 Get_Camera_Pos()
 	return Vector3(camera->object.position[0],camera->object.position[1],camera->object.position[2]);
 }
 
+////Per-frame ring
+OpenGLUboInstance<ObjectBlock>* Get_Object_Ubo()
+{
+	std::shared_ptr<OpenGLUbo> ubo=Get_Ubo("object");
+	return dynamic_cast<OpenGLUboInstance<ObjectBlock>* >(ubo.get());
+}
+
+void Write_Frame_Ubos(OpenGLUboRing& ring)
+{
+	auto* camera_ubo=Get_Camera_Ubo();if(camera_ubo!=nullptr)ring.Write(camera_ubo->object,camera_ubo->ring_range);
+	auto* lights_ubo=Get_Lights_Ubo();if(lights_ubo!=nullptr)ring.Write(lights_ubo->object,lights_ubo->ring_range);
+}
+
+////Falls back to the buffers of the library if the ring could not take the blocks
+void Bind_Frame_Ubos(OpenGLUboRing& ring)
+{
+	auto* camera_ubo=Get_Camera_Ubo();
+	if(camera_ubo!=nullptr&&!ring.Bind_Range(camera_ubo->binding_point,camera_ubo->ring_range)){camera_ubo->Set_Block_Attributes();camera_ubo->Bind_Block();}
+	auto* lights_ubo=Get_Lights_Ubo();
+	if(lights_ubo!=nullptr&&!ring.Bind_Range(lights_ubo->binding_point,lights_ubo->ring_range)){lights_ubo->Set_Block_Attributes();lights_ubo->Bind_Block();}
+}
+
 ////Lighting
 OpenGLUboInstance<Lights>* Get_Lights_Ubo()
 {
@@ -55,7 +55,7 @@ protected:
 	GLuint Generate_Attachment_Texture(const AttachmentType& att_type,GLuint width,GLuint height);
 	void Bind_Texture_Color();
 	void Bind_Texture_Depth();
-	float Linearize_Depth(float depth,float near_plane,float far_plane);
+	static float Linearize_Depth(float depth,float near_plane,float far_plane);
 };
 
 class Fbo_Library
@@ -76,6 +76,8 @@ void Unbind_Fbo();
 void Clear_Fbo(const std::string& name,const int init_type=0);
 };
 
+GLuint Default_Framebuffer();	////the framebuffer objects unbind to: the headless target of the window, or 0 for a GLUT window
+
 class OpenGLShaderProgram;
 
 namespace OpenGLUbos{
@@ -181,9 +183,41 @@ layout (std140) uniform lights
 };
 );
 
+////Per-object block; each vec3 shares its 16-byte std140 slot with the float after it
+class ObjectBlock
+{public:
+	glm::mat4x4 model;
+	glm::vec3 ka;float shininess;
+	glm::vec3 kd;float iTime;
+	glm::vec3 ks;float pad;
+};
+
+const std::string object=To_String(
+layout (std140) uniform object
+{
+	mat4 model;
+	vec3 ka;
+	float shininess;
+	vec3 kd;
+	float iTime;
+	vec3 ks;
+};
+);
+
+////The classes above are the CPU mirrors of their blocks and are uploaded as they are
+static_assert(sizeof(Camera)==272&&sizeof(Lights)==544&&sizeof(ObjectBlock)==112,"UBO mirrors must match the std140 layout");
+
 //////////////////////////////////////////////////////////////////////////
 ////OpenGL UBO classes and library
 
+////Range of a block written into the ring in one frame
+struct OpenGLUboRange
+{
+	GLint offset=-1;		////from the start of the frame section
+	size_type size=0;
+	unsigned int frame=0;	////the ring frame it was written in
+};
+
 class OpenGLUbo
 {public:
 	std::string name="";
@@ -192,6 +226,7 @@ class OpenGLUbo
 	GLuint binding_point=0;
 	GLint block_offset=0;
 	size_type block_size=0;
+	OpenGLUboRange ring_range;	////where the mirror was written in the ring this frame
 
 	virtual void Initialize(const std::string& _uniform_block_name,GLuint _binding_point=0,GLuint _ubo=0,GLint _block_offset=0){}
 	virtual void Set_Block_Attributes(){}
@@ -203,29 +238,50 @@ template<class T_UBO> class OpenGLUboInstance : public OpenGLUbo
 	OpenGLUboInstance():Base(){}
 
 	virtual void Initialize(const std::string& _uniform_block_name,GLuint _binding_point=0,GLuint _ubo=0,GLint _block_offset=0);
-	void Set_Block_Attributes();
+	void Set_Block_Attributes();	////uploads the whole mirror with one call
 	void Bind_Block();
 
 protected:
 	void Bind_Block(GLuint binding_point,GLint block_offset,size_type block_size);
+};
 
-	template<class T_ATT> GLint Set_Block_Attribute(const T_ATT& att,const GLint att_offset)	////work for glm types only, std140
-	{
-		size_type att_size=Size_Helper<T_ATT>();
-		GLvoid* att_data=Data_Helper(att);
-		glBindBuffer(GL_UNIFORM_BUFFER,buffer_index);
-		glBufferSubData(GL_UNIFORM_BUFFER,att_offset,att_size,att_data);
-		glBindBuffer(GL_UNIFORM_BUFFER,0);
-		return att_offset+(GLint)att_size;
-	}
+////Per-frame blocks (camera, lights, one per object) are packed on the CPU and copied into one of frame_num sections of a single
+////buffer; shaders address them with glBindBufferRange. With GL 4.4 or ARB_buffer_storage the buffer is mapped once, persistent
+////and coherent, and Flush is a memcpy; otherwise each Flush maps its section unsynchronized and unmaps it. Begin_Frame waits for
+////the fence the section got frame_num frames ago, so a section is never rewritten while the GPU may still read it.
+////Blocks must be written between Begin_Frame and Flush; ranges from another frame, or written after Flush, are refused by Bind_Range.
+class OpenGLUboRing
+{public:
+	static const int frame_num=3;
+	static OpenGLUboRing* Instance(){static OpenGLUboRing instance;return &instance;}
 
-	void Set_Block_Attributes_Helper(const Camera& obj,GLint block_offset);
+	void Begin_Frame();
+	bool Write(const void* data,const size_type size,OpenGLUboRange& range);
+	template<class T_UBO> bool Write(const T_UBO& block,OpenGLUboRange& range){return Write(&block,sizeof(T_UBO),range);}
+	void Flush();
+	bool Bind_Range(const GLuint binding_point,const OpenGLUboRange& range) const;
+	void End_Frame();
 
-	void Set_Block_Attributes_Helper(const Lights& obj,GLint block_offset);
+	unsigned int Frame() const {return frame_count;}
+	size_type Section_Size() const {return section_size;}
 
-	template<class T_VAL> GLvoid* Data_Helper(T_VAL& val){return (GLvoid*)(&val);}
-	GLvoid* Data_Helper(glm::mat4& val){return (GLvoid*)(glm::value_ptr(val));}
-	template<class T_ATT> size_type Size_Helper(){size_type size=sizeof(T_ATT);size=size<4?4:size;return size;}	////for std140
+protected:
+	GLuint buffer_index=0;
+	size_type section_size=0;	////bytes per frame
+	int persistent=-1;			////-1: not queried yet
+	char* mapped=nullptr;		////the whole buffer while persistently mapped
+	GLint alignment=0;			////GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	int section=0;
+	unsigned int frame_count=0;
+	GLsync fences[frame_num]={0,0,0};
+	Array<char> staging;
+	bool writing=false;
+	bool flushed=false;
+
+	OpenGLUboRing(){}
+	void Wait(const int i);
+	void Resize(const size_type size);
+	bool Persistent();
 };
 
 class Ubo_Library
@@ -257,6 +313,11 @@ OpenGLUboInstance<Camera>* Get_Camera_Ubo();
 Camera* Get_Camera();
 Vector3 Get_Camera_Pos();
 
+////Per-frame ring
+OpenGLUboInstance<ObjectBlock>* Get_Object_Ubo();
+void Write_Frame_Ubos(OpenGLUboRing& ring);	////camera and lights, bound to their binding points after Flush
+void Bind_Frame_Ubos(OpenGLUboRing& ring);
+
 ////Lighting
 OpenGLUboInstance<Lights>* Get_Lights_Ubo();
 Lights* Get_Lights();
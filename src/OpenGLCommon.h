@@ -117,4 +117,8 @@ inline void OpenGL_Vertex4_And_Color4(const Vector3& v,const GLfloat* c,Array<GL
 
 inline void OpenGL_Color(const GLfloat* color,Array<GLfloat>& colors){OpenGL_Color4(color,colors);}
 
+////Immutable storage for persistently mapped buffers: core since GL 4.4, otherwise through ARB_buffer_storage
+inline bool OpenGL_Has_Buffer_Storage()
+{return glBufferStorage!=nullptr&&(GLAD_GL_ARB_buffer_storage||GLVersion.major>4||(GLVersion.major==4&&GLVersion.minor>=4));}
+
 #endif
@@ -0,0 +1,207 @@
+//#####################################################################
+// OpenGL Frame Capture
+// Asynchronous framebuffer readback through a ring of pixel-pack buffers, flipped and encoded on worker threads
+//#####################################################################
+#ifndef __OpenGLFrameCapture_h__
+#define __OpenGLFrameCapture_h__
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <glad.h>
+#include "Common.h"
+#include "File.h"
+#include "Parallel.h"
+#include "FrameSink.h"
+
+struct OpenGLCaptureStats
+{
+	size_type requested=0;		////frames passed to Capture
+	size_type written=0;		////files the workers finished
+	size_type dropped=0;		////frames skipped because every buffer was busy (drop_when_busy)
+	size_type failed=0;			////files that could not be written
+	size_type stalls=0;			////captures that waited for a buffer or a worker
+	size_type bytes=0;			////pixel bytes read back
+	double encode_ms=0.;		////worker time spent flipping and encoding, summed over workers
+	double seconds=0.;			////wall time from the first capture to the last written file
+
+	double Frames_Per_Second() const {return seconds>0.?(double)written/seconds:0.;}
+	double Encode_Ms_Per_Frame() const {return written>0?encode_ms/(double)written:0.;}
+};
+
+////Capture issues glReadPixels into the next buffer of the ring and returns; the driver copies the pixels while later frames render.
+////A buffer is mapped once its fence has signaled, at the latest when the ring comes back to it ring_size frames later, and a worker
+////converts the mapped rows, bottom-up as GL returns them, into a pooled staging image, flags the buffer for unmapping by the render
+////thread and encodes the image. The render thread never copies or encodes pixels; it only blocks when all buffers are still busy,
+////or drops the frame instead with drop_when_busy, e.g., for interactive recording.
+class OpenGLFrameCapture
+{
+public:
+	////Converts h rows of w texels read with a given format into top-down RGB8; src is the mapped buffer, rows bottom-up
+	typedef std::function<void(const unsigned char* src,const int w,const int h,unsigned char* dst)> Convert;
+
+	int ring_size=3;				////buffers in flight; a frame is mapped at most ring_size-1 frames after it was read
+	int worker_num=4;
+	bool drop_when_busy=false;
+	std::shared_ptr<FrameSink> sink=std::make_shared<PngSink>();	////file sink of the captures that do not name one, e.g., FBO dumps
+
+	static OpenGLFrameCapture* Instance(){static OpenGLFrameCapture instance;return &instance;}
+
+	////Reads the w x h rectangle at (x,y) of the bound read framebuffer into frame_sink, file_name without extension;
+	////format and type as for glReadPixels, converted with convert (a row flip of RGB8 if empty)
+	void Capture(const int x,const int y,const int w,const int h,const std::string& file_name,std::shared_ptr<FrameSink> frame_sink=nullptr,
+		const GLenum format=GL_RGB,const GLenum type=GL_UNSIGNED_BYTE,const int texel_bytes=3,Convert convert=nullptr)
+	{
+		if(w<=0||h<=0)return;
+		if(frame_sink==nullptr)frame_sink=sink;
+		Initialize();
+		{std::lock_guard<std::mutex> lock(mtx);stats.requested++;
+		if(stats.requested==1)start=std::chrono::steady_clock::now();}
+		Update();
+		Slot& slot=*ring[next];
+		if(slot.state!=Slot::Free){
+			if(drop_when_busy){std::lock_guard<std::mutex> lock(mtx);stats.dropped++;return;}
+			{std::lock_guard<std::mutex> lock(mtx);stats.stalls++;}
+			Wait(slot);}
+
+		size_type size=(size_type)w*h*texel_bytes;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER,slot.pbo);
+		if(size>slot.capacity){glBufferData(GL_PIXEL_PACK_BUFFER,(GLsizeiptr)size,nullptr,GL_STREAM_READ);slot.capacity=size;}
+		glPixelStorei(GL_PACK_ALIGNMENT,1);
+		glReadPixels(x,y,w,h,format,type,nullptr);
+		glPixelStorei(GL_PACK_ALIGNMENT,4);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+		slot.fence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+		slot.w=w;slot.h=h;slot.size=size;slot.file_name=file_name;slot.convert=convert;
+		slot.sink=frame_sink;slot.index=frame_sink->frame_num++;
+		slot.state=Slot::Reading;
+		next=(next+1)%(int)ring.size();
+		{std::lock_guard<std::mutex> lock(mtx);stats.bytes+=size;}
+	}
+
+	////Render thread, once per frame: hands the buffers whose reads finished to the workers and unmaps those they are done with
+	void Update()
+	{
+		for(auto& s:ring){Slot& slot=*s;
+			if(slot.state==Slot::Reading&&glClientWaitSync(slot.fence,0,0)!=GL_TIMEOUT_EXPIRED)Dispatch(slot);
+			if(slot.state==Slot::Mapped&&slot.done)Release(slot);}
+	}
+
+	////Blocks until every captured frame is written
+	void Finish()
+	{
+		if(ring.empty())return;
+		for(int i=0;i<(int)ring.size();i++){Slot& slot=*ring[(next+i)%ring.size()];if(slot.state!=Slot::Free)Wait(slot);}
+		while(true){{std::lock_guard<std::mutex> lock(mtx);if(encoding==0)break;}std::this_thread::sleep_for(std::chrono::milliseconds(1));}
+	}
+
+	OpenGLCaptureStats Stats(){std::lock_guard<std::mutex> lock(mtx);return stats;}
+
+	std::string Stats_String()
+	{
+		OpenGLCaptureStats s=Stats();
+		return "Captured: "+std::to_string(s.written)+"/"+std::to_string(s.requested)+", dropped: "+std::to_string(s.dropped)
+			+", "+std::to_string((int)(s.Frames_Per_Second()+.5))+" fps, encode "+std::to_string((int)(s.Encode_Ms_Per_Frame()+.5))+" ms/frame";
+	}
+
+protected:
+	struct Slot
+	{
+		enum State{Free,Reading,Mapped} state=Free;
+		GLuint pbo=0;
+		size_type capacity=0;
+		size_type size=0;
+		GLsync fence=0;
+		int w=0,h=0;
+		std::string file_name;
+		Convert convert;
+		std::shared_ptr<FrameSink> sink;
+		size_type index=0;				////of the frame in its sink
+		const unsigned char* mapped=nullptr;
+		std::atomic<bool> done{false};		////set by the worker once it no longer reads mapped
+	};
+
+	Array<std::unique_ptr<Slot> > ring;
+	int next=0;
+	std::unique_ptr<Parallel::ThreadPool> pool;
+	Array<std::unique_ptr<Array<unsigned char> > > staging;	////free images, reused across frames
+	int encoding=0;					////frames handed to the workers and not written yet
+	OpenGLCaptureStats stats;
+	std::chrono::steady_clock::time_point start;
+	std::mutex mtx;
+
+	void Initialize()
+	{
+		if((int)ring.size()==std::max(ring_size,1))return;
+		Finish();
+		for(auto& s:ring)glDeleteBuffers(1,&s->pbo);
+		ring.clear();next=0;
+		for(int i=0;i<std::max(ring_size,1);i++){ring.push_back(std::unique_ptr<Slot>(new Slot()));glGenBuffers(1,&ring.back()->pbo);}
+		if(pool==nullptr)pool.reset(new Parallel::ThreadPool(std::max(1,std::min(worker_num,Parallel::Thread_Num()))));
+	}
+
+	////Waits for the read of slot, then for the worker converting it, and frees it
+	void Wait(Slot& slot)
+	{
+		if(slot.state==Slot::Reading){
+			while(glClientWaitSync(slot.fence,GL_SYNC_FLUSH_COMMANDS_BIT,1000000)==GL_TIMEOUT_EXPIRED){}
+			Dispatch(slot);}
+		while(slot.state==Slot::Mapped&&!slot.done)std::this_thread::sleep_for(std::chrono::microseconds(100));
+		if(slot.state==Slot::Mapped)Release(slot);
+	}
+
+	void Dispatch(Slot& slot)
+	{
+		glDeleteSync(slot.fence);slot.fence=0;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER,slot.pbo);
+		slot.mapped=(const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER,0,(GLsizeiptr)slot.size,GL_MAP_READ_BIT);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER,0);
+		slot.state=Slot::Mapped;slot.done=false;
+		if(slot.mapped==nullptr){
+			std::cerr<<"Error: [OpenGLFrameCapture] Cannot map the pixel-pack buffer of "<<slot.file_name<<std::endl;
+			slot.sink->Skip(slot.index);slot.sink=nullptr;
+			std::lock_guard<std::mutex> lock(mtx);stats.failed++;slot.done=true;return;}
+
+		std::unique_ptr<Array<unsigned char> > image=Acquire_Staging((size_type)slot.w*slot.h*3);
+		{std::lock_guard<std::mutex> lock(mtx);encoding++;}
+		Slot* s=&slot;
+		const int w=slot.w,h=slot.h;const std::string file_name=slot.file_name;const Convert convert=slot.convert;
+		const std::shared_ptr<FrameSink> frame_sink=slot.sink;const size_type index=slot.index;slot.sink=nullptr;
+		std::shared_ptr<Array<unsigned char> > shared_image(image.release());
+		pool->Enqueue([this,s,w,h,file_name,convert,frame_sink,index,shared_image](){
+			auto t0=std::chrono::steady_clock::now();
+			unsigned char* dst=shared_image->data();
+			if(convert)convert(s->mapped,w,h,dst);
+			else for(int i=0;i<h;i++)std::memcpy(dst+(size_type)w*3*(h-1-i),s->mapped+(size_type)w*3*i,(size_type)w*3);
+			s->done=true;	////the slot may be reused from here on
+			bool ok=frame_sink->Write(index,file_name,w,h,dst);
+			double ms=std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-t0).count();
+			std::lock_guard<std::mutex> lock(mtx);
+			encoding--;stats.encode_ms+=ms;
+			if(ok)stats.written++;else{stats.failed++;std::cerr<<"Error: [OpenGLFrameCapture] Cannot write "<<file_name<<frame_sink->Extension()<<std::endl;}
+			stats.seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+			staging.push_back(std::unique_ptr<Array<unsigned char> >(new Array<unsigned char>(std::move(*shared_image))));});
+	}
+
+	void Release(Slot& slot)
+	{
+		if(slot.mapped!=nullptr){glBindBuffer(GL_PIXEL_PACK_BUFFER,slot.pbo);glUnmapBuffer(GL_PIXEL_PACK_BUFFER);glBindBuffer(GL_PIXEL_PACK_BUFFER,0);}
+		slot.mapped=nullptr;slot.state=Slot::Free;
+	}
+
+	std::unique_ptr<Array<unsigned char> > Acquire_Staging(const size_type size)
+	{
+		std::unique_ptr<Array<unsigned char> > image;
+		{std::lock_guard<std::mutex> lock(mtx);
+		if(!staging.empty()){image=std::move(staging.back());staging.pop_back();}}
+		if(image==nullptr)image.reset(new Array<unsigned char>());
+		image->resize(size);
+		return image;
+	}
+};
+
+#endif
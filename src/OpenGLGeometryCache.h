@@ -0,0 +1,171 @@
+//#####################################################################
+// OpenGL Geometry Cache
+// Reference-counted meshes shared by the objects that load the same file
+//#####################################################################
+#ifndef __OpenGLGeometryCache_h__
+#define __OpenGLGeometryCache_h__
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <glad.h>
+#include "Mesh.h"
+#include "OpenGLCommon.h"
+#include "OpenGLVertexLayout.h"
+#include "OpenGLBounds.h"
+#include "OpenGLAssetWatcher.h"
+
+////One packed upload of a shared mesh. The vertex stream depends on the layout and, without per-vertex colors, on the constant color,
+////so objects only reuse the buffers if both match.
+struct OpenGLGeometryBuffers
+{
+	GLuint vbo=0,ebo=0;
+	OpenGLVertexLayout layout;
+	float color[4]={0.f,0.f,0.f,0.f};
+	int vtx_size=0;
+	int ele_size=0;
+	Box3f local_box;
+
+	bool Match(const OpenGLVertexLayout& _layout,const float* _color) const
+	{return layout==_layout&&(_color==nullptr||std::equal(color,color+4,_color));}
+};
+
+////All meshes read from one file. The geometries made from it hold it, so while one mesh of a file is in use, asking for another
+////mesh of the same file does not read and parse the file again.
+struct OpenGLGeometryFile
+{
+	Array<std::shared_ptr<TriangleMesh<3> > > meshes;
+};
+
+////A mesh read from a file, with the GPU buffers packed from it. The objects that hold it alias its arrays (SimplicialMesh::Share)
+////and bind its buffers instead of uploading their own; an object that edits its mesh detaches first (copy-on-write).
+class OpenGLGeometry
+{
+public:
+	std::string key;							////file name, size, modification time and loader options
+	std::shared_ptr<TriangleMesh<3> > mesh;
+	std::shared_ptr<OpenGLGeometryFile> file;	////the meshes parsed together with mesh
+	Array<OpenGLGeometryBuffers> buffers;		////one entry per layout and color the objects asked for
+	int version=0;								////bumped when the file is reloaded
+	std::mutex mtx;
+
+	bool Find_Buffers(const OpenGLVertexLayout& layout,const float* color,OpenGLGeometryBuffers& found)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for(const auto& b:buffers)if(b.Match(layout,color)){found=b;return true;}
+		return false;
+	}
+
+	void Add_Buffers(const OpenGLGeometryBuffers& b)
+	{std::lock_guard<std::mutex> lock(mtx);buffers.push_back(b);}
+
+	////Render thread: swaps in the mesh read again from the file. The old buffers are still bound by the objects until they
+	////re-share the geometry (OpenGLObject::Reload_Assets), so they are handed back to be deleted after that.
+	void Replace(std::shared_ptr<TriangleMesh<3> > _mesh,Array<GLuint>& retired_buffers)
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		mesh=_mesh;version++;
+		for(const auto& b:buffers){retired_buffers.push_back(b.vbo);retired_buffers.push_back(b.ebo);}
+		buffers.clear();
+	}
+};
+
+struct OpenGLGeometryCacheStats
+{
+	size_type loads=0;			////files read and parsed
+	size_type hits=0;			////requests served by a geometry that was already loaded
+	size_type shared_uploads=0;	////uploads skipped because an object bound the buffers of another
+	size_type reloads=0;		////geometries replaced after their file changed
+};
+
+////Keyed by file name, size, modification time and loader options. The cache holds weak references: a geometry lives as long as
+////an object uses it, so a file that changed on disk gets a new key and is read again, and an unused one is released.
+////The size and modification time stand in for a content hash (File::Hash_File), so a hit does not read the file. The cost is that
+////a file rewritten with the same size within the resolution of its time stamp is taken as unchanged; the loaders behind it, e.g.,
+////Obj::Read_From_Obj_File_Cached, still check their binary caches against the content hash, so a miss never maps stale data.
+////A geometry in use is also watched: when its file changes, the loader reads it again on the watcher thread and the render thread
+////swaps the mesh in, keeping the key the objects found it under.
+class OpenGLGeometryCache
+{
+public:
+	typedef std::function<bool(const std::string&,Array<std::shared_ptr<TriangleMesh<3> > >&)> Loader;
+	OpenGLGeometryCacheStats stats;
+
+	static OpenGLGeometryCache* Instance(){static OpenGLGeometryCache instance;return &instance;}
+
+	////Mesh mesh_idx of file_name, read with load on a miss; null if the file cannot be read or has no such mesh
+	std::shared_ptr<OpenGLGeometry> Get(const std::string& file_name,const std::string& options,const Loader& load,const int mesh_idx=0)
+	{
+		if(!File::File_Exists(file_name)){std::cerr<<"Error: [OpenGLGeometryCache] Cannot read "<<file_name<<std::endl;return nullptr;}
+		unsigned long long h=File::Hash_Bytes(options.data(),options.size());
+		std::string file_key=file_name+"#"+std::to_string(File::File_Size(file_name))+"#"+std::to_string(File::File_Modified_Time(file_name))
+			+"#"+std::to_string(h);
+		std::string key=file_key+"#"+std::to_string(mesh_idx);
+
+		std::lock_guard<std::mutex> lock(mtx);
+		auto search=geometry_hashtable.find(key);
+		if(search!=geometry_hashtable.end()){
+			std::shared_ptr<OpenGLGeometry> geometry=search->second.lock();
+			if(geometry!=nullptr){stats.hits++;return geometry;}}
+
+		////another mesh of the file may be in use, in which case the file was parsed already
+		std::shared_ptr<OpenGLGeometryFile> file;
+		auto file_search=file_hashtable.find(file_key);
+		if(file_search!=file_hashtable.end())file=file_search->second.lock();
+		if(file==nullptr){
+			file=std::make_shared<OpenGLGeometryFile>();
+			if(!load(file_name,file->meshes)){
+				std::cerr<<"Error: [OpenGLGeometryCache] Load "<<file_name<<" failed"<<std::endl;return nullptr;}
+			stats.loads++;
+			file_hashtable[file_key]=file;}
+		if(mesh_idx<0||mesh_idx>=(int)file->meshes.size()){
+			std::cerr<<"Error: [OpenGLGeometryCache] "<<file_name<<" has no mesh "<<mesh_idx<<std::endl;return nullptr;}
+
+		std::shared_ptr<OpenGLGeometry> geometry=std::make_shared<OpenGLGeometry>();
+		geometry->key=key;geometry->mesh=file->meshes[mesh_idx];geometry->file=file;
+		geometry_hashtable[key]=geometry;
+		Watch(geometry,file_name,load,mesh_idx);
+		return geometry;
+	}
+
+	////Render thread, after the objects re-shared the reloaded geometries
+	void Delete_Retired_Buffers()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if(!retired_buffers.empty())glDeleteBuffers((GLsizei)retired_buffers.size(),retired_buffers.data());
+		retired_buffers.clear();
+	}
+
+	////Drops the entries whose geometry is no longer used
+	void Purge()
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for(auto iter=geometry_hashtable.begin();iter!=geometry_hashtable.end();){
+			if(iter->second.expired())iter=geometry_hashtable.erase(iter);else iter++;}
+		for(auto iter=file_hashtable.begin();iter!=file_hashtable.end();){
+			if(iter->second.expired())iter=file_hashtable.erase(iter);else iter++;}
+	}
+
+protected:
+	Hashtable<std::string,std::weak_ptr<OpenGLGeometry> > geometry_hashtable;
+	Hashtable<std::string,std::weak_ptr<OpenGLGeometryFile> > file_hashtable;
+	Array<GLuint> retired_buffers;
+	std::mutex mtx;
+
+	void Watch(std::shared_ptr<OpenGLGeometry> geometry,const std::string& file_name,const Loader& load,const int mesh_idx)
+	{
+		std::weak_ptr<OpenGLGeometry> weak=geometry;
+		OpenGLAssetWatcher::Instance()->Watch(file_name,"mesh:"+geometry->key,[this,weak,file_name,load,mesh_idx]()->OpenGLAssetWatcher::Step{
+			if(weak.expired())return OpenGLAssetWatcher::Step();
+			Array<std::shared_ptr<TriangleMesh<3> > > meshes;
+			if(!load(file_name,meshes)||mesh_idx>=(int)meshes.size()){
+				std::cerr<<"Error: [OpenGLGeometryCache] Reload mesh "<<mesh_idx<<" of "<<file_name<<" failed"<<std::endl;return OpenGLAssetWatcher::Step();}
+			std::shared_ptr<TriangleMesh<3> > mesh=meshes[mesh_idx];
+			return [this,weak,mesh](){
+				std::shared_ptr<OpenGLGeometry> geometry=weak.lock();if(geometry==nullptr)return;
+				std::lock_guard<std::mutex> lock(mtx);
+				geometry->Replace(mesh,retired_buffers);stats.reloads++;};});
+	}
+};
+
+#endif
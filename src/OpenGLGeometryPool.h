@@ -0,0 +1,232 @@
+//#####################################################################
+// OpenGL Geometry Pool
+// Static meshes suballocated from large shared vertex and index buffers, drawn with multi-draw indirect
+//#####################################################################
+#ifndef __OpenGLGeometryPool_h__
+#define __OpenGLGeometryPool_h__
+#include <map>
+#include <memory>
+#include <glad.h>
+#include "Common.h"
+#include "OpenGLVertexLayout.h"
+#include "OpenGLStateCache.h"
+
+////glMultiDrawElementsIndirect, loaded at run time
+typedef void (APIENTRYP OpenGLMultiDrawProc)(GLenum mode,GLenum type,const void* indirect,GLsizei draw_num,GLsizei stride);
+
+////Indirect draw command, laid out as glMultiDrawElementsIndirect reads it
+struct OpenGLDrawCommand
+{
+	GLuint count=0;
+	GLuint instance_num=1;
+	GLuint first_index=0;
+	GLint base_vertex=0;
+	GLuint base_instance=0;		////row of the per-draw stream the draw reads
+};
+
+////First fit over [0,capacity); adjacent free ranges are merged
+class OpenGLRangeAllocator
+{
+public:
+	size_type capacity=0;
+	std::map<size_type,size_type> free_ranges;	////begin -> size
+
+	bool Allocate(const size_type n,size_type& begin)
+	{
+		for(auto iter=free_ranges.begin();iter!=free_ranges.end();iter++){
+			if(iter->second<n)continue;
+			begin=iter->first;size_type rest=iter->second-n;
+			free_ranges.erase(iter);if(rest>0)free_ranges[begin+n]=rest;
+			return true;}
+		return false;
+	}
+
+	void Free(const size_type begin,const size_type n)
+	{
+		if(n==0)return;
+		auto iter=free_ranges.insert(std::make_pair(begin,n)).first;
+		auto next=std::next(iter);
+		if(next!=free_ranges.end()&&iter->first+iter->second==next->first){iter->second+=next->second;free_ranges.erase(next);}
+		if(iter!=free_ranges.begin()){auto prev=std::prev(iter);
+			if(prev->first+prev->second==iter->first){prev->second+=iter->second;free_ranges.erase(iter);}}
+	}
+
+	void Grow(const size_type new_capacity){if(new_capacity>capacity){Free(capacity,new_capacity-capacity);capacity=new_capacity;}}
+};
+
+class OpenGLGeometryArena;
+
+////Vertex and index ranges of one mesh in an arena. Indices keep their local values; draws add vtx_begin as the base vertex.
+struct OpenGLGeometrySlot
+{
+	std::shared_ptr<OpenGLGeometryArena> arena;
+	size_type vtx_begin=0,vtx_num=0;
+	size_type ele_begin=0,ele_num=0;
+};
+
+////Shared buffers of one vertex layout. The VAO also reads a per-draw stream at draw_location.. draw_location+6 with a divisor of 1,
+////in the layout of OpenGLInstancedMesh: a draw selects its row with the base instance of its command, so shaders written for
+////instanced meshes (e.g., basic.vert of a9) draw a batch of different meshes unchanged.
+class OpenGLGeometryArena
+{
+public:
+	static const GLuint draw_location=8;
+	static const int draw_float_num=28;
+
+	OpenGLVertexLayout layout;
+	GLuint vao=0,vbo=0,ebo=0;
+	GLuint draw_vbo=0,indirect_vbo=0;
+	OpenGLRangeAllocator vertices,elements;
+
+	void Initialize(const OpenGLVertexLayout& _layout,const size_type vtx_capacity,const size_type ele_capacity)
+	{
+		layout=_layout;
+		glGenVertexArrays(1,&vao);glGenBuffers(1,&draw_vbo);glGenBuffers(1,&indirect_vbo);
+		////one identity row, so the stream is never read out of bounds before the first batch
+		GLfloat row[draw_float_num]={1.f,0.f,0.f,0.f,0.f,1.f,0.f,0.f,0.f,0.f,1.f,0.f,0.f,0.f,0.f,1.f};
+		glBindBuffer(GL_ARRAY_BUFFER,draw_vbo);glBufferData(GL_ARRAY_BUFFER,sizeof(row),row,GL_STREAM_DRAW);glBindBuffer(GL_ARRAY_BUFFER,0);
+		Resize_Buffer(vbo,0,layout.Byte_Size(vtx_capacity));vertices.Grow(vtx_capacity);
+		Resize_Buffer(ebo,0,ele_capacity*sizeof(GLuint));elements.Grow(ele_capacity);
+		Set_Vertex_Array();
+	}
+
+	////Grows the buffers by doubling if the ranges do not fit
+	bool Allocate(const size_type vtx_num,const size_type ele_num,OpenGLGeometrySlot& slot)
+	{
+		bool grown=false;
+		while(!vertices.Allocate(vtx_num,slot.vtx_begin)){
+			size_type capacity=std::max(vertices.capacity*2,vertices.capacity+vtx_num);
+			Resize_Buffer(vbo,layout.Byte_Size(vertices.capacity),layout.Byte_Size(capacity));vertices.Grow(capacity);grown=true;}
+		while(!elements.Allocate(ele_num,slot.ele_begin)){
+			size_type capacity=std::max(elements.capacity*2,elements.capacity+ele_num);
+			Resize_Buffer(ebo,elements.capacity*sizeof(GLuint),capacity*sizeof(GLuint));elements.Grow(capacity);grown=true;}
+		if(grown)Set_Vertex_Array();
+		slot.vtx_num=vtx_num;slot.ele_num=ele_num;
+		return true;
+	}
+
+	////CPU-side only, so it is safe after the context is gone
+	void Free(const OpenGLGeometrySlot& slot){vertices.Free(slot.vtx_begin,slot.vtx_num);elements.Free(slot.ele_begin,slot.ele_num);}
+
+	////Copies the packed vertices and indices of an object's buffers into the slot, on the GPU
+	void Copy_From(const GLuint src_vbo,const GLuint src_ebo,const OpenGLGeometrySlot& slot)
+	{
+		Copy_Buffer(src_vbo,vbo,0,layout.Byte_Size(slot.vtx_begin),layout.Byte_Size(slot.vtx_num));
+		Copy_Buffer(src_ebo,ebo,0,slot.ele_begin*sizeof(GLuint),slot.ele_num*sizeof(GLuint));
+	}
+
+	////The stream of a single draw outside a batch, which reads the first row
+	void Set_Draw_Row(const GLfloat* row) const
+	{
+		glBindBuffer(GL_ARRAY_BUFFER,draw_vbo);
+		glBufferData(GL_ARRAY_BUFFER,draw_float_num*sizeof(GLfloat),row,GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER,0);
+	}
+
+	////One call for all commands; draw_data holds draw_float_num floats per command
+	void Multi_Draw(OpenGLStateCache& state,const Array<OpenGLDrawCommand>& commands,const Array<GLfloat>& draw_data,
+		OpenGLMultiDrawProc multi_draw) const
+	{
+		if(commands.empty())return;
+		glBindBuffer(GL_ARRAY_BUFFER,draw_vbo);
+		glBufferData(GL_ARRAY_BUFFER,draw_data.size()*sizeof(GLfloat),draw_data.data(),GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER,0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER,indirect_vbo);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER,commands.size()*sizeof(OpenGLDrawCommand),commands.data(),GL_STREAM_DRAW);
+		state.Bind_Vertex_Array(vao);
+		if(multi_draw!=nullptr)multi_draw(GL_TRIANGLES,GL_UNSIGNED_INT,nullptr,(GLsizei)commands.size(),0);
+		else for(size_type i=0;i<commands.size();i++)glDrawElementsIndirect(GL_TRIANGLES,GL_UNSIGNED_INT,(const GLvoid*)(i*sizeof(OpenGLDrawCommand)));
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER,0);
+	}
+
+protected:
+	static void Copy_Buffer(const GLuint src,const GLuint dst,const size_type src_offset,const size_type dst_offset,const size_type bytes)
+	{
+		if(bytes==0)return;
+		glBindBuffer(GL_COPY_READ_BUFFER,src);glBindBuffer(GL_COPY_WRITE_BUFFER,dst);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER,GL_COPY_WRITE_BUFFER,(GLintptr)src_offset,(GLintptr)dst_offset,(GLsizeiptr)bytes);
+		glBindBuffer(GL_COPY_READ_BUFFER,0);glBindBuffer(GL_COPY_WRITE_BUFFER,0);
+	}
+
+	////Reallocates buffer with new_bytes and keeps its first old_bytes; the name changes, so the VAO is set again
+	static void Resize_Buffer(GLuint& buffer,const size_type old_bytes,const size_type new_bytes)
+	{
+		GLuint resized=0;glGenBuffers(1,&resized);
+		glBindBuffer(GL_COPY_WRITE_BUFFER,resized);
+		glBufferData(GL_COPY_WRITE_BUFFER,(GLsizeiptr)new_bytes,nullptr,GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER,0);
+		if(old_bytes>0)Copy_Buffer(buffer,resized,0,0,old_bytes);
+		glDeleteBuffers(1,&buffer);buffer=resized;
+	}
+
+	void Set_Vertex_Array()
+	{
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER,vbo);
+		for(const auto& attr:layout.attributes){
+			glVertexAttribPointer(attr.location,attr.size,GL_FLOAT,GL_FALSE,layout.stride*sizeof(GLfloat),(GLvoid*)(attr.offset*sizeof(GLfloat)));
+			glEnableVertexAttribArray(attr.location);}
+		glBindBuffer(GL_ARRAY_BUFFER,draw_vbo);
+		for(GLuint j=0;j<(GLuint)draw_float_num/4;j++){
+			glVertexAttribPointer(draw_location+j,4,GL_FLOAT,GL_FALSE,draw_float_num*sizeof(GLfloat),(GLvoid*)(j*4*sizeof(GLfloat)));
+			glEnableVertexAttribArray(draw_location+j);
+			glVertexAttribDivisor(draw_location+j,1);}
+		glBindBuffer(GL_ARRAY_BUFFER,0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,ebo);
+		glBindVertexArray(0);
+		OpenGLStateCache::Instance()->Invalidate();
+	}
+};
+
+////One arena per vertex layout. Slots are reference counted: objects that share their buffers (OpenGLGeometryCache) pass the same
+////key and get the same slot, which is released with its last holder.
+class OpenGLGeometryPool
+{
+public:
+	size_type initial_vtx_capacity=1<<16;
+	size_type initial_ele_capacity=3<<16;
+	size_type slot_num=0;		////slots acquired, shared ones counted once
+
+	static OpenGLGeometryPool* Instance(){static OpenGLGeometryPool instance;return &instance;}
+
+	////glMultiDrawElementsIndirect is GL 4.3 and not in the bundled loader; the window passes it in if the driver has it.
+	////Without it a batch is issued as consecutive glDrawElementsIndirect calls on the same buffers.
+	void Set_Multi_Draw_Proc(void* proc){multi_draw=(OpenGLMultiDrawProc)proc;}
+	OpenGLMultiDrawProc Multi_Draw_Proc() const {return multi_draw;}
+
+	////Slot holding a copy of vtx_num vertices of src_vbo and ele_num indices of src_ebo; key is empty for buffers that are not shared
+	std::shared_ptr<OpenGLGeometrySlot> Acquire(const GLuint src_vbo,const GLuint src_ebo,const OpenGLVertexLayout& layout,
+		const size_type vtx_num,const size_type ele_num,const std::string& key="")
+	{
+		if(!key.empty()){
+			auto search=slot_hashtable.find(key);
+			if(search!=slot_hashtable.end()){
+				std::shared_ptr<OpenGLGeometrySlot> slot=search->second.lock();
+				if(slot!=nullptr&&slot->arena->layout==layout&&slot->vtx_num==vtx_num&&slot->ele_num==ele_num)return slot;}}
+
+		std::shared_ptr<OpenGLGeometryArena> arena=Arena(layout);
+		OpenGLGeometrySlot* raw=new OpenGLGeometrySlot();raw->arena=arena;
+		arena->Allocate(vtx_num,ele_num,*raw);
+		arena->Copy_From(src_vbo,src_ebo,*raw);
+		std::shared_ptr<OpenGLGeometrySlot> slot(raw,[](OpenGLGeometrySlot* s){s->arena->Free(*s);delete s;});
+		if(!key.empty())slot_hashtable[key]=slot;
+		slot_num++;
+		return slot;
+	}
+
+protected:
+	Array<std::shared_ptr<OpenGLGeometryArena> > arenas;
+	Hashtable<std::string,std::weak_ptr<OpenGLGeometrySlot> > slot_hashtable;
+	OpenGLMultiDrawProc multi_draw=nullptr;
+
+	std::shared_ptr<OpenGLGeometryArena> Arena(const OpenGLVertexLayout& layout)
+	{
+		for(auto& a:arenas)if(a->layout==layout)return a;
+		std::shared_ptr<OpenGLGeometryArena> arena=std::make_shared<OpenGLGeometryArena>();
+		arena->Initialize(layout,initial_vtx_capacity,initial_ele_capacity);
+		arenas.push_back(arena);
+		return arena;
+	}
+};
+
+#endif
@@ -0,0 +1,103 @@
+//#####################################################################
+// OpenGL Headless Context
+// An EGL context without a window or display server, e.g., for Mesa llvmpipe on render servers
+//#####################################################################
+#ifndef __OpenGLHeadlessContext_h__
+#define __OpenGLHeadlessContext_h__
+#include <cstring>
+#include <iostream>
+#ifdef USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+////The context is made current without any surface (EGL_KHR_surfaceless_context), so the window renders into its own framebuffer
+////object. Displays are tried in order: the Mesa surfaceless platform, the first EGL device, and the default display.
+////Requires USE_EGL and linking libEGL; otherwise Create fails.
+class OpenGLHeadlessContext
+{
+public:
+	int major=4,minor=2;			////core profile version requested, as by the GLUT window
+
+	bool Create()
+	{
+#ifdef USE_EGL
+		display=Get_Display();
+		EGLint egl_major=0,egl_minor=0;
+		if(display==EGL_NO_DISPLAY||!eglInitialize(display,&egl_major,&egl_minor)){
+			std::cerr<<"Error: [OpenGLHeadlessContext] Cannot initialize an EGL display"<<std::endl;return false;}
+		const char* extensions=eglQueryString(display,EGL_EXTENSIONS);
+		if(extensions==nullptr||std::strstr(extensions,"EGL_KHR_surfaceless_context")==nullptr){
+			std::cerr<<"Error: [OpenGLHeadlessContext] EGL_KHR_surfaceless_context is not supported"<<std::endl;return false;}
+		if(!eglBindAPI(EGL_OPENGL_API)){std::cerr<<"Error: [OpenGLHeadlessContext] Cannot bind the OpenGL API"<<std::endl;return false;}
+
+		////any config renders to framebuffer objects; a context without one needs EGL_KHR_no_config_context
+		const EGLint config_attribs[]={EGL_SURFACE_TYPE,EGL_PBUFFER_BIT,EGL_RENDERABLE_TYPE,EGL_OPENGL_BIT,EGL_NONE};
+		EGLConfig config=nullptr;EGLint config_num=0;
+		if(!eglChooseConfig(display,config_attribs,&config,1,&config_num)||config_num==0){
+			if(std::strstr(extensions,"EGL_KHR_no_config_context")==nullptr){
+				std::cerr<<"Error: [OpenGLHeadlessContext] No EGL config for OpenGL"<<std::endl;return false;}
+			config=nullptr;}
+
+		const EGLint context_attribs[]={EGL_CONTEXT_MAJOR_VERSION,major,EGL_CONTEXT_MINOR_VERSION,minor,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK,EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,EGL_NONE};
+		context=eglCreateContext(display,config,EGL_NO_CONTEXT,context_attribs);
+		if(context==EGL_NO_CONTEXT){
+			std::cerr<<"Error: [OpenGLHeadlessContext] Cannot create an OpenGL "<<major<<"."<<minor<<" core context"<<std::endl;return false;}
+		if(!eglMakeCurrent(display,EGL_NO_SURFACE,EGL_NO_SURFACE,context)){
+			std::cerr<<"Error: [OpenGLHeadlessContext] Cannot make the context current"<<std::endl;return false;}
+		std::cout<<"Headless EGL "<<egl_major<<"."<<egl_minor<<", vendor: "<<eglQueryString(display,EGL_VENDOR)<<std::endl;
+		return true;
+#else
+		std::cerr<<"Error: [OpenGLHeadlessContext] Built without USE_EGL"<<std::endl;
+		return false;
+#endif
+	}
+
+	static void* Get_Proc_Address(const char* name)
+	{
+#ifdef USE_EGL
+		return (void*)eglGetProcAddress(name);
+#else
+		return nullptr;
+#endif
+	}
+
+	void Destroy()
+	{
+#ifdef USE_EGL
+		if(display==EGL_NO_DISPLAY)return;
+		eglMakeCurrent(display,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT);
+		if(context!=EGL_NO_CONTEXT)eglDestroyContext(display,context);
+		eglTerminate(display);
+		display=EGL_NO_DISPLAY;context=EGL_NO_CONTEXT;
+#endif
+	}
+
+	~OpenGLHeadlessContext(){Destroy();}
+
+protected:
+#ifdef USE_EGL
+	EGLDisplay display=EGL_NO_DISPLAY;
+	EGLContext context=EGL_NO_CONTEXT;
+
+	static EGLDisplay Get_Display()
+	{
+		const char* client_extensions=eglQueryString(EGL_NO_DISPLAY,EGL_EXTENSIONS);
+		auto get_platform_display=(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if(client_extensions!=nullptr&&get_platform_display!=nullptr){
+			if(std::strstr(client_extensions,"EGL_MESA_platform_surfaceless")!=nullptr){
+				EGLDisplay d=get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,EGL_DEFAULT_DISPLAY,nullptr);
+				if(d!=EGL_NO_DISPLAY)return d;}
+			auto query_devices=(PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+			EGLDeviceEXT device;EGLint device_num=0;
+			if(std::strstr(client_extensions,"EGL_EXT_platform_device")!=nullptr&&query_devices!=nullptr
+				&&query_devices(1,&device,&device_num)&&device_num>0){
+				EGLDisplay d=get_platform_display(EGL_PLATFORM_DEVICE_EXT,device,nullptr);
+				if(d!=EGL_NO_DISPLAY)return d;}}
+		return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+#endif
+};
+
+#endif
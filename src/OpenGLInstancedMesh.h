@@ -0,0 +1,126 @@
+//#####################################################################
+// OpenGL Instanced Mesh
+// One triangle mesh drawn many times with per-instance transforms and materials
+//#####################################################################
+#ifndef __OpenGLInstancedMesh_h__
+#define __OpenGLInstancedMesh_h__
+#include "OpenGLMesh.h"
+
+////Per-instance data, laid out as it is uploaded: the model matrix column by column, then ka with the shininess in w, kd and ks
+struct OpenGLInstance
+{
+	Matrix4f model=Matrix4f::Identity();
+	Vector4f ka_shininess=Vector4f(.1f,.1f,.1f,0.f);
+	Vector4f kd=Vector4f(.7f,.7f,.7f,0.f);
+	Vector4f ks=Vector4f(2.f,2.f,2.f,0.f);
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+////The geometry lives once in the VBO/EBO of the base mesh; the instances go to a second buffer read with a divisor of 1,
+////and all of them are drawn with one glDrawElementsInstanced call.
+////The shader reads the instance stream at locations instance_location.. instance_location+6:
+////	layout(location=8) in vec4 inst_model0; ... layout(location=11) in vec4 inst_model3;
+////	layout(location=12) in vec4 inst_ka;	layout(location=13) in vec4 inst_kd;	layout(location=14) in vec4 inst_ks;
+////Only ShadingMode::TexAlpha is drawn, with the state of OpenGLTriangleMesh; the model and material uniforms are still set
+////from the object and may be ignored by the shader.
+class OpenGLInstancedMesh : public OpenGLTriangleMesh
+{public:typedef OpenGLTriangleMesh Base;
+	static const GLuint instance_location=8;	////above the mesh attributes, including the skinning streams
+	static const int instance_float_num=28;
+
+	AlignedArray<OpenGLInstance> instances;
+	GLuint instance_vbo=0;
+	int instance_vbo_num=0;			////instances in instance_vbo
+	bool instances_dirty=true;
+
+	OpenGLInstancedMesh(){name="instanced_mesh";shading_mode=ShadingMode::TexAlpha;}
+
+	int Add_Instance(const Matrix4f& model,const Vector3f& ka=Vector3f(.1f,.1f,.1f),const Vector3f& kd=Vector3f(.7f,.7f,.7f),
+		const Vector3f& ks=Vector3f(2.f,2.f,2.f),const float shininess=0.f)
+	{
+		OpenGLInstance instance;instance.model=model;
+		instance.ka_shininess<<ka,shininess;instance.kd<<kd,0.f;instance.ks<<ks,0.f;
+		instances.push_back(instance);instances_dirty=true;
+		return (int)instances.size()-1;
+	}
+
+	void Set_Instance_Model(const int i,const Matrix4f& model){instances[i].model=model;instances_dirty=true;}
+	void Clear_Instances(){instances.clear();instances_dirty=true;}
+	int Instance_Num() const {return (int)instances.size();}
+
+	virtual void Update_Data_To_Render()
+	{
+		Base::Update_Data_To_Render();
+		if(!instances_dirty||vao==0)return;
+
+		Array<GLfloat> data(instances.size()*instance_float_num);
+		for(size_type i=0;i<instances.size();i++){GLfloat* p=&data[i*instance_float_num];const OpenGLInstance& inst=instances[i];
+			std::memcpy(p,inst.model.data(),16*sizeof(GLfloat));
+			std::memcpy(p+16,inst.ka_shininess.data(),4*sizeof(GLfloat));
+			std::memcpy(p+20,inst.kd.data(),4*sizeof(GLfloat));
+			std::memcpy(p+24,inst.ks.data(),4*sizeof(GLfloat));}
+
+		bool first=(instance_vbo==0);
+		if(first)glGenBuffers(1,&instance_vbo);
+		glBindBuffer(GL_ARRAY_BUFFER,instance_vbo);
+		if(first||(int)instances.size()!=instance_vbo_num)glBufferData(GL_ARRAY_BUFFER,data.size()*sizeof(GLfloat),data.data(),GL_DYNAMIC_DRAW);
+		else glBufferSubData(GL_ARRAY_BUFFER,0,data.size()*sizeof(GLfloat),data.data());
+		if(first){
+			glBindVertexArray(vao);
+			for(GLuint j=0;j<(GLuint)instance_float_num/4;j++){
+				glVertexAttribPointer(instance_location+j,4,GL_FLOAT,GL_FALSE,instance_float_num*sizeof(GLfloat),(GLvoid*)(j*4*sizeof(GLfloat)));
+				glEnableVertexAttribArray(instance_location+j);
+				glVertexAttribDivisor(instance_location+j,1);}
+			glBindVertexArray(0);}
+		glBindBuffer(GL_ARRAY_BUFFER,0);
+		instance_vbo_num=(int)instances.size();
+		instances_dirty=false;instance_bounds_changed=true;
+	}
+
+	////Union of the instance boxes; the group is drawn or culled as a whole
+	virtual void Update_Bounds()
+	{
+		if(!local_box_changed&&!instance_bounds_changed)return;
+		Box3f box=local_box;
+		if(!box.isEmpty()&&bounds_padding>0.f){box.min().array()-=bounds_padding;box.max().array()+=bounds_padding;}
+		Box3f world_box;world_box.setEmpty();
+		for(const auto& inst:instances){OpenGLBounds b;b.Initialize(box,inst.model);if(!b.Empty())world_box.extend(b.box);}
+		world_bounds.Initialize(world_box,Matrix4f::Identity());
+		local_box_changed=false;instance_bounds_changed=false;
+	}
+
+	////The instance stream is part of the own vao, so the geometry is never pooled
+	virtual bool Use_Geometry_Pool() const {return false;}
+
+	////The depth shader takes a single model matrix, so instances cast no shadows
+	virtual void Preprocess(){}
+
+	virtual void Draw_Elements() const {glDrawElementsInstanced(GL_TRIANGLES,ele_size,GL_UNSIGNED_INT,0,instance_vbo_num);}
+
+	virtual bool Draw_Item(OpenGLDrawItem& item) const
+	{
+		if(!Base::Draw_Item(item))return false;
+		item.instance_num=std::max(instance_vbo_num,1);
+		return true;
+	}
+
+	virtual void Display_Queued(OpenGLStateCache& state) const
+	{if(!instances.empty()&&instance_vbo!=0)Base::Display_Queued(state);}
+
+	virtual void Display() const
+	{
+		if(!visible||mesh.elements.empty()||instances.empty()||instance_vbo==0)return;
+		Update_Polygon_Mode();
+		std::shared_ptr<OpenGLShaderProgram> shader=shader_programs[0];
+		shader->Begin();
+		Set_TexAlpha_State(shader);
+		glBindVertexArray(vao);
+		Draw_Elements();
+		shader->End();
+	}
+
+protected:
+	bool instance_bounds_changed=true;
+};
+
+#endif
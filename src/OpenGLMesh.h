@@ -13,12 +13,15 @@
 #include "OpenGLShaderProgram.h"
 #include "OpenGLTexture.h"
 #include "OpenGLBufferObjects.h"
+#include "OpenGLGeometryCache.h"
+#include "OpenGLRenderQueue.h"
 
 const OpenGLColor default_mesh_color=OpenGLColor::Blue();
 
 template<class T_MESH> class OpenGLMesh: public OpenGLObject
 {public:typedef OpenGLObject Base;typedef T_MESH MESH_TYPE;using Base::Add_Shader_Program;
 	T_MESH mesh;
+	std::shared_ptr<FramePrefetcher<T_MESH> > mesh_prefetcher=nullptr;
 	OpenGLMesh(){}
 
 	virtual void Initialize()
@@ -34,26 +37,59 @@ template<class T_MESH> class OpenGLMesh: public OpenGLObject
 	{
 		if(!Update_Data_To_Render_Pre())return;
 
-		for(auto& p:mesh.Vertices()){
-			OpenGL_Vertex4_And_Color4(p,color.rgba,opengl_vertices);}		////position, 4 floats; color, 4 floats
-		for(auto& e:mesh.elements)OpenGL_Vertex(e,opengl_elements);
+		const size_type n=mesh.Vertices().size();
+		vtx_layout.Clear();
+		vtx_layout.Add_Attribute(4);	////position
+		vtx_layout.Add_Attribute(4);	////color
+		Set_OpenGL_Vertices(vtx_layout,n,[&](GLfloat* dst){
+			Pack_Vertex_Attribute(Vertex_Stream(mesh.Vertices(),n),n,vtx_layout[0],vtx_layout.stride,dst);
+			Pack_Vertex_Attribute_Constant(color.rgba,n,vtx_layout[1],vtx_layout.stride,dst);});
+		Set_OpenGL_Vertex_Attributes(vtx_layout);
 
-		Set_OpenGL_Vertices();
-		Set_OpenGL_Vertex_Attribute(0,4,8,0);	////position
-		Set_OpenGL_Vertex_Attribute(1,4,8,4);	////color
+		Pack_Elements(mesh.elements,opengl_elements);
 		Set_OpenGL_Elements();
+		mesh.dirty.Clear();
 
 		Update_Data_To_Render_Post();
 	}
 
+	////A full refresh marks every mesh attribute dirty
+	virtual void Set_Data_Refreshed(const bool _refreshed=true)
+	{Base::Set_Data_Refreshed(_refreshed);if(_refreshed)mesh.Set_Dirty();}
+
+	////Partial refresh: only the given attributes (bits of MeshAttributeFlag) in the vertex range [begin,end) are uploaded again
+	virtual void Set_Attributes_Refreshed(const unsigned int attributes,const size_type begin=0,const size_type end=MeshDirtyState::max_end)
+	{mesh.Set_Dirty(attributes,begin,end);Base::Set_Data_Refreshed();}
+
+	virtual void Enable_Prefetch(const int read_ahead,std::shared_ptr<FrameMemoryBudget> budget=nullptr)
+	{
+		if(File::File_Extension_Name(name)=="txt")return;
+		mesh_prefetcher=std::make_shared<FramePrefetcher<T_MESH> >(output_dir,name,read_ahead,budget);
+		mesh_prefetcher->read=[](const std::string& file_name,T_MESH& data){data.elements.clear();return File::Read_Binary_From_File(file_name,data);};
+		prefetcher=mesh_prefetcher;
+	}
+
 	virtual void Refresh(const int frame)
 	{
+		if(mesh_prefetcher!=nullptr){
+			////swap the decoded arrays in; the prefetcher keeps the previous ones to read a later frame into
+			bool topology_changed=false;
+			if(mesh_prefetcher->Acquire(frame,mesh,[&topology_changed](T_MESH& loaded,T_MESH& current){
+				topology_changed=(loaded.elements!=current.elements);
+				loaded.Vertices().swap(current.Vertices());loaded.elements.swap(current.elements);})){
+				Set_Attributes_Refreshed(MeshAttributeFlag::Position|(topology_changed?MeshAttributeFlag::Topology:0));
+				if(verbose)std::cout<<"Read frame "<<frame<<" of "<<name<<std::endl;}
+			return;}
+
 		bool is_binary_file=(File::File_Extension_Name(name)!="txt");std::string file_name=output_dir+"/"+std::to_string(frame)+"/"+name;
 		if(is_binary_file){
 			if(File::File_Exists(file_name)){
-				mesh.elements.clear();
+				auto last_elements=std::move(mesh.elements);mesh.elements.clear();
 				File::Read_Binary_From_File(file_name,mesh);
-				Set_Data_Refreshed();
+				////frames of a simulation usually keep their connectivity; only positions are uploaded then
+				unsigned int attributes=MeshAttributeFlag::Position;
+				if(mesh.elements!=last_elements)attributes|=MeshAttributeFlag::Topology;
+				Set_Attributes_Refreshed(attributes);
 				if(verbose)std::cout<<"Read file "<<file_name<<std::endl;}}
 	}
 };
@@ -97,9 +133,30 @@ class OpenGLTriangleMesh : public OpenGLMesh<TriangleMesh<3> >
 
 	Array<Vector4f> vtx_color;
 	Array<Vector3> vtx_normal;
+	NormalWeighting normal_weighting=NormalWeighting::Uniform;
+	VertexElementAdjacency vtx_adjacency;		////rebuilt only when the mesh topology changes
+	Box3f local_box;							////model-space bounds, refreshed when positions change; empty for skinned meshes
+	float bounds_padding=0.f;					////model-space margin for shaders that displace vertices
+	Matrix4f bounds_model_matrix=Matrix4f::Zero();	////transform world_bounds was computed with
+	bool local_box_changed=true;
+	std::shared_ptr<OpenGLGeometry> geometry=nullptr;	////mesh shared with other objects loading the same file, null if the mesh is owned
+	bool buffers_shared=false;					////vbo and ebo belong to geometry and may be bound by other objects
+	int geometry_version=0;						////version of geometry the mesh arrays alias
+	bool use_geometry_pool=false;				////static mesh, drawn from a slot of OpenGLGeometryPool
+	std::shared_ptr<OpenGLGeometrySlot> pool_slot=nullptr;
+	GLuint own_vao=0;							////vao of the own buffers while vao is the pool's
 
 	GLfloat iTime=0;
 
+	////Uniform handles of the TexAlpha path, resolved once per shader link
+	struct TexAlphaUniforms
+	{
+		OpenGLUniform iTime{"iTime"},model{"model"},ka{"ka"},kd{"kd"},ks{"ks"},shininess{"shininess"},skybox{"skybox"};
+		Array<OpenGLUniform> samplers;
+	};
+	mutable TexAlphaUniforms tex_alpha_uniforms;
+	mutable OpenGLUbos::OpenGLUboRange object_range;	////this object's block in the uniform ring
+
 	void setTime(GLfloat time) { iTime=time; }
 
 	void Set_Model_Matrix(const Eigen::Matrix<float, 4, 4>& _model_matrix)
@@ -116,6 +173,72 @@ class OpenGLTriangleMesh : public OpenGLMesh<TriangleMesh<3> >
 
     OpenGLTriangleMesh(){color=default_mesh_color;name="triangle_mesh";shading_mode=ShadingMode::Lighting;}
 
+	////Alias the arrays of a cached geometry; the first upload packs them, later objects with the same layout bind its buffers
+	void Set_Geometry(std::shared_ptr<OpenGLGeometry> _geometry)
+	{
+		Detach_Geometry();
+		geometry=_geometry;if(geometry==nullptr)return;
+		mesh.Share(*geometry->mesh);geometry_version=geometry->version;
+		Base::Set_Data_Refreshed();
+	}
+
+	////The geometry file was reloaded: alias the new arrays and pack them into own buffers, or bind those another object packed
+	virtual void Reload_Assets()
+	{
+		if(geometry==nullptr||geometry_version==geometry->version)return;
+		Release_Pool_Slot();
+		if(buffers_shared){
+			glGenBuffers(1,&vbo);glGenBuffers(1,&ebo);
+			vtx_size=0;ele_size=0;vtx_layout.Clear();buffers_shared=false;}
+		mesh.Share(*geometry->mesh);geometry_version=geometry->version;
+		Set_Data_Refreshed();
+		Update_Data_To_Render();
+	}
+
+	////Copy-on-write: the shared arrays are copied and the object gets its own buffers, so its edits stay local
+	void Detach_Geometry()
+	{
+		if(geometry==nullptr)return;
+		mesh.Make_Unique();geometry=nullptr;
+		if(buffers_shared){
+			if(initialized){glGenBuffers(1,&vbo);glGenBuffers(1,&ebo);}
+			vtx_size=0;ele_size=0;vtx_layout.Clear();buffers_shared=false;}
+		Set_Data_Refreshed();
+	}
+
+	////A pooled mesh packs its own buffers as usual, then they are copied into the slot on the GPU and, unless they are shared,
+	////emptied; an update releases the slot and packs them again in full
+	virtual bool Use_Geometry_Pool() const {return use_geometry_pool;}
+
+	void Acquire_Pool_Slot()
+	{
+		if(!Use_Geometry_Pool()||pool_slot!=nullptr||ele_size==0||vtx_layout.stride==0)return;
+		std::string key=buffers_shared?std::to_string(vbo)+"/"+std::to_string(ebo):"";
+		pool_slot=OpenGLGeometryPool::Instance()->Acquire(vbo,ebo,vtx_layout,(size_type)vtx_size/vtx_layout.stride,(size_type)ele_size,key);
+		own_vao=vao;vao=pool_slot->arena->vao;
+		if(!buffers_shared){
+			Release_Vertex_Storage();
+			glBindBuffer(GL_COPY_WRITE_BUFFER,ebo);glBufferData(GL_COPY_WRITE_BUFFER,0,nullptr,GL_STATIC_DRAW);
+			glBindBuffer(GL_COPY_WRITE_BUFFER,0);}
+	}
+
+	void Release_Pool_Slot()
+	{
+		if(pool_slot==nullptr)return;
+		vao=own_vao;pool_slot=nullptr;
+		if(!buffers_shared){vtx_size=0;ele_size=0;vtx_layout.Clear();}
+	}
+
+	////The mesh to edit; detaches it first if it is shared
+	TriangleMesh<3>& Edit_Mesh(){Detach_Geometry();return mesh;}
+
+	////Frames read from files overwrite the mesh arrays in place
+	virtual void Refresh(const int frame)
+	{
+		if(geometry!=nullptr&&(mesh_prefetcher!=nullptr||Object_File_Exists(output_dir,frame,name)))Detach_Geometry();
+		Base::Refresh(frame);
+	}
+
 	virtual void Set_Shading_Mode(const ShadingMode& _mode)
 	{
 		shading_mode=_mode;
@@ -152,21 +275,48 @@ class OpenGLTriangleMesh : public OpenGLMesh<TriangleMesh<3> >
 		GLint viewport[4];glGetIntegerv(GL_VIEWPORT,viewport);
 		Compute_Shadow_PV(shadow_pv);
 
-		std::shared_ptr<OpenGLShaderProgram> shader=shader_programs[3];		/////SHADOW TODO: Set the index to be the shadow depth shader
-		shader->Begin();
-		Bind_Uniform_Block_To_Ubo(shader,"camera");
-		shader->Set_Uniform_Matrix4f("shadow_pv",glm::value_ptr(shadow_pv));
-		shader->Set_Uniform_Matrix4f("model",glm::value_ptr(model_matrix));
-		glBindVertexArray(vao);
-		glDrawElements(GL_TRIANGLES,ele_size,GL_UNSIGNED_INT,0);
-		shader->End();
+		////casters off screen can still shadow what is on screen, so the depth pass is culled against the light volume instead of the camera
+		OpenGLFrustum light_frustum;light_frustum.Initialize(Eigen::Map<const Matrix4f>(glm::value_ptr(shadow_pv)));
+		if(!use_culling||world_bounds.Empty()||light_frustum.Intersect(world_bounds)){
+			std::shared_ptr<OpenGLShaderProgram> shader=shader_programs[3];		/////SHADOW TODO: Set the index to be the shadow depth shader
+			shader->Begin();
+			Bind_Uniform_Block_To_Ubo(shader,"camera");
+			shader->Set_Uniform_Matrix4f("shadow_pv",glm::value_ptr(shadow_pv));
+			shader->Set_Uniform_Matrix4f("model",glm::value_ptr(model_matrix));
+			Set_Draw_Data(shader);
+			glBindVertexArray(vao);
+			Draw_Elements();
+			shader->End();}
 		Unbind_Fbo();
 
 		glViewport(viewport[0],viewport[1],viewport[2],viewport[3]);
 	}
+	////Writes the streams enabled by the use_vtx_* flags into dst, in the attribute order of vtx_layout
+	////The stream pointers already start at vertex begin; dst receives the n vertices [begin,begin+n)
+	template<class T_VEC3,class T_VEC2,class T_VEC4> void Pack_Vertices(GLfloat* dst,const size_type begin,const size_type n,const bool do_skinning,
+		const T_VEC3* pos,const T_VEC3* nor,const T_VEC2* uv,const T_VEC4* tan,const T_VEC4* w,const Vector4i* j) const
+	{
+		const GLuint stride=vtx_layout.stride;int idx=0;
+		Pack_Vertex_Attribute(pos,n,vtx_layout[idx++],stride,dst);	////position
+		if(use_vtx_color){
+			const Vector4f* c=Vertex_Stream(vtx_color,n,begin);
+			if(c!=nullptr)Pack_Vertex_Attribute(c,n,vtx_layout[idx++],stride,dst);
+			else Pack_Vertex_Attribute_Constant(color.rgba,n,vtx_layout[idx++],stride,dst);}	////color
+		if(use_vtx_normal){
+			const Vector3* vn=Vertex_Stream(vtx_normal,n,begin);
+			if(vn!=nullptr)Pack_Vertex_Attribute(vn,n,vtx_layout[idx++],stride,dst);
+			else Pack_Vertex_Attribute(nor,n,vtx_layout[idx++],stride,dst);}	////normal
+		if(use_vtx_tex)Pack_Vertex_Attribute(uv,n,vtx_layout[idx++],stride,dst);			////uvs
+		if(use_vtx_tangent)Pack_Vertex_Attribute(tan,n,vtx_layout[idx++],stride,dst);	////tangent
+		if(do_skinning){
+			Pack_Vertex_Attribute(w,n,vtx_layout[idx++],stride,dst);				////weights
+			Pack_Vertex_Attribute_Bits(j,n,vtx_layout[idx++],stride,dst);}		////joints, 4 ints
+	}
+
 	virtual void Update_Data_To_Render()
 	{
 		if(!Update_Data_To_Render_Pre())return;
+		Release_Pool_Slot();
 
 		switch(shading_mode){
 		case ShadingMode::None:
@@ -183,52 +333,241 @@ class OpenGLTriangleMesh : public OpenGLMesh<TriangleMesh<3> >
 		{use_vtx_color=true;use_vtx_normal=true;use_vtx_tangent=true;use_vtx_tex=true;}break;
 		}
 		
-		if(use_vtx_normal&&(mesh.Normals().size()<mesh.Vertices().size()||recomp_vtx_normal)){
-			Update_Normals(mesh,mesh.Normals());}
-
-		if ((use_vtx_tex || use_vtx_tangent) && (mesh.Uvs().size() < mesh.Vertices().size())) {
-			Update_Uvs(mesh, mesh.Uvs());}
-
-		if (use_vtx_tangent && (mesh.Tangents().size() < mesh.Vertices().size() || recomp_vtx_tangent)) {
-			Update_Tangents(mesh);}
-
-		bool doSkinning=mesh.Weights().size() != 0;
-
-		GLuint stride_size=4+(use_vtx_color?4:0)+(use_vtx_normal?4:0)+(use_vtx_tex?4:0)+(use_vtx_tangent?4:0) + (doSkinning ? 8 : 0);
-		int i=0;for(auto& p:mesh.Vertices()){
-			OpenGL_Vertex4(p,opengl_vertices);	////position, 4 floats
-			if(use_vtx_color){
-				if(vtx_color.size()>0)OpenGL_Color4(&vtx_color[i][0],opengl_vertices);
-				else OpenGL_Color4(color.rgba,opengl_vertices);
-			}	////color, 4 floats
-			if(use_vtx_normal){
-				if(vtx_normal.size()>0)OpenGL_Vertex4(vtx_normal[i],opengl_vertices);
-				else OpenGL_Vertex4(mesh.Normals()[i],opengl_vertices);
-			}	////normal, 4 floats
-			if (use_vtx_tex) {
-				OpenGL_Vertex4(mesh.Uvs()[i], opengl_vertices);
-			}	////uvs, 4 floats
-			if (use_vtx_tangent) {
-				OpenGL_Vertex4(mesh.Tangents()[i], opengl_vertices);}	////tangents, 4 floats
-			if (doSkinning) {
-				OpenGL_WeightsAndJoints(mesh.Weights()[i], mesh.Joints()[i], opengl_vertices); ////weights, 4 floats; joints, 4 ints
-			}
-			i++;}
-		for(auto& e:mesh.elements)OpenGL_Vertex(e,opengl_elements);
-
-		Set_OpenGL_Vertices();
-		int idx=0;{Set_OpenGL_Vertex_Attribute(0,4,stride_size,0);idx++;}	////position
-		if (use_vtx_color) { Set_OpenGL_Vertex_Attribute(idx,4,stride_size,idx*4);idx++;}	////color
-		if (use_vtx_normal) { Set_OpenGL_Vertex_Attribute(idx, 4, stride_size, idx * 4); idx++; }	////normal
-		if (use_vtx_tex) { Set_OpenGL_Vertex_Attribute(idx,4,stride_size,idx*4);idx++;}	////uvs
-		if (use_vtx_tangent) { Set_OpenGL_Vertex_Attribute(idx, 4, stride_size, idx * 4); idx++; }	////tangent
-		if (doSkinning) {
-			Set_OpenGL_Vertex_Attribute(idx, 4, stride_size, idx * 4); idx++; // weights
-			Set_OpenGL_Vertex_Attribute(idx, 4, stride_size, idx * 4); idx++; // joints
+		////missing attributes are filled into a shared mesh for all its users, but recomputing them is an edit, and so is a write
+		////through the Edit_* accessors of the mesh, which detached the array written (copy-on-write) and left the shared buffers stale
+		if(geometry!=nullptr&&(recomp_vtx_normal||recomp_vtx_tangent||!mesh.Aliases(*geometry->mesh)))Detach_Geometry();
+
+		////derived attributes are computed on the real-typed arrays; skipped if the mesh only keeps its float32 store
+		MeshDirtyState& dirty=mesh.dirty;
+		if(!mesh.Real_Attributes_Released()&&!mesh.Vertices().empty()){
+			bool update_normal=use_vtx_normal&&(mesh.Normals().size()<mesh.Vertices().size()||recomp_vtx_normal);
+			bool update_tangent=use_vtx_tangent&&(mesh.Tangents().size()<mesh.Vertices().size()||recomp_vtx_tangent);
+			if((update_normal||update_tangent)&&(dirty.Has(MeshAttributeFlag::Topology)||vtx_adjacency.Vertex_Num()!=mesh.Vertices().size()))
+				vtx_adjacency.Initialize(mesh.Elements(),mesh.Vertices().size());
+
+			if(update_normal){
+				Update_Normals(mesh,vtx_adjacency,mesh.Normals(),normal_weighting);dirty.Set(MeshAttributeFlag::Normal);}
+
+			if ((use_vtx_tex || use_vtx_tangent) && (mesh.Uvs().size() < mesh.Vertices().size())) {
+				Update_Uvs(mesh, mesh.Uvs());dirty.Set(MeshAttributeFlag::Uv);}
+
+			if(update_tangent){
+				assert(Tangents_Match_MikkTSpace());
+				Update_Tangents(mesh,vtx_adjacency);dirty.Set(MeshAttributeFlag::Tangent);}
+
+			mesh.Update_Float_Attributes();}
+
+		const TriangleMesh<3>& source=mesh;		////read only, so a shared mesh stays shared
+		const MeshAttributes<3>* attr=source.Use_Float_Attributes()?source.attributes_f.get():nullptr;
+		const size_type n=source.Vertex_Num();
+		bool doSkinning=(attr!=nullptr)?!attr->weights.empty():source.Weights().size() != 0;
+
+		OpenGLVertexLayout layout;
+		layout.Add_Attribute(4);						////position
+		if(use_vtx_color)layout.Add_Attribute(4);		////color
+		if(use_vtx_normal)layout.Add_Attribute(4);		////normal
+		if(use_vtx_tex)layout.Add_Attribute(4);			////uvs
+		if(use_vtx_tangent)layout.Add_Attribute(4);		////tangent
+		if(doSkinning){layout.Add_Attribute(4);layout.Add_Attribute(4);}	////weights; joints
+
+		auto pack=[&](GLfloat* dst,const size_type b,const size_type m){
+			if(attr!=nullptr)Pack_Vertices(dst,b,m,doSkinning,Vertex_Stream(attr->positions,m,b),Vertex_Stream(attr->normals,m,b),Vertex_Stream(attr->uvs,m,b),
+				Vertex_Stream(attr->tangents,m,b),Vertex_Stream(attr->weights,m,b),Vertex_Stream(attr->joints,m,b));
+			else Pack_Vertices(dst,b,m,doSkinning,Vertex_Stream(source.Vertices(),m,b),Vertex_Stream(source.Normals(),m,b),Vertex_Stream(source.Uvs(),m,b),
+				Vertex_Stream(source.Tangents(),m,b),Vertex_Stream(source.Weights(),m,b),Vertex_Stream(source.Joints(),m,b));};
+
+		////a shared geometry is packed once per layout and color; objects that match bind those buffers instead
+		const bool share_buffers=(geometry!=nullptr&&vtx_color.empty()&&vtx_normal.empty());
+		const float* share_color=use_vtx_color?color.rgba:nullptr;
+		if(share_buffers&&Bind_Geometry_Buffers(layout,share_color)){
+			dirty.Clear();assert(mesh.Aliases(*geometry->mesh));Acquire_Pool_Slot();Update_Data_To_Render_Post();return;}
+		if(buffers_shared){		////the bound buffers are used by others, so this layout is packed into new ones
+			glGenBuffers(1,&vbo);glGenBuffers(1,&ebo);
+			vtx_size=0;ele_size=0;vtx_layout.Clear();buffers_shared=false;}
+
+		////a new layout or vertex count reallocates the VBO; otherwise only the dirty vertex range is rewritten
+		bool layout_changed=(layout!=vtx_layout);
+		if(layout_changed||vtx_size!=(int)layout.Float_Num(n)){
+			vtx_layout=layout;
+			Set_OpenGL_Vertices(vtx_layout,n,[&](GLfloat* dst){pack(dst,0,n);});}
+		else if(dirty.Has(MeshAttributeFlag::Vertex)){
+			size_type b=dirty.Begin(n),e=dirty.End(n);
+			if(e>b)Set_OpenGL_Vertices_Range(vtx_layout,b,e-b,[&](GLfloat* dst){pack(dst,b,e-b);});}
+
+		////attribute pointers and indices are only re-specified when they change
+		if(layout_changed)Set_OpenGL_Vertex_Attributes(vtx_layout);
+		if(dirty.Has(MeshAttributeFlag::Topology)||ele_size!=(int)mesh.elements.size()*3){
+			Pack_Elements(mesh.elements,opengl_elements);
+			Set_OpenGL_Elements();}
+		if(dirty.Has(MeshAttributeFlag::Position)){Update_Local_Box(attr,n,doSkinning);local_box_changed=true;}
+		if(share_buffers){
+			OpenGLGeometryBuffers b;b.vbo=vbo;b.ebo=ebo;b.layout=vtx_layout;b.vtx_size=vtx_size;b.ele_size=ele_size;b.local_box=local_box;
+			if(share_color!=nullptr)std::copy(share_color,share_color+4,b.color);
+			geometry->Add_Buffers(b);buffers_shared=true;}
+		dirty.Clear();
+		assert(geometry==nullptr||mesh.Aliases(*geometry->mesh));	////the packing above only reads, so a shared mesh stays shared
+		Acquire_Pool_Slot();
+		Update_Data_To_Render_Post();
+	}
+
+	////Points vao at the buffers another object packed from geometry with the same layout and color; false if there are none yet
+	bool Bind_Geometry_Buffers(const OpenGLVertexLayout& layout,const float* share_color)
+	{
+		OpenGLGeometryBuffers b;
+		if(!geometry->Find_Buffers(layout,share_color,b))return false;
+		if(vbo!=b.vbo||ebo!=b.ebo){
+			if(!buffers_shared){glDeleteBuffers(1,&vbo);glDeleteBuffers(1,&ebo);}
+			vbo=b.vbo;ebo=b.ebo;buffers_shared=true;
+			vtx_layout=layout;Set_OpenGL_Vertex_Attributes(vtx_layout);
+			glBindVertexArray(vao);glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,ebo);glBindVertexArray(0);
+			OpenGLGeometryCache::Instance()->stats.shared_uploads++;}
+		vtx_size=b.vtx_size;ele_size=b.ele_size;
+		local_box=b.local_box;local_box_changed=true;
+		return true;
+	}
+
+	void Update_Local_Box(const MeshAttributes<3>* attr,const size_type n,const bool do_skinning)
+	{
+		local_box.setEmpty();
+		if(do_skinning)return;	////posed in the vertex shader, so the rest pose does not bound it
+		if(attr!=nullptr)for(size_type i=0;i<std::min(n,attr->positions.size());i++)local_box.extend(attr->positions[i]);
+		else{const TriangleMesh<3>& source=mesh;
+			for(size_type i=0;i<std::min(n,source.Vertices().size());i++)local_box.extend(source.Vertices()[i].cast<float>());}
+	}
+
+	virtual void Update_Bounds()
+	{
+		Matrix4f model=Eigen::Map<const Matrix4f>(glm::value_ptr(model_matrix));
+		if(!local_box_changed&&model==bounds_model_matrix)return;
+		Box3f box=local_box;
+		if(!box.isEmpty()&&bounds_padding>0.f){box.min().array()-=bounds_padding;box.max().array()+=bounds_padding;}
+		world_bounds.Initialize(box,model);
+		bounds_model_matrix=model;local_box_changed=false;
+	}
+
+	void Fill_Object_Block(OpenGLUbos::ObjectBlock& block) const
+	{
+		block.model=model_matrix;
+		block.ka=ka;block.shininess=shininess;
+		block.kd=kd;block.iTime=iTime;
+		block.ks=ks;block.pad=0.f;
+	}
+
+	virtual void Write_Uniform_Block(OpenGLUbos::OpenGLUboRing& ring) const
+	{OpenGLUbos::ObjectBlock block;Fill_Object_Block(block);ring.Write(block,object_range);}
+
+	////model, iTime and the material: one range bind if the shader declares the object block and this frame's block is in the ring,
+	////loose uniforms otherwise; the per-draw stream too if the shader reads it
+	void Set_Object_Uniforms(std::shared_ptr<OpenGLShaderProgram> shader) const
+	{
+		using namespace OpenGLUbos;
+		Set_Draw_Data(shader);
+		if(shader->Has_Uniform_Block("object")){
+			auto* ubo=Get_Object_Ubo();
+			if(ubo!=nullptr&&OpenGLUboRing::Instance()->Bind_Range(ubo->binding_point,object_range))return;
+			if(ubo!=nullptr){Fill_Object_Block(ubo->object);ubo->Set_Block_Attributes();ubo->Bind_Block();return;}}
+		shader->Set_Uniform(tex_alpha_uniforms.iTime, iTime);
+		shader->Set_Uniform_Matrix4f(tex_alpha_uniforms.model,glm::value_ptr(model_matrix));
+		shader->Set_Uniform(tex_alpha_uniforms.ka, ka);
+		shader->Set_Uniform(tex_alpha_uniforms.kd, kd);
+		shader->Set_Uniform(tex_alpha_uniforms.ks, ks);
+		shader->Set_Uniform(tex_alpha_uniforms.shininess, shininess);
+	}
+
+	////Blending, textures, material uniforms and uniform blocks of ShadingMode::TexAlpha, for a shader that has begun
+	void Set_TexAlpha_State(std::shared_ptr<OpenGLShaderProgram> shader,OpenGLStateCache* state=nullptr) const
+	{
+		if(state!=nullptr)state->Blend(true);else Enable_Alpha_Blend(); // enable alpha blending
+
+		if(tex_alpha_uniforms.samplers.size()!=textures.size()){
+			tex_alpha_uniforms.samplers.clear();for(const auto& t:textures)tex_alpha_uniforms.samplers.push_back(OpenGLUniform(t.binding_name));}
+		for (int i=0; i < textures.size(); i++) {
+			shader->Set_Uniform(tex_alpha_uniforms.samplers[i], i);
+			textures[i].texture->Bind(i);
 		}
 
-		Set_OpenGL_Elements();
-		Update_Data_To_Render_Post();
+		Set_Object_Uniforms(shader);
+
+		// bind cube map
+		auto cube_map = OpenGLTextureLibrary::Get_Texture("cube_map");
+		if (cube_map) {
+			shader->Set_Uniform(tex_alpha_uniforms.skybox, (int)textures.size());
+			cube_map->Bind((int)textures.size());
+		}
+		////the camera and lights blocks are bound when the program is linked, see OpenGLShaderProgram::Reflect
+	}
+
+	virtual void Draw_Elements() const
+	{
+		if(pool_slot!=nullptr)glDrawElementsBaseVertex(GL_TRIANGLES,ele_size,GL_UNSIGNED_INT,(GLvoid*)(pool_slot->ele_begin*sizeof(GLuint)),(GLint)pool_slot->vtx_begin);
+		else glDrawElements(GL_TRIANGLES,ele_size,GL_UNSIGNED_INT,0);
+	}
+
+	////Row of the per-draw stream of OpenGLGeometryArena, in the layout of OpenGLInstance
+	void Pack_Draw_Data(GLfloat* p) const
+	{
+		std::memcpy(p,glm::value_ptr(model_matrix),16*sizeof(GLfloat));
+		p[16]=ka[0];p[17]=ka[1];p[18]=ka[2];p[19]=shininess;
+		p[20]=kd[0];p[21]=kd[1];p[22]=kd[2];p[23]=0.f;
+		p[24]=ks[0];p[25]=ks[1];p[26]=ks[2];p[27]=0.f;
+	}
+
+	////For shaders that read the per-draw stream instead of the object block (e.g., basic.vert of a9): a pooled mesh puts its row first
+	////in the arena's stream, other vaos take it as generic attribute values, which a disabled array returns for every vertex.
+	////Batches overwrite the stream with their rows, see Display_Batch.
+	////Every draw path of this class calls it next to the model uniform, since such shaders have no model uniform.
+	void Set_Draw_Data(std::shared_ptr<OpenGLShaderProgram> shader) const
+	{
+		if(!shader->Has_Attribute("inst_model0"))return;
+		GLfloat row[OpenGLGeometryArena::draw_float_num];Pack_Draw_Data(row);
+		if(pool_slot!=nullptr){pool_slot->arena->Set_Draw_Row(row);return;}
+		for(GLuint j=0;j<(GLuint)OpenGLGeometryArena::draw_float_num/4;j++)glVertexAttrib4fv(OpenGLGeometryArena::draw_location+j,&row[j*4]);
+	}
+
+	////Only ShadingMode::TexAlpha goes through the render queue
+	virtual bool Draw_Item(OpenGLDrawItem& item) const
+	{
+		if(shading_mode!=ShadingMode::TexAlpha||shader_programs.empty())return false;
+		item.pass=Use_Alpha_Blend()?RenderPass::Transparent:RenderPass::Opaque;
+		item.shader=shader_programs[0].get();
+		item.texture_key=0;for(const auto& t:textures)item.texture_key=item.texture_key*31+(size_type)t.texture->Id();
+		item.slot=pool_slot.get();
+		item.batchable=(pool_slot!=nullptr&&shader_programs[0]->Has_Attribute("inst_model0"));
+		return true;
+	}
+
+	////The state of this object's item is shared by the batch; each mesh contributes a command and a row of per-draw data
+	virtual void Display_Batch(OpenGLStateCache& state,const OpenGLDrawItem* items,const int n) const
+	{
+		if(pool_slot==nullptr){Base::Display_Batch(state,items,n);return;}
+		Array<OpenGLDrawCommand> commands;commands.reserve(n);
+		Array<GLfloat> draw_data;draw_data.reserve(n*OpenGLGeometryArena::draw_float_num);
+		for(int i=0;i<n;i++){
+			const OpenGLTriangleMesh* m=static_cast<const OpenGLTriangleMesh*>(items[i].object);
+			if(!m->visible||m->ele_size==0||m->pool_slot==nullptr)continue;
+			OpenGLDrawCommand c;c.count=(GLuint)m->ele_size;c.first_index=(GLuint)m->pool_slot->ele_begin;
+			c.base_vertex=(GLint)m->pool_slot->vtx_begin;c.base_instance=(GLuint)commands.size();
+			commands.push_back(c);
+			draw_data.resize(draw_data.size()+OpenGLGeometryArena::draw_float_num);
+			m->Pack_Draw_Data(&draw_data[draw_data.size()-OpenGLGeometryArena::draw_float_num]);}
+		if(commands.empty())return;
+
+		state.Polygon_Mode(polygon_mode==PolygonMode::Fill?GL_FILL:GL_LINE);
+		std::shared_ptr<OpenGLShaderProgram> shader=shader_programs[0];
+		shader->Begin();
+		Set_TexAlpha_State(shader,&state);
+		pool_slot->arena->Multi_Draw(state,commands,draw_data,OpenGLGeometryPool::Instance()->Multi_Draw_Proc());
+	}
+
+	virtual void Display_Queued(OpenGLStateCache& state) const
+	{
+		if(!visible||mesh.elements.empty())return;
+		state.Polygon_Mode(polygon_mode==PolygonMode::Fill?GL_FILL:GL_LINE);
+		std::shared_ptr<OpenGLShaderProgram> shader=shader_programs[0];
+		shader->Begin();
+		Set_TexAlpha_State(shader,&state);
+		state.Bind_Vertex_Array(vao);
+		Draw_Elements();
 	}
 
 	virtual void Display() const
@@ -242,9 +581,10 @@ class OpenGLTriangleMesh : public OpenGLMesh<TriangleMesh<3> >
 			std::shared_ptr<OpenGLShaderProgram> shader=shader_programs[0];
 			shader->Begin();
 			shader->Set_Uniform_Matrix4f("model",glm::value_ptr(model_matrix));
+			Set_Draw_Data(shader);
 			Bind_Uniform_Block_To_Ubo(shader,"camera");
 			glBindVertexArray(vao);
-			glDrawElements(GL_TRIANGLES,ele_size,GL_UNSIGNED_INT,0);
+			Draw_Elements();
 			shader->End();
 		}break;
 		case ShadingMode::A2:{
@@ -252,74 +592,43 @@ class OpenGLTriangleMesh : public OpenGLMesh<TriangleMesh<3> >
 			shader->Begin();
 			shader->Set_Uniform_Matrix4f("model",glm::value_ptr(model_matrix));
 			shader->Set_Uniform("iTime", iTime);
+			Set_Draw_Data(shader);
 			Bind_Uniform_Block_To_Ubo(shader,"camera");
 			glBindVertexArray(vao);
-			glDrawElements(GL_TRIANGLES,ele_size,GL_UNSIGNED_INT,0);
+			Draw_Elements();
 			shader->End();		
 		}break;
 		case ShadingMode::Phong:{
 			std::shared_ptr<OpenGLShaderProgram> shader=shader_programs[0];
 			shader->Begin();
-			shader->Set_Uniform_Matrix4f("model",glm::value_ptr(model_matrix));
-			shader->Set_Uniform("iTime", iTime);
-			shader->Set_Uniform("ka", ka);
-			shader->Set_Uniform("kd", kd);
-			shader->Set_Uniform("ks", ks);
-			shader->Set_Uniform("shininess", shininess);
+			Set_Object_Uniforms(shader);
 			Bind_Uniform_Block_To_Ubo(shader,"camera");
 			glBindVertexArray(vao);
-			glDrawElements(GL_TRIANGLES,ele_size,GL_UNSIGNED_INT,0);
+			Draw_Elements();
 			shader->End();		
 		}break;
 		case ShadingMode::Texture:{
 			std::shared_ptr<OpenGLShaderProgram> shader=shader_programs[0];
 			shader->Begin();
-			shader->Set_Uniform("iTime", iTime);
 
 			for (int i=0; i < textures.size(); i++) {
 				shader->Set_Uniform(textures[i].binding_name, i);
 				textures[i].texture->Bind(i);
 			}
 
-			shader->Set_Uniform_Matrix4f("model",glm::value_ptr(model_matrix));
-			shader->Set_Uniform("ka", ka);
-			shader->Set_Uniform("kd", kd);
-			shader->Set_Uniform("ks", ks);
-			shader->Set_Uniform("shininess", shininess);
+			Set_Object_Uniforms(shader);
 
 			Bind_Uniform_Block_To_Ubo(shader,"camera");
 			glBindVertexArray(vao);
-			glDrawElements(GL_TRIANGLES,ele_size,GL_UNSIGNED_INT,0);
+			Draw_Elements();
 			shader->End();		
 		}break;
 		case ShadingMode::TexAlpha: {
 			std::shared_ptr<OpenGLShaderProgram> shader=shader_programs[0];
 			shader->Begin();
-			Enable_Alpha_Blend(); // enable alpha blending
-
-			for (int i=0; i < textures.size(); i++) {
-				shader->Set_Uniform(textures[i].binding_name, i);
-				textures[i].texture->Bind(i);
-			}
-
-			shader->Set_Uniform("iTime", iTime);
-			shader->Set_Uniform_Matrix4f("model",glm::value_ptr(model_matrix));
-			shader->Set_Uniform("ka", ka);
-			shader->Set_Uniform("kd", kd);
-			shader->Set_Uniform("ks", ks);
-			shader->Set_Uniform("shininess", shininess);
-
-			// bind cube map
-			auto cube_map = OpenGLTextureLibrary::Get_Texture("cube_map");
-			if (cube_map) {
-				shader->Set_Uniform("skybox", (int)textures.size());
-				cube_map->Bind((int)textures.size());
-			}
-
-			Bind_Uniform_Block_To_Ubo(shader,"camera");
-			Bind_Uniform_Block_To_Ubo(shader,"lights");
+			Set_TexAlpha_State(shader);
 			glBindVertexArray(vao);
-			glDrawElements(GL_TRIANGLES,ele_size,GL_UNSIGNED_INT,0);
+			Draw_Elements();
 			shader->End();	
 		} break;
 		case ShadingMode::Shadow:{
@@ -332,6 +641,7 @@ class OpenGLTriangleMesh : public OpenGLMesh<TriangleMesh<3> >
 			}
 			
 			shader->Set_Uniform_Matrix4f("model",glm::value_ptr(model_matrix));
+			Set_Draw_Data(shader);
 			
 			Bind_Uniform_Block_To_Ubo(shader,"camera");
 			Bind_Uniform_Block_To_Ubo(shader,"lights");
@@ -340,7 +650,7 @@ class OpenGLTriangleMesh : public OpenGLMesh<TriangleMesh<3> >
 
 			shader->Set_Uniform_Matrix4f("shadow_pv",glm::value_ptr(shadow_pv));
 			glBindVertexArray(vao);
-			glDrawElements(GL_TRIANGLES,ele_size,GL_UNSIGNED_INT,0);
+			Draw_Elements();
 			shader->End();
 		}break;
 		}
@@ -392,14 +702,16 @@ public:typedef OpenGLMesh<TriangleMesh<3> > Base;
 	{
 		if (!Update_Data_To_Render_Pre())return;
 
-		GLuint stride_size=4;
-		int i=0; for (auto& p : mesh.Vertices()) OpenGL_Vertex4(p, opengl_vertices);	////position, 4 floats
-		for (auto& e : mesh.elements)OpenGL_Vertex(e, opengl_elements);
-
-		Set_OpenGL_Vertices();
-		int idx=0; {Set_OpenGL_Vertex_Attribute(0, 4, stride_size, 0); idx++; }	////position
+		const size_type n=mesh.Vertices().size();
+		vtx_layout.Clear();
+		vtx_layout.Add_Attribute(4);	////position
+		Set_OpenGL_Vertices(vtx_layout,n,[&](GLfloat* dst){
+			Pack_Vertex_Attribute(Vertex_Stream(mesh.Vertices(),n),n,vtx_layout[0],vtx_layout.stride,dst);});
+		Set_OpenGL_Vertex_Attributes(vtx_layout);
 
+		Pack_Elements(mesh.elements,opengl_elements);
 		Set_OpenGL_Elements();
+		mesh.dirty.Clear();
 		Update_Data_To_Render_Post();
 	}
 
@@ -449,7 +761,7 @@ public:typedef OpenGLMesh<TriangleMesh<3> > Base;
 			}
 		}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, Default_Framebuffer());
 		glEnable(GL_POLYGON_OFFSET_FILL);
 		glPolygonOffset(1.f, 1.f);
 		glBindVertexArray(vao);
@@ -7,6 +7,8 @@
 #include "OpenGLShaderProgram.h"
 #include "OpenGLTexture.h"
 #include "OpenGLObject.h"
+#include "OpenGLRenderQueue.h"
+#include <iostream>
 
 OpenGLObject::OpenGLObject()
 {
@@ -68,6 +70,7 @@ void OpenGLObject::Set_OpenGL_Vertices()
 
 void OpenGLObject::Set_OpenGL_Vertices(Array<GLfloat>& opengl_vertices,int& vtx_size)
 {
+	if(vbo==vbo_storage)Release_Vertex_Storage();
 	glBindVertexArray(vao);
 	glBindBuffer(GL_ARRAY_BUFFER,vbo);
 	glBufferData(GL_ARRAY_BUFFER,opengl_vertices.size()*sizeof(GLfloat),&opengl_vertices[0],GL_STATIC_DRAW);
@@ -83,7 +86,9 @@ void OpenGLObject::Set_OpenGL_Elements(Array<GLuint>& opengl_elemetns,int& ele_s
 {
 	glBindVertexArray(vao);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,opengl_elements.size()*sizeof(GLuint),&opengl_elements[0],GL_STATIC_DRAW);
+	////same index count: overwrite the existing storage instead of reallocating it
+	if(ele_size>0&&(int)opengl_elements.size()==ele_size)glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,0,opengl_elements.size()*sizeof(GLuint),&opengl_elements[0]);
+	else glBufferData(GL_ELEMENT_ARRAY_BUFFER,opengl_elements.size()*sizeof(GLuint),&opengl_elements[0],GL_STATIC_DRAW);
 	glBindVertexArray(0);
 	ele_size=(int)opengl_elements.size();
 }
@@ -98,6 +103,99 @@ void OpenGLObject::Set_OpenGL_Vertex_Attribute(const GLuint idx,const GLint elem
 	glBindVertexArray(0);	
 }
 
+void OpenGLObject::Set_OpenGL_Vertices(const OpenGLVertexLayout& layout,const size_type vtx_num,const std::function<void(GLfloat*)>& pack)
+{
+	GLsizeiptr byte_size=(GLsizeiptr)layout.Byte_Size(vtx_num);
+	glBindBuffer(GL_ARRAY_BUFFER,vbo);
+	bool packed=false,grown=false;
+	GLfloat* storage=(use_persistent_vbo&&byte_size>0)?Map_Vertex_Storage((size_type)byte_size,grown):nullptr;
+	if(storage!=nullptr){pack(storage);packed=true;}
+	else if(vbo==vbo_storage){Release_Vertex_Storage();glBindBuffer(GL_ARRAY_BUFFER,vbo);grown=true;}	////persistent mapping turned off
+	if(!packed&&use_mapped_vbo&&byte_size>0){
+		glBufferData(GL_ARRAY_BUFFER,byte_size,nullptr,GL_STATIC_DRAW);
+		GLfloat* ptr=(GLfloat*)glMapBufferRange(GL_ARRAY_BUFFER,0,byte_size,GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT);
+		if(ptr!=nullptr){pack(ptr);packed=(glUnmapBuffer(GL_ARRAY_BUFFER)==GL_TRUE);}}
+	if(!packed){	////mapping failed or the buffer was corrupted on unmap; pack into the staging array, whose capacity is kept between updates
+		opengl_vertices.resize(layout.Float_Num(vtx_num));
+		if(byte_size>0)pack(opengl_vertices.data());
+		glBufferData(GL_ARRAY_BUFFER,byte_size,opengl_vertices.data(),GL_STATIC_DRAW);}
+	glBindBuffer(GL_ARRAY_BUFFER,0);
+	vtx_size=(int)layout.Float_Num(vtx_num);
+	if(grown&&vtx_attrib_num>0)Set_OpenGL_Vertex_Attributes(layout);
+}
+
+void OpenGLObject::Set_OpenGL_Vertices_Range(const OpenGLVertexLayout& layout,const size_type begin,const size_type vtx_num,const std::function<void(GLfloat*)>& pack)
+{
+	if(vtx_num==0)return;
+	GLintptr byte_offset=(GLintptr)layout.Byte_Size(begin);
+	GLsizeiptr byte_size=(GLsizeiptr)layout.Byte_Size(vtx_num);
+	glBindBuffer(GL_ARRAY_BUFFER,vbo);
+	bool packed=false,grown=false;
+	if(vbo==vbo_storage&&vbo_mapped!=nullptr&&(size_type)(byte_offset+byte_size)<=vbo_capacity){	////immutable: written through the mapping only
+		GLfloat* storage=Map_Vertex_Storage((size_type)(byte_offset+byte_size),grown);
+		if(storage!=nullptr&&!grown){pack(storage+byte_offset/sizeof(GLfloat));packed=true;}}
+	if(!packed&&use_mapped_vbo){	////whole vertices are rewritten, so the range can be invalidated
+		GLfloat* ptr=(GLfloat*)glMapBufferRange(GL_ARRAY_BUFFER,byte_offset,byte_size,GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_RANGE_BIT);
+		if(ptr!=nullptr){pack(ptr);packed=(glUnmapBuffer(GL_ARRAY_BUFFER)==GL_TRUE);}}
+	if(!packed){
+		opengl_vertices.resize(layout.Float_Num(vtx_num));
+		pack(opengl_vertices.data());
+		glBufferSubData(GL_ARRAY_BUFFER,byte_offset,byte_size,opengl_vertices.data());}
+	glBindBuffer(GL_ARRAY_BUFFER,0);
+}
+
+////Immutable storage, written through a pointer mapped once. It is only replaced when it grows, by half again the size asked for.
+////A rewrite waits for the GPU to finish the commands queued so far, which may still read the old vertices; glBufferSubData
+////synchronizes the same way. Objects rewritten every frame may prefer use_persistent_vbo=false, which orphans the buffer instead.
+GLfloat* OpenGLObject::Map_Vertex_Storage(const size_type byte_size,bool& grown)
+{
+	grown=false;
+	if(!OpenGL_Has_Buffer_Storage())return nullptr;
+	if(vbo==vbo_storage&&vbo_mapped!=nullptr){
+		GLvoid* ptr=nullptr;glGetBufferPointerv(GL_ARRAY_BUFFER,GL_BUFFER_MAP_POINTER,&ptr);
+		if(ptr!=(GLvoid*)vbo_mapped){vbo_storage=0;vbo_mapped=nullptr;vbo_capacity=0;}}	////the name was deleted and reused
+	if(vbo==vbo_storage&&byte_size<=vbo_capacity){
+		GLsync fence=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+		while(true){GLenum result=glClientWaitSync(fence,GL_SYNC_FLUSH_COMMANDS_BIT,1000000000);
+			if(result==GL_ALREADY_SIGNALED||result==GL_CONDITION_SATISFIED||result==GL_WAIT_FAILED)break;}
+		glDeleteSync(fence);
+		return vbo_mapped;}
+
+	if(vbo==vbo_storage){glDeleteBuffers(1,&vbo);glGenBuffers(1,&vbo);glBindBuffer(GL_ARRAY_BUFFER,vbo);grown=true;}
+	const size_type capacity=grown?byte_size+byte_size/2:byte_size;
+	const GLbitfield flags=GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT;
+	glBufferStorage(GL_ARRAY_BUFFER,(GLsizeiptr)capacity,nullptr,flags);
+	vbo_mapped=(GLfloat*)glMapBufferRange(GL_ARRAY_BUFFER,0,(GLsizeiptr)capacity,flags);
+	if(vbo_mapped==nullptr){std::cerr<<"Error: [OpenGLObject] Persistent map of "<<capacity<<" bytes failed, mapping per upload"<<std::endl;
+		use_persistent_vbo=false;}
+	vbo_storage=vbo;vbo_capacity=capacity;
+	return vbo_mapped;
+}
+
+void OpenGLObject::Release_Vertex_Storage()
+{
+	if(vbo==vbo_storage){
+		glDeleteBuffers(1,&vbo);glGenBuffers(1,&vbo);
+		vbo_storage=0;vbo_mapped=nullptr;vbo_capacity=0;}
+	else{glBindBuffer(GL_COPY_WRITE_BUFFER,vbo);glBufferData(GL_COPY_WRITE_BUFFER,0,nullptr,GL_STATIC_DRAW);glBindBuffer(GL_COPY_WRITE_BUFFER,0);}
+}
+
+void OpenGLObject::Set_OpenGL_Vertex_Attributes(const OpenGLVertexLayout& layout)
+{
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER,vbo);
+	for(const auto& attr:layout.attributes){
+		glVertexAttribPointer(attr.location,attr.size,GL_FLOAT,GL_FALSE,layout.stride*sizeof(GLfloat),(GLvoid*)(attr.offset*sizeof(GLfloat)));
+		glEnableVertexAttribArray(attr.location);}
+	for(int i=layout.Size();i<vtx_attrib_num;i++)glDisableVertexAttribArray((GLuint)i);
+	vtx_attrib_num=layout.Size();
+	glBindBuffer(GL_ARRAY_BUFFER,0);
+	glBindVertexArray(0);
+}
+
+void OpenGLObject::Display_Batch(OpenGLStateCache& state,const OpenGLDrawItem* items,const int n) const
+{for(int i=0;i<n;i++)items[i].object->Display_Queued(state);}
+
 bool OpenGLObject::Use_Alpha_Blend() const {return alpha<1.f;}
 
 void OpenGLObject::Enable_Alpha_Blend() const
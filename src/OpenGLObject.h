@@ -5,13 +5,20 @@
 #ifndef __OpenGLObject_h__
 #define __OpenGLObject_h__
 #include <memory>
+#include <functional>
 #include <glad.h>
 #include "OpenGLCommon.h"
+#include "OpenGLVertexLayout.h"
+#include "FramePrefetcher.h"
+#include "OpenGLBounds.h"
 
 ////Forward declaration
 class OpenGLShaderProgram;
 class OpenGLColorMapper;
 class OpenGLTexture;
+class OpenGLStateCache;
+struct OpenGLDrawItem;
+namespace OpenGLUbos{class OpenGLUboRing;}
 
 class OpenGLData
 {
@@ -43,6 +50,19 @@ public:
 
 	Array<GLfloat> opengl_vertices;
 	Array<GLuint> opengl_elements;
+	OpenGLVertexLayout vtx_layout;
+	bool use_mapped_vbo=true;		////pack vertices straight into the mapped VBO; opengl_vertices is the staging fallback
+	bool use_persistent_vbo=true;	////with buffer storage, keep the VBO mapped for good and reallocate it only when it grows
+	GLuint vbo_storage=0;			////the vbo whose immutable storage is mapped at vbo_mapped
+	GLfloat* vbo_mapped=nullptr;
+	size_type vbo_capacity=0;		////bytes of that storage
+	int vtx_attrib_num=0;			////number of enabled vertex attribute arrays in vao
+	std::shared_ptr<FramePrefetcherBase> prefetcher=nullptr;	////background frame loading for Refresh, null if frames are read synchronously
+	////Culling
+	bool use_culling=true;			////objects with empty world_bounds are never culled
+	bool culled=false;				////outside the view frustum in the current frame
+	OpenGLBounds world_bounds;
+
 	int vtx_size=0;
 	int ele_size=0;
 	real scale=(real)1;
@@ -97,7 +117,21 @@ public:
 	virtual void Update_Color_Mapper(){}
 	virtual void Preprocess(){}
     virtual void Display() const {}
+	////Render queue: an object that fills a draw item is sorted with the others and drawn by Display_Queued through the state cache;
+	////the others are drawn with Display in list order
+	virtual bool Draw_Item(OpenGLDrawItem& item) const {return false;}
+	virtual void Display_Queued(OpenGLStateCache& state) const {Display();}
+	////Draws the n batchable items starting with this object's in one call; see OpenGLRenderQueue
+	virtual void Display_Batch(OpenGLStateCache& state,const OpenGLDrawItem* items,const int n) const;
+
+	////Per-frame uniform ring: called for the objects drawn in the frame, before the ring is flushed
+	virtual void Write_Uniform_Block(OpenGLUbos::OpenGLUboRing& ring) const {}
 	virtual void Refresh(const int frame){}
+	virtual void Reload_Assets(){}	////called after the asset watcher replaced files, e.g., to re-share a reloaded mesh
+	////Bring world_bounds up to date with the data and transform; the default leaves them empty
+	virtual void Update_Bounds(){}
+	////Read frames read_ahead ahead on worker threads; objects without per-frame files ignore it
+	virtual void Enable_Prefetch(const int read_ahead,std::shared_ptr<FrameMemoryBudget> budget=nullptr){}
 	virtual void Timer_Refresh(){}
 	virtual std::string Get_String(){return frame_info_string;}
 	virtual void Add_Shader_Program(std::shared_ptr<OpenGLShaderProgram> shader_program) { shader_programs.push_back(shader_program); }
@@ -128,6 +162,16 @@ public:
 	virtual void Set_OpenGL_Elements();
 	void Set_OpenGL_Elements(Array<GLuint>& opengl_elemetns,int& ele_size);
 	virtual void Set_OpenGL_Vertex_Attribute(const GLuint idx,const GLint element_size,const GLuint stride_size=0,GLuint start_idx=0);
+	////Layout-based upload: pack writes vtx_num interleaved vertices into the destination it is given
+	virtual void Set_OpenGL_Vertices(const OpenGLVertexLayout& layout,const size_type vtx_num,const std::function<void(GLfloat*)>& pack);
+	virtual void Set_OpenGL_Vertex_Attributes(const OpenGLVertexLayout& layout);
+	////Partial upload of the vertices [begin,begin+vtx_num) into the existing VBO; pack writes the range only
+	virtual void Set_OpenGL_Vertices_Range(const OpenGLVertexLayout& layout,const size_type begin,const size_type vtx_num,const std::function<void(GLfloat*)>& pack);
+	////Persistent mapping of the bound vbo with room for byte_size bytes, null if unavailable; a larger size replaces the buffer,
+	////and grown is set since vao then points at the old one
+	GLfloat* Map_Vertex_Storage(const size_type byte_size,bool& grown);
+	////Empties vbo; immutable storage cannot be respecified, so the buffer is replaced by a new name
+	void Release_Vertex_Storage();
 	virtual void Set_Color(const OpenGLColor& c){color=c;}
 
 	virtual bool Use_Alpha_Blend() const;
@@ -7,6 +7,7 @@
 #include "Common.h"
 #include "Particles.h"
 #include "File.h"
+#include "MeshAttributes.h"
 #include "OpenGLObject.h"
 #include "OpenGLVectors.h"
 #include "OpenGLShaderProgram.h"
@@ -20,6 +21,7 @@ public:
 	GLfloat point_size=6.f;
 	bool use_varying_point_size=false;
 	Array<GLfloat> varying_point_size;
+	MeshDirtyState dirty;		////particles changed since the last upload; only the Position flag and range are used
 
 	OpenGLPoints(){color=OpenGLColor::Red();name="points";}
 
@@ -36,20 +38,28 @@ public:
 		if(!initialized)Initialize();
 
 		use_vtx_color=(colors!=nullptr&&shading_mode!=ShadingMode::None);
-		GLuint stride_size=4+(use_vtx_color?4:0);
-		Clear_OpenGL_Arrays();
-		GLfloat placeholder=(GLfloat)0;
-		for(size_type i=0;i<(*points).size();i++){
-			OpenGL_Vertex((*points)[i],opengl_vertices);		////position, 3 floats
-			if(use_varying_point_size) OpenGL_Vertex(varying_point_size[i],opengl_vertices);
-			else OpenGL_Vertex(placeholder,opengl_vertices);	////placeholder, 1 float
-			if(use_vtx_color){
-				//OpenGLColor color=color_mapper->Color((*colors)[i]);	////TOFIX
-				OpenGL_Color4(color.rgba,opengl_vertices);}}	////color, 4 floats
-		
-		Set_OpenGL_Vertices();
-		int idx=0;{Set_OpenGL_Vertex_Attribute(0,4,stride_size,0);idx++;}	////position
-		if(use_vtx_color){Set_OpenGL_Vertex_Attribute(idx,4,stride_size,idx*4);idx++;}	////color
+		const size_type n=(*points).size();
+		OpenGLVertexLayout layout;
+		layout.Add_Attribute(4);						////position, 3 floats; point size or placeholder, 1 float
+		if(use_vtx_color)layout.Add_Attribute(4);		////color, 4 floats
+
+		auto pack=[&](GLfloat* dst,const size_type b,const size_type m){
+			Pack_Vertex_Attribute(Vertex_Stream(*points,m,b),m,layout[0],layout.stride,dst);
+			if(use_varying_point_size){GLfloat* p=dst+3;
+				for(size_type i=0;i<m&&b+i<varying_point_size.size();i++,p+=layout.stride)*p=varying_point_size[b+i];}
+			//OpenGLColor color=color_mapper->Color((*colors)[i]);	////TOFIX
+			if(use_vtx_color)Pack_Vertex_Attribute_Constant(color.rgba,m,layout[1],layout.stride,dst);};
+
+		////as for meshes: a new layout or particle count reallocates the VBO, otherwise only the dirty range is rewritten
+		bool layout_changed=(layout!=vtx_layout);
+		if(layout_changed||vtx_size!=(int)layout.Float_Num(n)){
+			vtx_layout=layout;
+			Set_OpenGL_Vertices(vtx_layout,n,[&](GLfloat* dst){pack(dst,0,n);});}
+		else if(dirty.Has(MeshAttributeFlag::Vertex)){
+			size_type b=dirty.Begin(n),e=dirty.End(n);
+			if(e>b)Set_OpenGL_Vertices_Range(vtx_layout,b,e-b,[&](GLfloat* dst){pack(dst,b,e-b);});}
+		if(layout_changed)Set_OpenGL_Vertex_Attributes(vtx_layout);
+		dirty.Clear();
 		Clear_OpenGL_Arrays();
 	}
 
@@ -79,6 +89,7 @@ class OpenGLParticles : public OpenGLObject
 {typedef OpenGLObject Base;
 public:
     T_PARTICLE particles;
+	std::shared_ptr<FramePrefetcher<T_PARTICLE> > particles_prefetcher=nullptr;
 	
 	OpenGLPoints opengl_points;
 	Array<OpenGLVectors> opengl_vector_fields;
@@ -108,8 +119,22 @@ public:
 		Update_Data_To_Render_Post();
 	}
 
+	virtual void Enable_Prefetch(const int read_ahead,std::shared_ptr<FrameMemoryBudget> budget=nullptr)
+	{
+		particles_prefetcher=std::make_shared<FramePrefetcher<T_PARTICLE> >(output_dir,name,read_ahead,budget);
+		prefetcher=particles_prefetcher;
+	}
+
 	virtual void Refresh(const int frame)
 	{
+		if(particles_prefetcher!=nullptr){
+			if(particles_prefetcher->Acquire(frame,particles,[](T_PARTICLE& loaded,T_PARTICLE& current){
+				loaded.XRef().swap(current.XRef());loaded.VRef().swap(current.VRef());loaded.FRef().swap(current.FRef());
+				loaded.MRef().swap(current.MRef());loaded.CRef().swap(current.CRef());loaded.RRef().swap(current.RRef());
+				loaded.PRef().swap(current.PRef());loaded.DRef().swap(current.DRef());}))
+				Set_Data_Refreshed();
+			return;}
+
 		std::string file_name=output_dir+"/"+std::to_string(frame)+"/"+name;
 		if(File::File_Exists(file_name)){
 			File::Read_Binary_From_File(file_name,particles);
@@ -123,14 +148,20 @@ public:
 		for(auto& vf:opengl_vector_fields){vf.Display();}
     }
 
-	virtual void Set_Color(const OpenGLColor& c){color=c;opengl_points.color=c;}
+	////A full refresh rewrites every particle; a partial one only the particles [begin,end), e.g., a simulation moving a subset
+	virtual void Set_Data_Refreshed(const bool _refreshed=true)
+	{Base::Set_Data_Refreshed(_refreshed);if(_refreshed)opengl_points.dirty.Set();}
+	virtual void Set_Attributes_Refreshed(const size_type begin,const size_type end=MeshDirtyState::max_end)
+	{opengl_points.dirty.Set(MeshAttributeFlag::Position,begin,end);Base::Set_Data_Refreshed();}
+
+	virtual void Set_Color(const OpenGLColor& c){color=c;opengl_points.color=c;opengl_points.dirty.Set();}
 
 	virtual void Set_Shading_Mode(const ShadingMode _shading_mode)
 	{shading_mode=_shading_mode;opengl_points.shading_mode=_shading_mode;}
 	virtual void Set_Point_Size(const GLfloat point_size)
 	{opengl_points.point_size=point_size;}
 	virtual void Set_Point_Size(const Array<GLfloat>& point_size)
-	{opengl_points.varying_point_size=point_size;opengl_points.use_varying_point_size=true;}
+	{opengl_points.varying_point_size=point_size;opengl_points.use_varying_point_size=true;opengl_points.dirty.Set();}
 
 protected:
 	void Initialize_Vector_Fields_Helper(Particles<3>* particles=nullptr)
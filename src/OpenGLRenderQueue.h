@@ -0,0 +1,90 @@
+//#####################################################################
+// OpenGL Render Queue
+// Draw items of all objects, sorted by pass, shader, textures and depth before submission
+//#####################################################################
+#ifndef __OpenGLRenderQueue_h__
+#define __OpenGLRenderQueue_h__
+#include <algorithm>
+#include "OpenGLObject.h"
+#include "OpenGLShaderProgram.h"
+#include "OpenGLStateCache.h"
+#include "OpenGLGeometryPool.h"
+
+enum class RenderPass : int {Opaque=0,Transparent=1};
+
+////Filled by OpenGLObject::Draw_Item; the queue sets object and depth
+struct OpenGLDrawItem
+{
+	OpenGLObject* object=nullptr;
+	RenderPass pass=RenderPass::Opaque;
+	const OpenGLShaderProgram* shader=nullptr;
+	size_type texture_key=0;	////hash of the bound texture ids, equal for equal texture sets
+	float depth=0.f;			////view-space distance of the bounds center
+	int instance_num=1;			////copies drawn by the single call of the item
+	const OpenGLGeometrySlot* slot=nullptr;	////set for meshes in the geometry pool
+	bool batchable=false;		////the shader reads the per-draw stream, so the item can share a multi-draw call
+};
+
+////Opaque items are grouped by shader id, then textures, and drawn front to back within a group so that early depth testing rejects
+////hidden fragments; transparent items are drawn after them, back to front, whatever their state.
+////Consecutive opaque items of pooled meshes with the same state and arena are drawn by one multi-draw call.
+class OpenGLRenderQueue
+{
+public:
+	Array<OpenGLDrawItem> items;
+	bool use_multi_draw=true;
+
+	void Clear(){items.clear();}
+
+	////view is the camera view matrix the depths are measured in
+	void Set_View(const Matrix4f& _view){view=_view;}
+
+	void Add(OpenGLObject* object,OpenGLDrawItem item)
+	{
+		item.object=object;
+		const OpenGLBounds& b=object->world_bounds;
+		item.depth=b.Empty()?0.f:-(view*Vector4f(b.center[0],b.center[1],b.center[2],1.f))[2];
+		items.push_back(item);
+	}
+
+	void Sort()
+	{
+		auto shader_id=[](const OpenGLDrawItem& item){return item.shader==nullptr?-1:item.shader->Id();};
+		std::stable_sort(items.begin(),items.end(),[&shader_id](const OpenGLDrawItem& a,const OpenGLDrawItem& b){
+			if(a.pass!=b.pass)return a.pass<b.pass;
+			if(a.pass==RenderPass::Transparent)return a.depth>b.depth;
+			if(a.shader!=b.shader)return shader_id(a)<shader_id(b);
+			if(a.texture_key!=b.texture_key)return a.texture_key<b.texture_key;
+			return a.depth<b.depth;});
+	}
+
+	void Submit(OpenGLStateCache& state) const
+	{
+		for(size_type i=0;i<items.size();){
+			size_type n=use_multi_draw?Batch_Size(i):1;
+			if(n>1){
+				items[i].object->Display_Batch(state,&items[i],(int)n);
+				state.stats.multi_draws++;state.stats.draw_calls++;state.stats.draw_calls_saved+=(int)n-1;}
+			else{
+				items[i].object->Display_Queued(state);
+				state.stats.draw_calls++;state.stats.draw_calls_saved+=items[i].instance_num-1;}
+			i+=n;}
+	}
+
+protected:
+	Matrix4f view=Matrix4f::Identity();
+
+	////Items from i on that can be drawn together with items[i]
+	size_type Batch_Size(const size_type i) const
+	{
+		const OpenGLDrawItem& a=items[i];
+		if(a.pass!=RenderPass::Opaque||!a.batchable||a.slot==nullptr)return 1;
+		size_type j=i+1;
+		for(;j<items.size();j++){const OpenGLDrawItem& b=items[j];
+			if(b.pass!=a.pass||!b.batchable||b.slot==nullptr||b.slot->arena!=a.slot->arena||b.shader!=a.shader
+				||b.texture_key!=a.texture_key||b.object->polygon_mode!=a.object->polygon_mode)break;}
+		return j-i;
+	}
+};
+
+#endif
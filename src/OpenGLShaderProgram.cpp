@@ -4,11 +4,14 @@
 //#####################################################################
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include "File.h"
 #include "OpenGLBufferObjects.h"
 #include "OpenGLShaderProgram.h"
-
-#define DAS_FILE_WATCHER_IMPLEMENTATION
-#include "das_file_watcher.h"
+#include "OpenGLStateCache.h"
+#include "OpenGLAssetWatcher.h"
 
 //////////////////////////////////////////////////////////////////////////
 ////OpenGLShaders
@@ -487,50 +490,127 @@ bool OpenGLShaderProgram::Reload(const std::string& vtx_shader_input, const std:
 }
 	
 void OpenGLShaderProgram::Set_Uniform(const std::string& name,GLint value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniform1i(location,value);}
+{glUniform1i(Uniform_Location(name),value);}
 void OpenGLShaderProgram::Set_Uniform(const std::string& name,GLfloat value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniform1f(location,value);}
+{glUniform1f(Uniform_Location(name),value);}
 void OpenGLShaderProgram::Set_Uniform(const std::string& name,Vector2f value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniform2f(location,value[0],value[1]);}
+{glUniform2f(Uniform_Location(name),value[0],value[1]);}
 void OpenGLShaderProgram::Set_Uniform(const std::string& name,Vector3f value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniform3f(location,value[0],value[1],value[2]);}
+{glUniform3f(Uniform_Location(name),value[0],value[1],value[2]);}
 void OpenGLShaderProgram::Set_Uniform(const std::string& name,Vector4f value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniform4f(location,value[0],value[1],value[2],value[3]);}
+{glUniform4f(Uniform_Location(name),value[0],value[1],value[2],value[3]);}
 
 void OpenGLShaderProgram::Set_Uniform(const std::string& name,glm::vec2 value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniform2f(location,value[0],value[1]);}
+{glUniform2f(Uniform_Location(name),value[0],value[1]);}
 void OpenGLShaderProgram::Set_Uniform(const std::string& name,glm::vec3 value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniform3f(location,value[0],value[1],value[2]);}
+{glUniform3f(Uniform_Location(name),value[0],value[1],value[2]);}
 void OpenGLShaderProgram::Set_Uniform(const std::string& name,glm::vec4 value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniform4f(location,value[0],value[1],value[2],value[3]);}
+{glUniform4f(Uniform_Location(name),value[0],value[1],value[2],value[3]);}
 
 void OpenGLShaderProgram::Set_Uniform_Array(const std::string& name,GLsizei count,const GLint* value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniform1iv(location,count,value);}
+{glUniform1iv(Uniform_Location(name),count,value);}
 void OpenGLShaderProgram::Set_Uniform_Array(const std::string& name,GLsizei count,const GLfloat* value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniform1fv(location,count,value);}
+{glUniform1fv(Uniform_Location(name),count,value);}
 
 void OpenGLShaderProgram::Set_Uniform_Matrix4f(const std::string& name,const GLfloat* value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniformMatrix4fv(location,1,GL_FALSE,value);}
+{glUniformMatrix4fv(Uniform_Location(name),1,GL_FALSE,value);}
 void OpenGLShaderProgram::Set_Uniform_Vec4f(const std::string& name,const GLfloat* value)
-{GLint location=glGetUniformLocation(prg_id,name.c_str());glUniform4f(location,value[0],value[1],value[2],value[3]);}
+{glUniform4f(Uniform_Location(name),value[0],value[1],value[2],value[3]);}
 
 void OpenGLShaderProgram::Set_Uniform_Mat(const Material* mat)
 {Set_Uniform("mat_amb",mat->mat_amb);Set_Uniform("mat_dif",mat->mat_dif);Set_Uniform("mat_spec",mat->mat_spec);Set_Uniform("mat_shinness",mat->mat_shinness);}
 
+void OpenGLShaderProgram::Set_Uniform(OpenGLUniform& uniform,GLint value)
+{glUniform1i(Uniform_Location(uniform),value);}
+void OpenGLShaderProgram::Set_Uniform(OpenGLUniform& uniform,GLfloat value)
+{glUniform1f(Uniform_Location(uniform),value);}
+void OpenGLShaderProgram::Set_Uniform(OpenGLUniform& uniform,const glm::vec3& value)
+{glUniform3f(Uniform_Location(uniform),value[0],value[1],value[2]);}
+void OpenGLShaderProgram::Set_Uniform_Matrix4f(OpenGLUniform& uniform,const GLfloat* value)
+{glUniformMatrix4fv(Uniform_Location(uniform),1,GL_FALSE,value);}
+
+////Names missing from the reflected table, e.g., single array elements, are looked up once and remembered, -1 included
+GLint OpenGLShaderProgram::Uniform_Location(const std::string& name)
+{
+	auto search=uniform_locations.find(name);
+	if(search!=uniform_locations.end())return search->second;
+	GLint location=glGetUniformLocation(prg_id,name.c_str());
+	uniform_locations[name]=location;
+	return location;
+}
+
+GLint OpenGLShaderProgram::Uniform_Location(OpenGLUniform& uniform)
+{
+	if(uniform.program!=this||uniform.link_version!=link_version){
+		uniform.location=Uniform_Location(uniform.name);uniform.program=this;uniform.link_version=link_version;}
+	return uniform.location;
+}
+
 void OpenGLShaderProgram::Bind_Uniform_Block(const std::string& name,const GLuint binding_point)
-{GLuint location=glGetUniformBlockIndex(prg_id,name.c_str());glUniformBlockBinding(prg_id,location,binding_point);}
+{
+	auto bound=block_bindings.find(name);
+	if(bound!=block_bindings.end()&&bound->second==binding_point)return;
+	auto search=uniform_blocks.find(name);
+	if(search==uniform_blocks.end())return;		////not an active block of this program
+	glUniformBlockBinding(prg_id,search->second,binding_point);
+	block_bindings[name]=binding_point;
+}
+
+////Active uniforms and blocks of the linked program; the blocks named after a UBO of the library are bound to it right away
+void OpenGLShaderProgram::Reflect()
+{
+	uniform_locations.clear();uniform_blocks.clear();block_bindings.clear();attribute_locations.clear();link_version++;
+
+	GLint uniform_num=0;glGetProgramiv(prg_id,GL_ACTIVE_UNIFORMS,&uniform_num);
+	char buffer[256];
+	for(GLint i=0;i<uniform_num;i++){
+		GLsizei length=0;GLint size=0;GLenum type=0;
+		glGetActiveUniform(prg_id,(GLuint)i,sizeof(buffer),&length,&size,&type,buffer);
+		std::string uniform_name(buffer,length);
+		GLint location=glGetUniformLocation(prg_id,uniform_name.c_str());
+		if(location<0)continue;		////members of uniform blocks
+		uniform_locations[uniform_name]=location;
+		////arrays are reported as name[0]; they are also set by their plain name
+		size_type bracket=uniform_name.find('[');
+		if(bracket!=std::string::npos)uniform_locations[uniform_name.substr(0,bracket)]=location;}
+
+	GLint block_num=0;glGetProgramiv(prg_id,GL_ACTIVE_UNIFORM_BLOCKS,&block_num);
+	for(GLint i=0;i<block_num;i++){
+		GLsizei length=0;glGetActiveUniformBlockName(prg_id,(GLuint)i,sizeof(buffer),&length,buffer);
+		std::string block_name(buffer,length);
+		uniform_blocks[block_name]=(GLuint)i;
+		GLuint binding_point=OpenGLUbos::Get_Ubo_Binding_Point(block_name);
+		if(binding_point!=GL_INVALID_INDEX)Bind_Uniform_Block(block_name,binding_point);}
+
+	GLint attribute_num=0;glGetProgramiv(prg_id,GL_ACTIVE_ATTRIBUTES,&attribute_num);
+	for(GLint i=0;i<attribute_num;i++){
+		GLsizei length=0;GLint size=0;GLenum type=0;
+		glGetActiveAttrib(prg_id,(GLuint)i,sizeof(buffer),&length,&size,&type,buffer);
+		std::string attribute_name(buffer,length);
+		GLint location=glGetAttribLocation(prg_id,attribute_name.c_str());
+		if(location>=0)attribute_locations[attribute_name]=location;}
+}
 
 void OpenGLShaderProgram::Bind_Texture2D(const std::string& name,GLuint tex_id,GLint tex_unit)
-{GLuint location=glGetUniformLocation(prg_id,name.c_str());glActiveTexture(GL_TEXTURE0+tex_unit);
-glBindTexture(GL_TEXTURE_2D,tex_id);glUniform1i(location,tex_unit);}
+{GLint location=Uniform_Location(name);OpenGLStateCache::Instance()->Bind_Texture(tex_unit,GL_TEXTURE_2D,tex_id);glUniform1i(location,tex_unit);}
 
-void OpenGLShaderProgram::Begin(){if(!compiled)Compile();glUseProgram(prg_id);}
-void OpenGLShaderProgram::End(){glUseProgram(0);}
+void OpenGLShaderProgram::Begin(){if(!compiled)Compile();OpenGLStateCache::Instance()->Use_Program(prg_id);}
+void OpenGLShaderProgram::End(){OpenGLStateCache::Instance()->Use_Program(0);}
 
 bool OpenGLShaderProgram::Compile()
 {
 	if(compiled)return true;
 
+	OpenGLProgramBinaryCache* cache=OpenGLProgramBinaryCache::Instance();
+	std::string key;
+	if(cache->Enabled()){
+		std::string source=vtx_shader+'\0'+frg_shader;
+		if(use_geo)source+='\0'+geo_shader+'\0'+std::to_string(geo_input_type)+' '+std::to_string(geo_output_type)+' '+std::to_string(max_geo_vtx_output);
+		key=cache->Key(source);
+		GLuint cached_id=glCreateProgram();
+		if(cache->Load(key,cached_id)){prg_id=cached_id;compiled=true;Reflect();return true;}
+		glDeleteProgram(cached_id);}
+
 	vtx_id=glCreateShader(GL_VERTEX_SHADER);
 	const char* vtx_shader_string=vtx_shader.c_str();
 	GLint vtx_string_length=(GLint)vtx_shader.length()+1;
@@ -583,6 +663,7 @@ bool OpenGLShaderProgram::Compile()
 		glProgramParameteriEXT(prg_id,GL_GEOMETRY_OUTPUT_TYPE_EXT,geo_output_type);
 		glProgramParameteriEXT(prg_id,GL_GEOMETRY_VERTICES_OUT_EXT,max_geo_vtx_output);}
 
+	if(!key.empty())glProgramParameteri(prg_id,GL_PROGRAM_BINARY_RETRIEVABLE_HINT,GL_TRUE);
 	glLinkProgram(prg_id);
 	GLint prg_link_status;
 	glGetProgramiv(prg_id,GL_LINK_STATUS,&prg_link_status);
@@ -596,10 +677,79 @@ bool OpenGLShaderProgram::Compile()
 	glDeleteShader(vtx_id);
 	glDeleteShader(frg_id);
 	if(use_geo)glDeleteShader(geo_id);
+	if(!key.empty())cache->Save(key,prg_id);
 	compiled=true;
+	Reflect();
 	return true;
 }
 
+//////////////////////////////////////////////////////////////////////////
+////OpenGLProgramBinaryCache
+
+OpenGLProgramBinaryCache* OpenGLProgramBinaryCache::Instance(){static OpenGLProgramBinaryCache instance;return &instance;}
+
+bool OpenGLProgramBinaryCache::Enabled()
+{
+	if(path.empty())return false;
+	if(supported<0){
+		GLint format_num=0;glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS,&format_num);
+		supported=format_num>0?1:0;
+		const GLubyte* strs[3]={glGetString(GL_VENDOR),glGetString(GL_RENDERER),glGetString(GL_VERSION)};
+		for(int i=0;i<3;i++){if(strs[i]!=nullptr)driver+=(const char*)strs[i];driver+='\n';}}
+	return supported==1;
+}
+
+std::string OpenGLProgramBinaryCache::Key(const std::string& source)
+{
+	unsigned long long h=File::Hash_Bytes(driver.data(),driver.size());
+	h=File::Hash_Bytes(source.data(),source.size(),h);
+	std::stringstream ss;ss<<std::hex<<std::setw(16)<<std::setfill('0')<<h;
+	return ss.str();
+}
+
+////File layout: magic, binary format, byte count, bytes
+static const unsigned int program_binary_magic=0x42505247;	////"GRPB"
+
+bool OpenGLProgramBinaryCache::Load(const std::string& key,const GLuint prg_id)
+{
+	std::string file_name=File_Name(key);
+	std::ifstream input(file_name,std::ios::binary);
+	if(!input){misses++;return false;}
+	unsigned int magic=0;GLenum format=0;GLint length=0;
+	input.read((char*)&magic,sizeof(magic));input.read((char*)&format,sizeof(format));input.read((char*)&length,sizeof(length));
+	////a truncated or corrupted length is rejected before anything is allocated for it
+	const long long remaining=File::File_Size(file_name)-(long long)(sizeof(magic)+sizeof(format)+sizeof(length));
+	Array<char> bytes;
+	if(input&&magic==program_binary_magic&&length>0&&(long long)length<=remaining){bytes.resize(length);input.read(bytes.data(),length);}
+	bool read=input&&!bytes.empty();input.close();
+
+	GLint status=GL_FALSE;
+	if(read){glProgramBinary(prg_id,format,bytes.data(),length);glGetProgramiv(prg_id,GL_LINK_STATUS,&status);}
+	if(status!=GL_TRUE){rejected++;misses++;std::remove(file_name.c_str());return false;}
+	hits++;return true;
+}
+
+void OpenGLProgramBinaryCache::Save(const std::string& key,const GLuint prg_id)
+{
+	GLint length=0;glGetProgramiv(prg_id,GL_PROGRAM_BINARY_LENGTH,&length);
+	if(length<=0)return;
+	Array<char> bytes(length);GLenum format=0;
+	glGetProgramBinary(prg_id,length,&length,&format,bytes.data());
+	if(length<=0)return;
+	if(!File::Directory_Exists(path.c_str()))File::Create_Directory(path);
+	////written to a temporary file and moved over the old one, so a crash or another process never leaves a truncated binary
+	std::string file_name=File_Name(key),tmp_name=file_name+".tmp";
+	{std::ofstream output(tmp_name,std::ios::binary);
+	if(!output){std::cerr<<"Error: [OpenGLProgramBinaryCache] Cannot write "<<tmp_name<<std::endl;return;}
+	output.write((const char*)&program_binary_magic,sizeof(program_binary_magic));
+	output.write((const char*)&format,sizeof(format));output.write((const char*)&length,sizeof(length));
+	output.write(bytes.data(),length);
+	output.close();
+	if(!output){std::cerr<<"Error: [OpenGLProgramBinaryCache] Cannot write "<<tmp_name<<std::endl;std::remove(tmp_name.c_str());return;}}
+	if(!File::Replace_File(tmp_name,file_name)){
+		std::cerr<<"Error: [OpenGLProgramBinaryCache] Cannot replace "<<file_name<<std::endl;std::remove(tmp_name.c_str());}
+}
+
 //////////////////////////////////////////////////////////////////////////
 ////OpenGLShaderLibrary
 
@@ -608,7 +758,28 @@ std::shared_ptr<OpenGLShaderProgram> OpenGLShaderLibrary::Get(const std::string&
 {
 	auto search=shader_hashtable.find(name);
 	if(search!=shader_hashtable.end())return search->second;
-	else return std::shared_ptr<OpenGLShaderProgram>(nullptr);
+
+	////first request of a built-in program: parse and compile it now
+	auto source=shader_source_hashtable.find(name);
+	if(source!=shader_source_hashtable.end()){
+		std::shared_ptr<OpenGLShaderProgram> shader=std::make_shared<OpenGLShaderProgram>();
+		shader->Initialize(Parse(source->second.first),Parse(source->second.second));shader->name=name;
+		shader_source_hashtable.erase(source);
+		shader->Compile();
+		shader_hashtable.insert(std::make_pair(name,shader));
+		return shader;}
+
+	////first request of a program from files
+	auto file=shader_file_hashtable.find(name);
+	if(file!=shader_file_hashtable.end()&&!file->second.loaded){
+		std::shared_ptr<OpenGLShaderProgram> shader=std::make_shared<OpenGLShaderProgram>();
+		shader->name=name;
+		Load_Shader_From_File(file->second,shader);
+		file->second.loaded=true;
+		shader_hashtable.insert(std::make_pair(name,shader));
+		return shader;}
+
+	return std::shared_ptr<OpenGLShaderProgram>(nullptr);
 }
 
 OpenGLShaderLibrary::OpenGLShaderLibrary(){Initialize_Shaders();}
@@ -628,21 +799,6 @@ void OpenGLShaderLibrary::Initialize_Shaders()
 	Add_Shader(skybox_vert, skybox_frag, "skybox_default");
 }
 
-void OpenGLShaderLibrary::Update_Shaders()
-{
-	// Go through all shaders that were loaded from files
-	for (auto& file_shaders : shader_file_hashtable) {
-		// Check if any associated file changed
-		if (dasfw_did_change(&file_shaders.second.vtx_info) || 
-			dasfw_did_change(&file_shaders.second.frg_info) ||
-			dasfw_did_change(&file_shaders.second.common_header_info)) {
-			// Reload if yes
-			std::cout << "[OpenGLShaderLibrary] reloading shader: " << file_shaders.first << std::endl;
-			Load_Shader_From_File(file_shaders.second, Get(file_shaders.first));
-		}
-	}
-}
-
 void OpenGLShaderLibrary::Initialize_Headers()
 {
 	shader_header_hashtable.insert(std::make_pair("version",version));
@@ -680,9 +836,8 @@ std::string OpenGLShaderLibrary::Parse(const std::string& shader) const
 
 void OpenGLShaderLibrary::Add_Shader(const std::string& vtx_shader,const std::string& frg_shader,const std::string& name)
 {
-	{std::shared_ptr<OpenGLShaderProgram> shader=std::make_shared<OpenGLShaderProgram>();
-	shader->Initialize(Parse(vtx_shader),Parse(frg_shader));shader->name=name;
-	shader_hashtable.insert(std::make_pair(shader->name,shader));}	
+	if(shader_hashtable.find(name)!=shader_hashtable.end())return;
+	shader_source_hashtable.insert(std::make_pair(name,std::make_pair(vtx_shader,frg_shader)));
 }
 
 std::string Read_All_Text(std::string filename) {
@@ -702,7 +857,7 @@ void Add_Common_Header(std::string& shader, const std::string& header) {
         shader.replace(startPos, endPos - startPos + 2, header);
 }
 
-bool OpenGLShaderLibrary::Load_Shader_From_File(const ShaderFile& file, std::shared_ptr<OpenGLShaderProgram> shader)
+bool OpenGLShaderLibrary::Read_Shader_From_File(const ShaderFile& file,std::string& vtx,std::string& frg) const
 {
 	std::string vtx_shader=Read_All_Text(file.vtx_file);
 	if (vtx_shader == "") {
@@ -721,47 +876,52 @@ bool OpenGLShaderLibrary::Load_Shader_From_File(const ShaderFile& file, std::sha
 		Add_Common_Header(frg_shader, header);
 	}
 
-	// std::cout<<"load vertex shader: "<<vtx_shader<<"\nload fragment shader: "<<frg_shader<<std::endl;
-
-	return shader->Reload(Parse(vtx_shader), Parse(frg_shader));
+	vtx=Parse(vtx_shader);frg=Parse(frg_shader);
+	return true;
 }
 
-void OpenGLShaderLibrary::Add_Shader_From_File(const std::string& vtx_shader_file, const std::string& frg_shader_file, const std::string& name)
+bool OpenGLShaderLibrary::Load_Shader_From_File(const ShaderFile& file, std::shared_ptr<OpenGLShaderProgram> shader)
 {
-	{std::shared_ptr<OpenGLShaderProgram> shader=std::make_shared<OpenGLShaderProgram>();
-	shader->name=name;
-
-	ShaderFile shader_file={
-		vtx_shader_file, frg_shader_file,
-	};
+	std::string vtx_shader,frg_shader;
+	if(!Read_Shader_From_File(file,vtx_shader,frg_shader))return false;
+	return shader->Reload(vtx_shader,frg_shader);
+}
 
-	dasfw_start_watching(vtx_shader_file, &shader_file.vtx_info);
-	dasfw_start_watching(frg_shader_file, &shader_file.frg_info);
+////The files are read and parsed on the watcher thread; the program is relinked on the render thread and keeps the old one if that fails.
+////A program not requested yet is skipped, since its first Get reads the files anyway.
+void OpenGLShaderLibrary::Watch_Shader_Files(const std::string& name)
+{
+	const ShaderFile& file=shader_file_hashtable[name];
+	OpenGLAssetWatcher::Prepare prepare=[this,name,file]()->OpenGLAssetWatcher::Step{
+		std::string vtx,frg;
+		if(!Read_Shader_From_File(file,vtx,frg))return OpenGLAssetWatcher::Step();
+		return [this,name,vtx,frg](){
+			auto search=shader_hashtable.find(name);
+			if(search==shader_hashtable.end())return;
+			std::cout<<"[OpenGLShaderLibrary] reloading shader: "<<name<<std::endl;
+			search->second->Reload(vtx,frg);};};
+	OpenGLAssetWatcher* watcher=OpenGLAssetWatcher::Instance();
+	watcher->Watch(file.vtx_file,"shader:"+name,prepare);
+	watcher->Watch(file.frg_file,"shader:"+name,prepare);
+	watcher->Watch(file.common_header,"shader:"+name,prepare);
+}
 
-	Load_Shader_From_File(shader_file, shader);
+void OpenGLShaderLibrary::Add_Shader_From_File(const std::string& vtx_shader_file, const std::string& frg_shader_file, const std::string& name)
+{
+	{ShaderFile shader_file;
+	shader_file.vtx_file=vtx_shader_file;shader_file.frg_file=frg_shader_file;
 
-	shader_file_hashtable.insert(std::make_pair(shader->name, shader_file));
-	shader_hashtable.insert(std::make_pair(shader->name, shader));}
+	shader_file_hashtable.insert(std::make_pair(name, shader_file));}
+	Watch_Shader_Files(name);
 }
 
 void OpenGLShaderLibrary::Add_Shader_From_File(const std::string& vtx_shader_file, const std::string& frg_shader_file, const std::string& common_header ,const std::string& name) 
 {
-	{std::shared_ptr<OpenGLShaderProgram> shader=std::make_shared<OpenGLShaderProgram>();
-	shader->name=name;
-
-	ShaderFile shader_file={
-		vtx_shader_file, frg_shader_file, common_header,
-	};
-
-	dasfw_start_watching(vtx_shader_file, &shader_file.vtx_info);
-	dasfw_start_watching(frg_shader_file, &shader_file.frg_info);
-	dasfw_start_watching(common_header, &shader_file.common_header_info);
-
-	Load_Shader_From_File(shader_file, shader);
-
-	shader_file_hashtable.insert(std::make_pair(shader->name, shader_file));
-	shader_hashtable.insert(std::make_pair(shader->name, shader));}
+	{ShaderFile shader_file;
+	shader_file.vtx_file=vtx_shader_file;shader_file.frg_file=frg_shader_file;shader_file.common_header=common_header;
 
+	shader_file_hashtable.insert(std::make_pair(name, shader_file));}
+	Watch_Shader_Files(name);
 }
 
 void OpenGLShaderLibrary::Create_Screen_Shader(const std::string& drawFunc, const std::string& name) {
@@ -5,10 +5,10 @@
 #ifndef __OpenGLShaderProgram_H__
 #define __OpenGLShaderProgram_H__
 #include <string>
+#include <atomic>
 #include <glad.h>
 #include "glm.hpp"
 #include "Common.h"
-#include "das_file_watcher.h"
 
 class Material
 {public:
@@ -18,6 +18,19 @@ class Material
 	glm::vec4 mat_shinness=glm::vec4(32.f,0.f,0.f,0.f);
 };
 
+class OpenGLShaderProgram;
+
+////Uniform handle: the location is resolved on first use and kept until the program is relinked (hot reload) or the handle is used
+////with another program
+struct OpenGLUniform
+{
+	std::string name;
+	GLint location=-1;
+	const OpenGLShaderProgram* program=nullptr;
+	int link_version=-1;
+	OpenGLUniform(const std::string& _name=""):name(_name){}
+};
+
 ////shader object
 class OpenGLShaderProgram
 {
@@ -46,7 +59,20 @@ public:
 	void Set_Uniform_Matrix4f(const std::string& name,const GLfloat* value);
 	void Set_Uniform_Vec4f(const std::string& name,const GLfloat* value);
 	void Set_Uniform_Mat(const Material* mat);
+	////Handle versions skip the name lookup
+	void Set_Uniform(OpenGLUniform& uniform,GLint value);
+	void Set_Uniform(OpenGLUniform& uniform,GLfloat value);
+	void Set_Uniform(OpenGLUniform& uniform,const glm::vec3& value);
+	void Set_Uniform_Matrix4f(OpenGLUniform& uniform,const GLfloat* value);
+	GLint Uniform_Location(const std::string& name);
+	GLint Uniform_Location(OpenGLUniform& uniform);
+	int Link_Version() const {return link_version;}
+	////Creation order of the program, kept across relinks; unlike the address it is the same in every run, so draws sort on it
+	int Id() const {return id;}
+	////A no-op if the block is already bound to binding_point since the last link
 	void Bind_Uniform_Block(const std::string& name,const GLuint binding_point);
+	bool Has_Uniform_Block(const std::string& name) const {return uniform_blocks.find(name)!=uniform_blocks.end();}
+	bool Has_Attribute(const std::string& name) const {return attribute_locations.find(name)!=attribute_locations.end();}
 	void Bind_Texture2D(const std::string& name,GLuint tex_id,GLint tex_unit);
 	void Begin();
 	void End();
@@ -61,14 +87,44 @@ protected:
     bool use_geo;
     GLenum geo_input_type,geo_output_type;
 	int max_geo_vtx_output;
+
+	////Reflection, rebuilt by every successful link
+	Hashtable<std::string,GLint> uniform_locations;		////active uniforms, and names looked up since that were not
+	Hashtable<std::string,GLuint> uniform_blocks;		////active block indices
+	Hashtable<std::string,GLuint> block_bindings;		////binding point set for each block
+	Hashtable<std::string,GLint> attribute_locations;	////active vertex inputs
+	int link_version=0;
+	int id=Next_Id();
+	void Reflect();
+	static int Next_Id(){static std::atomic<int> next{0};return next++;}
+};
+
+////Linked programs saved with glGetProgramBinary under the hash of their parsed sources and the driver string, and loaded instead
+////of compiling on later starts. A binary the driver rejects, e.g., after an update that kept the version string, is deleted and
+////the program is built from source.
+class OpenGLProgramBinaryCache
+{public:
+	std::string path="shader_cache";	////directory of the binaries; empty disables the cache
+	int hits=0,misses=0,rejected=0;
+
+	static OpenGLProgramBinaryCache* Instance();
+	bool Enabled();						////needs a context: the driver must offer at least one binary format
+	std::string Key(const std::string& source);
+	bool Load(const std::string& key,const GLuint prg_id);	////glProgramBinary into prg_id; false if missing or rejected
+	void Save(const std::string& key,const GLuint prg_id);
+
+protected:
+	int supported=-1;					////-1: not queried yet
+	std::string driver;
+	std::string File_Name(const std::string& key) const {return path+"/"+key+".bin";}
 };
 
+////Built-in programs and programs from files are parsed and compiled on their first Get
 class OpenGLShaderLibrary
 {public:
 	static OpenGLShaderLibrary* Instance();
 	static std::shared_ptr<OpenGLShaderProgram> Get_Shader(const std::string& name);
 	std::shared_ptr<OpenGLShaderProgram> Get(const std::string& name);
-	void Update_Shaders();
 	void Add_Shader_From_File(const std::string& vtx_shader_file, const std::string& frg_shader_file, const std::string& name);
 	void Add_Shader_From_File(const std::string& vtx_shader_file, const std::string& frg_shader_file, const std::string& common_header ,const std::string& name);
 
@@ -82,10 +138,11 @@ protected:
 	struct ShaderFile 
 	{
 		std::string vtx_file, frg_file, common_header;
-		FileWatchInfo vtx_info,frg_info, common_header_info;
+		bool loaded=false;	////false until the first Get compiles the files
 	};
 
 	Hashtable<std::string, ShaderFile> shader_file_hashtable;
+	Hashtable<std::string,std::pair<std::string,std::string> > shader_source_hashtable;	////built-in sources not requested yet
 
 	OpenGLShaderLibrary();
 	void Initialize_Shaders();
@@ -94,6 +151,8 @@ protected:
 
 public:
 	bool Load_Shader_From_File(const ShaderFile& file, std::shared_ptr<OpenGLShaderProgram> shader);
+	bool Read_Shader_From_File(const ShaderFile& file,std::string& vtx,std::string& frg) const;	////read, with the header added, and parsed
+	void Watch_Shader_Files(const std::string& name);
 	void Add_Shader(const std::string& vtx_shader, const std::string& frg_shader, const std::string& name);
 };
 
@@ -0,0 +1,84 @@
+//#####################################################################
+// OpenGL State Cache
+// Shadow copy of the bound GL state that skips redundant state calls
+//#####################################################################
+#ifndef __OpenGLStateCache_h__
+#define __OpenGLStateCache_h__
+#include <glad.h>
+#include "Common.h"
+
+////Calls issued and skipped in the current frame
+struct OpenGLStateStats
+{
+	int program_changes=0,program_skips=0;
+	int vao_changes=0,vao_skips=0;
+	int texture_changes=0,texture_skips=0;
+	int polygon_mode_changes=0,polygon_mode_skips=0;
+	int blend_changes=0,blend_skips=0;
+	int draw_calls=0;			////draws submitted through the queue
+	int draw_calls_saved=0;		////draws folded into instanced and multi-draw calls
+	int multi_draws=0;			////multi-draw batches of pooled meshes
+
+	int Changes() const {return program_changes+vao_changes+texture_changes+polygon_mode_changes+blend_changes;}
+	int Skips() const {return program_skips+vao_skips+texture_skips+polygon_mode_skips+blend_skips;}
+};
+
+////The cached values are only valid while all binds go through the cache. Code that calls GL directly leaves them stale,
+////so the window invalidates the cache at the start of a frame and after every object it draws without the render queue.
+class OpenGLStateCache
+{
+public:
+	static const int texture_unit_num=32;
+	OpenGLStateStats stats;
+
+	static OpenGLStateCache* Instance(){static OpenGLStateCache instance;return &instance;}
+
+	////Forget the cached values; the next call of each kind is issued
+	void Invalidate()
+	{
+		program=unknown;vao=unknown;active_unit=-1;polygon_mode=0;blend=-1;
+		for(int i=0;i<texture_unit_num;i++){textures[i]=unknown;texture_targets[i]=0;}
+	}
+
+	void Begin_Frame(){Invalidate();stats=OpenGLStateStats();}
+
+	void Use_Program(const GLuint prg)
+	{if(prg==program){stats.program_skips++;return;}glUseProgram(prg);program=prg;stats.program_changes++;}
+
+	void Bind_Vertex_Array(const GLuint _vao)
+	{if(_vao==vao){stats.vao_skips++;return;}glBindVertexArray(_vao);vao=_vao;stats.vao_changes++;}
+
+	void Bind_Texture(const int unit,const GLenum target,const GLuint tex)
+	{
+		if(unit<0||unit>=texture_unit_num){glActiveTexture(GL_TEXTURE0+unit);glBindTexture(target,tex);active_unit=-1;return;}
+		if(textures[unit]==tex&&texture_targets[unit]==target){stats.texture_skips++;return;}
+		if(active_unit!=unit){glActiveTexture(GL_TEXTURE0+unit);active_unit=unit;}
+		glBindTexture(target,tex);textures[unit]=tex;texture_targets[unit]=target;stats.texture_changes++;
+	}
+
+	void Polygon_Mode(const GLenum mode)
+	{if(mode==polygon_mode){stats.polygon_mode_skips++;return;}glPolygonMode(GL_FRONT_AND_BACK,mode);polygon_mode=mode;stats.polygon_mode_changes++;}
+
+	////Blending on uses the src-alpha/one-minus-src-alpha add of OpenGLObject::Enable_Alpha_Blend
+	void Blend(const bool enable)
+	{
+		if((int)enable==blend){stats.blend_skips++;return;}
+		if(enable){glEnable(GL_BLEND);glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);glBlendEquation(GL_FUNC_ADD);}
+		else glDisable(GL_BLEND);
+		blend=(int)enable;stats.blend_changes++;
+	}
+
+protected:
+	static const GLuint unknown=~0u;
+	GLuint program=unknown;
+	GLuint vao=unknown;
+	GLuint textures[texture_unit_num];
+	GLenum texture_targets[texture_unit_num];
+	int active_unit=-1;
+	GLenum polygon_mode=0;
+	int blend=-1;				////-1: unknown
+
+	OpenGLStateCache(){Invalidate();}
+};
+
+#endif
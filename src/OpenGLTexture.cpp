@@ -3,22 +3,62 @@
 // Copyright (c) (2018-), Bo Zhu
 //#####################################################################
 #include <iostream>
+#include <thread>
+#include <chrono>
+#include <cstring>
 #include "OpenGLWindow.h"
 #include "OpenGLTexture.h"
+#include "File.h"
+#include "OpenGLStateCache.h"
+#include "OpenGLAssetWatcher.h"
+#include "TextureCache.h"
 #include <StbImage.h>
 
 void OpenGLTexture::Bind(int textureSlot) {
-	glActiveTexture(GL_TEXTURE0 + textureSlot); // activate the texture unit first before binding texture
-	// glBindTexture(GL_TEXTURE_2D, texture); 
-	glBindTexture(target, texture);
+	// activates the texture unit first and skips the bind if the texture is already there
+	OpenGLStateCache::Instance()->Bind_Texture(textureSlot, target, texture);
 }
 
 OpenGLTexture::~OpenGLTexture() {
 	glDeleteTextures(0, &texture);
 }
 
+////Decoded pixels of one file, freed with the stb allocator
+struct DecodedImage
+{
+	int width=0, height=0, channels=0;
+	unsigned char* data=nullptr;
+	~DecodedImage() { free(data); }
+	size_type Size() const { return (size_type)width*height*channels; }
+};
+
+static std::shared_ptr<DecodedImage> Decode_Image(const std::string& filename)
+{
+	std::shared_ptr<DecodedImage> image=std::make_shared<DecodedImage>();
+	Stb::Read_Image(filename, image->width, image->height, image->channels, image->data);
+	if (image->data==nullptr) { std::cerr << "[Texture_Library]: Failed to load texture " << filename << std::endl; return nullptr; }
+	return image;
+}
+
+////One texture or cube map in flight: the workers decode the faces, the render thread maps an unpack buffer, a worker copies the
+////pixels into it, and the render thread unmaps it and specifies the levels from it
+struct OpenGLTextureLibrary::TextureLoad
+{
+	std::shared_ptr<OpenGLTexture> texture;
+	std::vector<std::string> filenames;
+	std::vector<std::shared_ptr<DecodedImage> > images;
+	std::shared_ptr<TextureCache::Texture> compressed;	////set instead of images for a block-compressed 2D texture
+	std::uint64_t generation=0;		////the texture's load_generation when this load was requested
+	std::vector<size_type> offsets;		////of each face or level in the buffer
+	std::atomic<int> remaining{0};		////faces still decoding
+	GLuint pbo=0;
+	size_type size=0;
+	unsigned char* mapped=nullptr;
+};
+
 OpenGLTextureLibrary* OpenGLTextureLibrary::Instance() { static OpenGLTextureLibrary instance; return &instance; }
 std::shared_ptr<OpenGLTexture> OpenGLTextureLibrary::Get(const std::string& name) {
+	std::lock_guard<std::mutex> lock(mtx);
 	auto search=texture_hashtable.find(name);
 	if (search != texture_hashtable.end())return search->second;
 	else return std::shared_ptr<OpenGLTexture>(nullptr);
@@ -28,8 +68,23 @@ std::shared_ptr<OpenGLTexture> OpenGLTextureLibrary::Get_Texture(const std::stri
 	return OpenGLTextureLibrary::Instance()->Get(name);
 }
 
+bool OpenGLTextureLibrary::Is_Resident(const std::string& name) {
+	std::shared_ptr<OpenGLTexture> texture=Get(name);
+	return texture!=nullptr && texture->Resident();
+}
+
+size_type OpenGLTextureLibrary::Pending_Num() { std::lock_guard<std::mutex> lock(mtx); return pending_num; }
+OpenGLTextureLoadStats OpenGLTextureLibrary::Stats() { std::lock_guard<std::mutex> lock(mtx); return stats; }
 
 void OpenGLTextureLibrary::Add_Texture_From_File(std::string filename, std::string name) {
+	std::string file_key=filename+"#"+std::to_string(File::File_Size(filename))+"#"+std::to_string(File::File_Modified_Time(filename));
+	{std::lock_guard<std::mutex> lock(mtx);
+	auto search=file_hashtable.find(file_key);
+	if (search != file_hashtable.end()) {
+		std::shared_ptr<OpenGLTexture> loaded=search->second.lock();
+		if (loaded) { texture_hashtable[name]=loaded; return; }
+	}}
+
 	unsigned int texture;
 	glGenTextures(1, &texture);
 	glBindTexture(GL_TEXTURE_2D, texture);
@@ -38,28 +93,23 @@ void OpenGLTextureLibrary::Add_Texture_From_File(std::string filename, std::stri
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT); // GL_CLAMP_TO_EDGE
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// load and generate the texture
-	int width, height, nrChannels;
-	unsigned char *data=nullptr;
-	Stb::Read_Image(filename, width, height, nrChannels, data);
-
-	if (data)
-	{
-		if (nrChannels == 4) 
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		else 
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-			
-		glGenerateMipmap(GL_TEXTURE_2D);
-	}
-	else
-	{
-		std::cerr << "[Texture_Library]: Failed to load texture " << filename << std::endl;
-	}
+	// the placeholder is shown until the decoded image is uploaded by Update_Loads
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
-	free(data);
+	std::shared_ptr<OpenGLTexture> tex(new OpenGLTexture(texture));
+	tex->resident=false;
+	{std::lock_guard<std::mutex> lock(mtx);
+	texture_hashtable[name]=tex;
+	file_hashtable[file_key]=tex;}
+	Load(tex, {filename});
 
-	texture_hashtable[name]=std::shared_ptr<OpenGLTexture>(new OpenGLTexture(texture));
+	// a changed file is loaded again into the same texture object, so the objects holding it see the new image
+	std::weak_ptr<OpenGLTexture> weak=tex;
+	OpenGLAssetWatcher::Instance()->Watch(filename, "texture:"+filename, [filename, weak]()->OpenGLAssetWatcher::Step {
+		return [filename, weak]() {
+			std::shared_ptr<OpenGLTexture> tex=weak.lock();
+			if (tex) OpenGLTextureLibrary::Instance()->Load(tex, {filename}); }; });
 }
 
 void OpenGLTextureLibrary::Add_CubeMap_From_Files(const std::vector<std::string>& filenames, std::string name) {
@@ -72,22 +122,155 @@ void OpenGLTextureLibrary::Add_CubeMap_From_Files(const std::vector<std::string>
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	// load and generate the texture
-	int width, height, nrChannels;
-	unsigned char *data=nullptr;
-	for (int i=0; i<filenames.size(); i++)
-	{
-		Stb::Read_Image(filenames[i], width, height, nrChannels, data);
-		if (data)
-		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+	for (int i=0; i<(int)filenames.size(); i++)
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	std::shared_ptr<OpenGLTexture> tex(new OpenGLTexture(texture, GL_TEXTURE_CUBE_MAP));
+	tex->resident=false;
+	{std::lock_guard<std::mutex> lock(mtx);
+	texture_hashtable[name]=tex;}
+	Load(tex, filenames);
+
+	// a change of any face loads all six again
+	std::weak_ptr<OpenGLTexture> weak=tex;
+	OpenGLAssetWatcher::Prepare prepare=[filenames, weak]()->OpenGLAssetWatcher::Step {
+		return [filenames, weak]() {
+			std::shared_ptr<OpenGLTexture> tex=weak.lock();
+			if (tex) OpenGLTextureLibrary::Instance()->Load(tex, filenames); }; };
+	for (const auto& f : filenames) OpenGLAssetWatcher::Instance()->Watch(f, "cubemap:"+name, prepare);
+}
+
+void OpenGLTextureLibrary::Load(std::shared_ptr<OpenGLTexture> texture, const std::vector<std::string>& filenames)
+{
+	if (filenames.empty()) return;
+	if (pool==nullptr) pool.reset(new Parallel::ThreadPool(std::max(1, std::min(decode_thread_num, Parallel::Thread_Num()))));
+	std::shared_ptr<TextureLoad> load=std::make_shared<TextureLoad>();
+	load->texture=texture; load->filenames=filenames;
+	// two quick changes of a file start two loads that may finish in either order; only the latest request is uploaded
+	{std::lock_guard<std::mutex> lock(mtx); pending_num++; stats.queued++; load->generation=++texture->load_generation;}
+
+	// BC1/BC3 need the s3tc extension, BC5 (RGTC2) is core since GL 3.0; without support this texture alone loads uncompressed
+	bool compress=use_texture_cache && texture->Target()==GL_TEXTURE_2D;
+	if (compress) compress=TextureCache::Is_Normal_Map(filenames[0]) ? GLVersion.major>=3 : GLAD_GL_EXT_texture_compression_s3tc!=0;
+	if (compress) {
+		pool->Enqueue([this, load]() {
+			{std::lock_guard<std::mutex> lock(mtx); if (Superseded(*load)) { decoded.push_back(load); return; }}
+			load->compressed=TextureCache::Load_Or_Build(load->filenames[0], load->filenames[0],
+				[](const std::string& file_name, int& width, int& height)->std::uint8_t* {
+					int channels; return Stb::Read_Image_8(file_name.c_str(), &width, &height, &channels, 4); });
+			// no compressed chain: the image is decoded as without the cache and uploaded uncompressed, or reported as failed
+			if (load->compressed==nullptr) { load->images.resize(1); load->images[0]=Decode_Image(load->filenames[0]); }
+			std::lock_guard<std::mutex> lock(mtx); decoded.push_back(load); });
+		return;
+	}
+
+	load->images.resize(filenames.size()); load->remaining=(int)filenames.size();
+	for (size_type i=0; i<filenames.size(); i++) {
+		pool->Enqueue([this, load, i]() {
+			bool superseded; {std::lock_guard<std::mutex> lock(mtx); superseded=Superseded(*load);}
+			if (!superseded) load->images[i]=Decode_Image(load->filenames[i]);
+			if (--load->remaining==0) { std::lock_guard<std::mutex> lock(mtx); decoded.push_back(load); } });
+	}
+}
+
+bool OpenGLTextureLibrary::Superseded(const TextureLoad& load) const { return load.generation != load.texture->load_generation; }
+
+GLuint OpenGLTextureLibrary::Acquire_Pbo()
+{
+	if (!free_pbos.empty()) { GLuint pbo=free_pbos.back(); free_pbos.pop_back(); return pbo; }
+	GLuint pbo; glGenBuffers(1, &pbo); return pbo;
+}
+
+int OpenGLTextureLibrary::Update_Loads()
+{
+	Array<std::shared_ptr<TextureLoad> > to_upload, to_map;
+	{std::lock_guard<std::mutex> lock(mtx);
+	if (decoded.empty() && filled.empty()) return 0;
+	to_upload.swap(filled); to_map.swap(decoded);}
+
+	// the buffers filled by the workers are unmapped and the levels specified from them; the copy into the texture runs on the GPU
+	int n=0;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (auto& load : to_upload) {
+		const GLenum target=load->texture->Target();
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, load->pbo);
+		if (load->mapped != nullptr) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		bool superseded; {std::lock_guard<std::mutex> lock(mtx); superseded=Superseded(*load); if (superseded) { pending_num--; stats.superseded++; }}
+		if (superseded) { glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); free_pbos.push_back(load->pbo); continue; }
+		if (load->mapped == nullptr) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);	// the buffer could not be mapped: specify from client memory
+		glBindTexture(target, load->texture->Id());
+		if (load->compressed != nullptr) {
+			const TextureCache::Texture& tex=*load->compressed;
+			GLenum internal=tex.format==TextureCache::Format::BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT :
+				tex.format==TextureCache::Format::BC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RG_RGTC2;
+			for (size_type i=0; i<tex.levels.size(); i++) {
+				const void* pixels=(load->mapped != nullptr) ? (const void*)(load->offsets[i]) : (const void*)tex.data[i];
+				glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, internal, tex.levels[i].width, tex.levels[i].height, 0, (GLsizei)tex.levels[i].size, pixels);
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)tex.levels.size()-1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		}
+		for (size_type i=0; i<load->images.size(); i++) {
+			const DecodedImage& image=*load->images[i];
+			const bool cube=(target==GL_TEXTURE_CUBE_MAP);
+			const GLenum face=cube ? GL_TEXTURE_CUBE_MAP_POSITIVE_X+(GLenum)i : GL_TEXTURE_2D;
+			const GLenum format=(image.channels==4 && !cube) ? GL_RGBA : GL_RGB;
+			const void* pixels=(load->mapped != nullptr) ? (const void*)(load->offsets[i]) : (const void*)image.data;
+			glTexImage2D(face, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, pixels);
 		}
-		else
-		{
-			std::cerr << "[Texture_Library]: Failed to load texture " << filenames[i] << std::endl;
+		if (target==GL_TEXTURE_2D && load->compressed==nullptr) {	// the level range of a compressed chain loaded before is reset
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000); glGenerateMipmap(GL_TEXTURE_2D); }
+		glBindTexture(target, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		free_pbos.push_back(load->pbo);
+		load->texture->resident=true; n++;
+		std::lock_guard<std::mutex> lock(mtx);
+		pending_num--; stats.resident++; if (load->mapped != nullptr) stats.upload_bytes+=load->size;
+		if (load->compressed != nullptr) {
+			stats.compressed_bytes+=load->compressed->Size();
+			if (load->compressed->file != nullptr) stats.cache_hits++;
+			for (const auto& l : load->compressed->levels) stats.uncompressed_bytes+=(size_type)l.width*l.height*4;
 		}
-		free(data);
 	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-	texture_hashtable[name]=std::shared_ptr<OpenGLTexture>(new OpenGLTexture(texture, GL_TEXTURE_CUBE_MAP));
-}
\ No newline at end of file
+	// decoded loads get a mapped buffer, and a worker copies the faces into it
+	for (auto& load : to_map) {
+		{std::lock_guard<std::mutex> lock(mtx); if (Superseded(*load)) { pending_num--; stats.superseded++; continue; }}
+		bool decoded_all=true;
+		load->size=0; load->offsets.clear();
+		for (const auto& image : load->images) {
+			if (image==nullptr) { decoded_all=false; break; }
+			load->offsets.push_back(load->size); load->size+=image->Size(); }
+		if (load->images.empty()) {
+			if (load->compressed==nullptr) decoded_all=false;
+			else for (const auto& l : load->compressed->levels) { load->offsets.push_back(load->size); load->size+=(size_type)l.size; }
+		}
+		if (!decoded_all) { std::lock_guard<std::mutex> lock(mtx); pending_num--; stats.failed++; continue; }
+
+		load->pbo=Acquire_Pbo();
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, load->pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)load->size, nullptr, GL_STREAM_DRAW);
+		load->mapped=(unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)load->size, GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		pool->Enqueue([this, load]() {
+			// for a cached texture this also reads the mapped pages of the file
+			if (load->mapped != nullptr) {
+				for (size_type i=0; i<load->images.size(); i++)
+					std::memcpy(load->mapped+load->offsets[i], load->images[i]->data, load->images[i]->Size());
+				if (load->compressed != nullptr)
+					for (size_type i=0; i<load->compressed->levels.size(); i++)
+						std::memcpy(load->mapped+load->offsets[i], load->compressed->data[i], (size_t)load->compressed->levels[i].size);
+			}
+			std::lock_guard<std::mutex> lock(mtx); filled.push_back(load); });
+	}
+	return n;
+}
+
+void OpenGLTextureLibrary::Finish_Loads()
+{
+	while (Pending_Num() > 0) {
+		if (Update_Loads()==0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
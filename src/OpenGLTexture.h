@@ -5,12 +5,16 @@
 #ifndef __OpenGLTexture_h__
 #define __OpenGLTexture_h__
 #include <string>
+#include <cstdint>
 #include <memory>
+#include <atomic>
+#include <mutex>
 #include <glad.h>
 #include "glm.hpp"
 #include "gtc/matrix_transform.hpp"
 #include "gtc/type_ptr.hpp"
 #include "Common.h"
+#include "Parallel.h"
 #include "OpenGLShaderProgram.h"
 
 class OpenGLTexture {
@@ -20,21 +24,68 @@ public:
 	~OpenGLTexture();
 
 	void Bind(int textureSlot);
+	GLuint Id() const { return texture; }
+	GLenum Target() const { return target; }
+	////False while the image is still loading and the texture holds the placeholder texel
+	bool Resident() const { return resident; }
 private:
+	friend class OpenGLTextureLibrary;
 	GLuint texture;
 	GLenum target;
+	std::atomic<bool> resident{true};
+	std::uint64_t load_generation=0;	////of the latest Load request, guarded by the library mutex; older loads are dropped
 };
 
+struct OpenGLTextureLoadStats
+{
+	size_type queued=0;			////textures and cube maps requested
+	size_type resident=0;		////uploads finished
+	size_type failed=0;			////files that could not be decoded; their textures keep the placeholder
+	size_type superseded=0;		////loads dropped because a newer load of the same texture was requested, e.g., by the file watcher
+	size_type upload_bytes=0;	////bytes streamed through pixel-unpack buffers
+	size_type cache_hits=0;		////textures read from their block-compressed cache instead of decoded
+	size_type compressed_bytes=0;	////GPU bytes of the block-compressed textures, all levels
+	size_type uncompressed_bytes=0;	////what the same levels would take as RGBA8
+};
 
+////Add_* return at once: the texture object is created with a one-texel placeholder, the files are decoded on a worker pool, and
+////Update_Loads, called by the window at the start of each frame, streams the pixels through pixel-unpack buffers into the same
+////texture object, so handles taken from Get before the load finished show the image once it is resident.
+////Add_*, Update_Loads and Finish_Loads need the context; Get, Is_Resident and Pending_Num may be called from any thread.
 class OpenGLTextureLibrary
 {
 public:
+	unsigned char placeholder[4]={255,255,255,255};	////RGBA of the texel shown until residency
+	int decode_thread_num=4;
+	bool use_texture_cache=true;	////2D textures are block-compressed with CPU mips and cached next to their files (TextureCache.h)
+
 	static OpenGLTextureLibrary* Instance();
 	static std::shared_ptr<OpenGLTexture> Get_Texture(const std::string& name);
 	std::shared_ptr<OpenGLTexture> Get(const std::string& name);
 	void Add_Texture_From_File(std::string filename, std::string name);
 	void Add_CubeMap_From_Files(const std::vector<std::string>& filenames, std::string name);
+
+	bool Is_Resident(const std::string& name);
+	size_type Pending_Num();
+	OpenGLTextureLoadStats Stats();
+	int Update_Loads();		////uploads the images the workers finished; returns the textures that became resident
+	void Finish_Loads();	////blocks until every queued texture is resident, e.g., before capturing the first frame
+
 protected:
+	struct TextureLoad;
 	Hashtable<std::string, std::shared_ptr<OpenGLTexture> > texture_hashtable;
+	////Textures by file name, size and modification time, so a file added under several names is decoded and uploaded once
+	Hashtable<std::string, std::weak_ptr<OpenGLTexture> > file_hashtable;
+	std::mutex mtx;			////guards the tables, the load queues and the stats
+	std::unique_ptr<Parallel::ThreadPool> pool;
+	Array<std::shared_ptr<TextureLoad> > decoded;		////all faces decoded, waiting for a mapped buffer
+	Array<std::shared_ptr<TextureLoad> > filled;		////pixels copied into the mapped buffer, waiting for the upload
+	size_type pending_num=0;
+	Array<GLuint> free_pbos;		////unpack buffers of finished uploads, reused by later loads
+	OpenGLTextureLoadStats stats;
+
+	void Load(std::shared_ptr<OpenGLTexture> texture, const std::vector<std::string>& filenames);
+	bool Superseded(const TextureLoad& load) const;	////called with mtx held
+	GLuint Acquire_Pbo();
 };
 #endif
@@ -0,0 +1,94 @@
+//#####################################################################
+// OpenGL Vertex Layout
+// Interleaved vertex layout descriptor and attribute-stream packers
+//#####################################################################
+#ifndef __OpenGLVertexLayout_h__
+#define __OpenGLVertexLayout_h__
+#include <cstring>
+#include <glad.h>
+#include "Common.h"
+
+////One interleaved attribute; size and offset are counted in floats
+struct OpenGLVertexAttribute
+{
+	GLuint location=0;
+	GLint size=4;
+	GLuint offset=0;
+};
+
+////Describes how the attribute streams of a mesh are interleaved in one VBO.
+////The stride is accumulated once while attributes are added, so the packer can size the destination exactly.
+class OpenGLVertexLayout
+{
+public:
+	Array<OpenGLVertexAttribute> attributes;
+	GLuint stride=0;	////floats per vertex
+
+	void Clear(){attributes.clear();stride=0;}
+
+	////Attributes are assigned consecutive locations in the order they are added
+	int Add_Attribute(const GLint size=4)
+	{
+		OpenGLVertexAttribute attr;attr.location=(GLuint)attributes.size();attr.size=size;attr.offset=stride;
+		attributes.push_back(attr);stride+=(GLuint)size;
+		return (int)attributes.size()-1;
+	}
+
+	int Size() const {return (int)attributes.size();}
+	const OpenGLVertexAttribute& operator[](const int i) const {return attributes[i];}
+	size_type Float_Num(const size_type vtx_num) const {return vtx_num*(size_type)stride;}
+	size_type Byte_Size(const size_type vtx_num) const {return Float_Num(vtx_num)*sizeof(GLfloat);}
+
+	bool operator==(const OpenGLVertexLayout& layout) const
+	{
+		if(stride!=layout.stride||attributes.size()!=layout.attributes.size())return false;
+		for(size_type i=0;i<attributes.size();i++){const auto& a=attributes[i];const auto& b=layout.attributes[i];
+			if(a.location!=b.location||a.size!=b.size||a.offset!=b.offset)return false;}
+		return true;
+	}
+	bool operator!=(const OpenGLVertexLayout& layout) const {return !(*this==layout);}
+};
+
+////Packers write one attribute stream into its slot of an interleaved destination buffer.
+////The destination is either a reused staging array or a mapped GL buffer; no intermediate arrays are created.
+
+////Data pointer of an attribute array starting at vertex begin, or null if it does not cover the n vertices [begin,begin+n)
+template<class T,class A> const T* Vertex_Stream(const std::vector<T,A>& array,const size_type n,const size_type begin=0)
+{return (n>0&&array.size()>=begin+n)?array.data()+begin:nullptr;}
+
+////Stream of Eigen vectors, converted to float and padded to the slot size with the placeholder; a null stream fills the slot with the placeholder
+template<class T_VEC> void Pack_Vertex_Attribute(const T_VEC* src,const size_type n,const OpenGLVertexAttribute& attr,const GLuint stride,GLfloat* dst,const GLfloat placeholder=(GLfloat)0)
+{
+	const int src_n=src==nullptr?0:((int)T_VEC::RowsAtCompileTime<attr.size?(int)T_VEC::RowsAtCompileTime:attr.size);
+	GLfloat* p=dst+attr.offset;
+	for(size_type i=0;i<n;i++,p+=stride){
+		int c=0;
+		for(;c<src_n;c++)p[c]=(GLfloat)src[i][c];
+		for(;c<attr.size;c++)p[c]=placeholder;}
+}
+
+////The same value for every vertex, e.g., a uniform object color
+inline void Pack_Vertex_Attribute_Constant(const GLfloat* value,const size_type n,const OpenGLVertexAttribute& attr,const GLuint stride,GLfloat* dst)
+{
+	GLfloat* p=dst+attr.offset;
+	for(size_type i=0;i<n;i++,p+=stride)std::memcpy(p,value,attr.size*sizeof(GLfloat));
+}
+
+////Integer stream stored bit-for-bit in float slots, e.g., skinning joint indices
+inline void Pack_Vertex_Attribute_Bits(const Vector4i* src,const size_type n,const OpenGLVertexAttribute& attr,const GLuint stride,GLfloat* dst)
+{
+	GLfloat* p=dst+attr.offset;
+	if(src==nullptr){for(size_type i=0;i<n;i++,p+=stride)std::memset(p,0,attr.size*sizeof(GLfloat));return;}
+	for(size_type i=0;i<n;i++,p+=stride)std::memcpy(p,&src[i][0],attr.size*sizeof(GLfloat));
+}
+
+////Element indices, written into an exactly sized index array
+template<class T_ELE> void Pack_Elements(const Array<T_ELE>& elements,Array<GLuint>& opengl_elements)
+{
+	const int e_d=(int)T_ELE::RowsAtCompileTime;
+	opengl_elements.resize(elements.size()*e_d);
+	GLuint* p=opengl_elements.data();
+	for(const auto& e:elements){for(int j=0;j<e_d;j++)p[j]=(GLuint)e[j];p+=e_d;}
+}
+
+#endif
@@ -17,7 +17,7 @@ void OpenGLViewer::Initialize()
 	if(opengl_window==nullptr)
 		opengl_window=std::make_shared<OpenGLWindow>();
     opengl_window->Init();
-	opengl_window->opengl_viewer.reset(this);
+	opengl_window->opengl_viewer=std::shared_ptr<OpenGLViewer>(this,[](OpenGLViewer*){});	////not owned; a headless run returns to the caller
 	Initialize_Common_Callback_Keys();
 	Initialize_Common_Data();
 	Initialize_Data();
@@ -56,17 +56,40 @@ void OpenGLViewer::Initialize_Common_Data()
 
 void OpenGLViewer::Update_Frame()
 {
+	////during playback a frame that is not read yet is dropped instead of stalling the render thread
 	for(auto& obj:opengl_window->object_list){
-		if(!obj->interactive)obj->Refresh(frame);
+		if(!obj->interactive){
+			if(obj->prefetcher!=nullptr)obj->prefetcher->realtime=play;
+			obj->Refresh(frame);
+			if(obj->prefetcher!=nullptr)obj->prefetcher->Schedule(frame+frame_step,frame_step,first_frame,last_frame);}
 		obj->Update_Data_To_Render();}
 
 	opengl_window->texts["frame"]="Frame: "+std::to_string(frame);
+	if(prefetch_budget!=nullptr)opengl_window->texts["frame"]+=", dropped: "+std::to_string(Prefetch_Stats().dropped);
 
 	if(opengl_window->display_offscreen){
 		opengl_window->frame_offscreen=frame;
 		opengl_window->frame_offscreen_rendered=-1;}
 }
 
+FramePrefetchStats OpenGLViewer::Prefetch_Stats() const
+{
+	FramePrefetchStats sum;
+	for(auto& obj:opengl_window->object_list){if(obj->prefetcher==nullptr)continue;
+		const FramePrefetchStats s=obj->prefetcher->Stats();
+		sum.loaded+=s.loaded;sum.hits+=s.hits;sum.waits+=s.waits;
+		sum.dropped+=s.dropped;sum.evicted+=s.evicted;sum.budget_stalls+=s.budget_stalls;}
+	return sum;
+}
+
+void OpenGLViewer::Print_Prefetch_Stats() const
+{
+	FramePrefetchStats s=Prefetch_Stats();
+	std::cout<<"Prefetch: loaded "<<s.loaded<<", hits "<<s.hits<<", waits "<<s.waits<<", dropped "<<s.dropped
+		<<", evicted "<<s.evicted<<", budget stalls "<<s.budget_stalls
+		<<", memory "<<(prefetch_budget!=nullptr?prefetch_budget->used.load():0)/(1<<20)<<" MB"<<std::endl;
+}
+
 //////////////////////////////////////////////////////////////////////////
 ////UI
 
@@ -76,6 +99,7 @@ void OpenGLViewer::Initialize_UI()
 
 void OpenGLViewer::Finish()
 {
+	opengl_window->Finish_Offscreen(true);
 }
 
 void OpenGLViewer::Toggle_Command(const std::string cmd)
@@ -91,6 +115,27 @@ void OpenGLViewer::Set_Offscreen_Output_Dir(const std::string offscreen_output)
 	opengl_window->offscreen_output_dir=offscreen_output;
 }
 
+void OpenGLViewer::Set_Headless(const int width,const int height,const int frame_num)
+{
+	if(opengl_window==nullptr)opengl_window=std::make_shared<OpenGLWindow>();
+	opengl_window->headless=true;
+	opengl_window->win_w=width;opengl_window->win_h=height;
+	opengl_window->headless_frame_num=frame_num;
+	opengl_window->display_offscreen=true;	////each frame of the viewer once, named by its number
+}
+
+void OpenGLViewer::Render_Frame(const int n)
+{
+	opengl_window->Render_Frame(n);
+}
+
+void OpenGLViewer::Set_Offscreen_Output_Format(const std::string format,const std::string pipe_command)
+{
+	opengl_window->Finish_Offscreen(true);
+	opengl_window->offscreen_output_format=format;
+	opengl_window->offscreen_output_pipe=pipe_command;
+}
+
 //////////////////////////////////////////////////////////////////////////
 ////Basic callbacks
 
@@ -131,21 +176,21 @@ void OpenGLViewer::Toggle_Draw_Dis()
 
 void OpenGLViewer::Toggle_Next_Frame()
 {
-	frame++;
+	frame++;frame_step=1;
 	if(last_frame!=-1&&frame>=last_frame)return;
 	Update_Frame();
 }
 
 void OpenGLViewer::Toggle_Prev_Frame()
 {
-	frame--;
+	frame--;frame_step=-1;
 	if(frame<0)frame=0;
 	else Update_Frame();
 }
 
 void OpenGLViewer::Toggle_First_Frame()
 {
-	frame=first_frame;
+	frame=first_frame;frame_step=1;
 	Update_Frame();
 }
 
@@ -153,6 +198,7 @@ void OpenGLViewer::Toggle_Play()
 {
 	play=!play;
 	opengl_window->Set_Timer_Callback(play?&Toggle_Next_Frame_Func:nullptr);
+	if(!play&&verbose&&prefetch_budget!=nullptr)Print_Prefetch_Stats();
 }
 
 void OpenGLViewer::Initialize_Common_Callback_Keys()
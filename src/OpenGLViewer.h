@@ -25,6 +25,10 @@ public:
 	std::string config_file_name;
 	std::shared_ptr<OpenGLWindow> opengl_window=nullptr;
 	int first_frame=0,last_frame=-1,frame=0;
+	int frame_step=1;					////direction of the last frame change, the direction frames are read ahead in
+	int prefetch_frames=0;				////frames read ahead on worker threads for objects added from files; 0 reads synchronously
+	size_type prefetch_memory_budget=(size_type)1<<30;	////bytes of read-ahead frames shared by all objects
+	std::shared_ptr<FrameMemoryBudget> prefetch_budget=nullptr;
 	bool draw_bk=false;
 	bool draw_axes=true;
 	bool use_ui=true;
@@ -48,6 +52,9 @@ public:
 	//////////////////////////////////////////////////////////////////////////
 	////Animation
 	void Update_Frame();
+	////Read-ahead statistics summed over all objects
+	FramePrefetchStats Prefetch_Stats() const;
+	void Print_Prefetch_Stats() const;
 
 	//////////////////////////////////////////////////////////////////////////
 	////UI
@@ -98,7 +105,12 @@ public:
 			opengl_object->output_dir=output_dir;
 			opengl_object->name=object_name;
 			opengl_object->data=data;
-			opengl_object->Refresh(frame);return true;}
+			opengl_object->Refresh(frame);
+			if(prefetch_frames>0){
+				if(prefetch_budget==nullptr)prefetch_budget=std::make_shared<FrameMemoryBudget>(prefetch_memory_budget);
+				opengl_object->Enable_Prefetch(prefetch_frames,prefetch_budget);
+				if(opengl_object->prefetcher!=nullptr)opengl_object->prefetcher->Schedule(frame+1,1,first_frame,last_frame);}
+			return true;}
 		return false;
 	}
 
@@ -132,6 +144,12 @@ public:
 	{if(obj==nullptr)return;obj->Set_Point_Size(point_size);}
 
 	void Set_Offscreen_Output_Dir(const std::string _offscreen_output);
+	////Before Initialize: renders width x height frames without a window and writes each viewer frame into the offscreen output;
+	////Run renders frame_num frames and returns, or call Render_Frame after Initialize
+	void Set_Headless(const int width,const int height,const int frame_num=1);
+	void Render_Frame(const int n=1);
+	////"png", "qoi", "raw" or "y4m"; raw and y4m frames go into one file in the output directory, or into pipe_command if given
+	void Set_Offscreen_Output_Format(const std::string format,const std::string pipe_command="");
 
 	//////////////////////////////////////////////////////////////////////////
 	////Basic callbacks
@@ -21,7 +21,13 @@
 #endif
 #include "File.h"
 #include "OpenGLObject.h"
+#include "OpenGLRenderQueue.h"
+#include "OpenGLGeometryCache.h"
+#include "OpenGLAssetWatcher.h"
+#include "OpenGLTexture.h"
 #include "OpenGLBufferObjects.h"
+#include "OpenGLFrameCapture.h"
+#include "OpenGLHeadlessContext.h"
 #include "OpenGLViewer.h"
 
 using namespace OpenGLUbos;
@@ -124,15 +130,29 @@ OpenGLWindow::OpenGLWindow()
 
 void OpenGLWindow::Init()
 {
-	Initialize_Window();
+	if(headless)Initialize_Headless();
+	else Initialize_Window();
 	Initialize_OpenGL();
 }
 
 void OpenGLWindow::Run()
 {
+	if(headless){Render_Frame(headless_frame_num);Finish_Offscreen(true);return;}
 	glutMainLoop();
 }
 
+////The idle and timer callbacks followed by a display, once per frame, as the GLUT main loop calls them
+void OpenGLWindow::Render_Frame(const int n)
+{
+	////every headless frame is captured, so the textures decoding on workers are made resident before the first one
+	if(headless)OpenGLTextureLibrary::Instance()->Finish_Loads();
+	for(int i=0;i<n;i++){
+		Idle_Func();
+		Timer_Func();
+		Display();
+		if(!headless)glutSwapBuffers();}
+}
+
 void OpenGLWindow::Initialize_Window()
 {
 	int argc=1;char* argv[1];argv[0]=(char*)(window_title.c_str());
@@ -165,20 +185,48 @@ void OpenGLWindow::Initialize_Window()
 	glutSpecialUpFunc(Keyboard_Special_Up_Func_Glut);
 }
 
+void OpenGLWindow::Initialize_Headless()
+{
+	headless_context=std::make_shared<OpenGLHeadlessContext>();
+	if(!headless_context->Create()){std::cerr<<"Error: [OpenGLWindow] Cannot create a headless context"<<std::endl;exit(1);}
+	resizable=false;
+}
+
+void* OpenGLWindow::Get_Proc_Address(const char* name)
+{
+	if(headless)return OpenGLHeadlessContext::Get_Proc_Address(name);
+	return (void*)glutGetProcAddress(name);
+}
+
 void OpenGLWindow::Initialize_OpenGL()
 {
-	if (!gladLoadGL()) {
+	if (!(headless?gladLoadGLLoader((GLADloadproc)OpenGLHeadlessContext::Get_Proc_Address):gladLoadGL())) {
 		std::cerr << "Error: [OpenGLWindow] Cannot initialize glad" << std::endl; 
 		return;
 	}
 
 	std::cout << "Opengl major version: " << GLVersion.major << ", minor version: " << GLVersion.minor << std::endl;
+#ifndef __APPLE__
+	if(GLVersion.major>4||(GLVersion.major==4&&GLVersion.minor>=3))
+		OpenGLGeometryPool::Instance()->Set_Multi_Draw_Proc(Get_Proc_Address("glMultiDrawElementsIndirect"));
+#endif
 
 	glEnable(GL_DEPTH_TEST);
 	glFrontFace(GL_CCW);
 
 	glEnable(GL_MULTISAMPLE);
-	glHint(GL_MULTISAMPLE_FILTER_HINT_NV, GL_NICEST);
+	if(!headless)glHint(GL_MULTISAMPLE_FILTER_HINT_NV, GL_NICEST);	////the headless target is single-sampled
+
+	if(headless){
+		glGenFramebuffers(1,&headless_fbo);glBindFramebuffer(GL_FRAMEBUFFER,headless_fbo);
+		glGenRenderbuffers(2,headless_rbo);
+		glBindRenderbuffer(GL_RENDERBUFFER,headless_rbo[0]);glRenderbufferStorage(GL_RENDERBUFFER,GL_RGBA8,win_w,win_h);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_RENDERBUFFER,headless_rbo[0]);
+		glBindRenderbuffer(GL_RENDERBUFFER,headless_rbo[1]);glRenderbufferStorage(GL_RENDERBUFFER,GL_DEPTH24_STENCIL8,win_w,win_h);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_STENCIL_ATTACHMENT,GL_RENDERBUFFER,headless_rbo[1]);
+		glBindRenderbuffer(GL_RENDERBUFFER,0);
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE)std::cerr<<"Error: [OpenGLWindow] headless framebuffer not complete"<<std::endl;
+		glViewport(0,0,(GLsizei)win_w,(GLsizei)win_h);}
 
 	Initialize_Camera();
 	Initialize_Ubos();
@@ -187,14 +235,24 @@ void OpenGLWindow::Initialize_OpenGL()
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 void OpenGLWindow::Display()
 {
-	OpenGLShaderLibrary::Instance()->Update_Shaders();
+	OpenGLTextureLibrary::Instance()->Update_Loads();
+	if(OpenGLAssetWatcher::Instance()->Apply()>0){
+		for(auto& obj:object_list)obj->Reload_Assets();
+		OpenGLGeometryCache::Instance()->Delete_Retired_Buffers();}
+	OpenGLStateCache::Instance()->Begin_Frame();
 	Update_Camera();
+	Update_Culling();
+	Update_Uniform_Blocks();
 	Preprocess();
+	OpenGLStateCache::Instance()->Invalidate();
+	glBindFramebuffer(GL_FRAMEBUFFER,Default_Framebuffer());
 	Clear_Buffers();
-	for(auto& obj:object_list){obj->Display();}
+	Display_Objects();
 
 	Display_Text();
 	if(display_offscreen)Display_Offscreen();
+	OpenGLFrameCapture::Instance()->Update();
+	if(use_ubo_ring)OpenGLUbos::OpenGLUboRing::Instance()->End_Frame();
 
 	GLenum gl_error=glGetError();
 	if(gl_error!=GL_NO_ERROR){std::cerr<<"Error: [OpenGLWindow] "<< (const char*)gluErrorString(gl_error)<<std::endl;}
@@ -219,6 +277,63 @@ void OpenGLWindow::Preprocess()
 		o->Preprocess();}
 }
 
+////Flags the objects whose world bounds lie outside the camera frustum; Display skips them
+void OpenGLWindow::Update_Culling()
+{
+	drawn_num=0;culled_num=0;
+	auto camera=Get_Camera_Ubo();
+	glm::mat4 pv=camera->object.projection*camera->object.view;
+	OpenGLFrustum frustum;frustum.Initialize(Eigen::Map<const Matrix4f>(glm::value_ptr(pv)));
+	for(auto& obj:object_list){
+		obj->Update_Bounds();
+		obj->culled=use_frustum_culling&&obj->use_culling&&!obj->world_bounds.Empty()&&!frustum.Intersect(obj->world_bounds);
+		if(obj->culled)culled_num++;else drawn_num++;}
+	if(display_culling_stats)texts["culling"]="Drawn: "+std::to_string(drawn_num)+", culled: "+std::to_string(culled_num);
+}
+
+////Packs the blocks of the frame into the ring and uploads them at once; objects skipped by culling write nothing
+void OpenGLWindow::Update_Uniform_Blocks()
+{
+	if(!use_ubo_ring)return;
+	using namespace OpenGLUbos;
+	OpenGLUboRing* ring=OpenGLUboRing::Instance();
+	ring->Begin_Frame();
+	Write_Frame_Ubos(*ring);
+	for(auto& obj:object_list){if(obj->culled&&!obj->use_preprocess)continue;obj->Write_Uniform_Block(*ring);}
+	ring->Flush();
+	Bind_Frame_Ubos(*ring);
+}
+
+////Opaque objects without a draw item are drawn first, in list order, then the sorted queue, then the blended objects without a draw
+////item in list order, so they blend over everything opaque. Direct GL calls in Display leave the state cache stale, so it is invalidated
+////after each of those objects.
+void OpenGLWindow::Display_Objects()
+{
+	OpenGLStateCache* state=OpenGLStateCache::Instance();
+	if(render_queue==nullptr)render_queue=std::make_shared<OpenGLRenderQueue>();
+	render_queue->Clear();
+	auto camera=Get_Camera_Ubo();
+	render_queue->Set_View(Eigen::Map<const Matrix4f>(glm::value_ptr(camera->object.view)));
+
+	Array<OpenGLObject*> blended;
+	for(auto& obj:object_list){
+		if(obj->culled)continue;
+		OpenGLDrawItem item;
+		if(use_render_queue&&obj->Draw_Item(item))render_queue->Add(obj.get(),item);
+		else if(obj->Use_Alpha_Blend())blended.push_back(obj.get());
+		else{obj->Display();state->Invalidate();}}
+	render_queue->Sort();
+	render_queue->Submit(*state);
+	////the queue ends with its last program and, after transparent items, blending still on
+	state->Blend(false);state->Use_Program(0);state->Bind_Vertex_Array(0);
+
+	for(auto obj:blended){obj->Display();state->Invalidate();}
+
+	if(display_render_stats){const OpenGLStateStats& s=state->stats;
+		texts["render"]="Queued draws: "+std::to_string(s.draw_calls)+", saved by instancing: "+std::to_string(s.draw_calls_saved)
+			+", multi-draws: "+std::to_string(s.multi_draws)+", state changes: "+std::to_string(s.Changes())+", skipped: "+std::to_string(s.Skips());}
+}
+
 void OpenGLWindow::Update_Data_To_Render()
 {
 	for(auto& obj:object_list){obj->Update_Data_To_Render();}
@@ -226,36 +341,41 @@ void OpenGLWindow::Update_Data_To_Render()
 
 void OpenGLWindow::Redisplay()
 {
-	glutPostRedisplay();
+	if(!headless)glutPostRedisplay();
 }
 
 void OpenGLWindow::Display_Offscreen()
 {
-#ifndef USE_STB
-    std::cerr<<"Error: stb is required for image io"<<std::endl;
-#else
-    ////render to image
+    ////render to image; the pixels are read back through the capture ring and written into the sink on its workers
+    OpenGLFrameCapture* capture=OpenGLFrameCapture::Instance();
     if((!display_offscreen_interactive&&frame_offscreen!=frame_offscreen_rendered)||display_offscreen_interactive){
-        int w=win_w;int h=win_h;
-        int num_pixel=w*h;int num_comp=3;
-        GLubyte* pixels=new GLubyte[num_comp*num_pixel];
-        GLubyte* pixels_flipped_y=new GLubyte[num_comp*num_pixel];
-        glReadPixels(0,0,w,h,GL_RGB,GL_UNSIGNED_BYTE,pixels);
-        for(int i=0;i<h;i++){int offset=w*num_comp*(h-i-1);
-            std::memcpy(pixels_flipped_y+offset,pixels+w*num_comp*i,w*num_comp);}
         int wrt_frame=display_offscreen_interactive?frame_offscreen_rendered++:frame_offscreen;
-        if(!File::Directory_Exists(offscreen_output_dir.c_str()))File::Create_Directory(offscreen_output_dir);
-        std::stringstream ss;ss<<offscreen_output_dir<<"/"<<std::setfill('0')<<std::setw(4)<<wrt_frame<<".png";
-        std::cout<<"Offscreen render to image "<<ss.str()<<std::endl;
-        int rst=Stb::Write_Png(ss.str().c_str(),w,h,num_comp,pixels_flipped_y,0);
-        delete pixels;delete pixels_flipped_y;
+        bool use_pipe=!offscreen_output_pipe.empty();
+        if(!use_pipe&&!File::Directory_Exists(offscreen_output_dir.c_str()))File::Create_Directory(offscreen_output_dir);
+        if(offscreen_sink==nullptr){
+            bool use_stream=(offscreen_output_format=="raw"||offscreen_output_format=="y4m");
+            std::string path=use_pipe?offscreen_output_pipe:offscreen_output_dir+"/frames."+offscreen_output_format;
+            offscreen_sink=Create_Frame_Sink(offscreen_output_format,path,use_stream&&use_pipe,offscreen_fps,offscreen_png_level);
+            if(offscreen_sink->Is_Stream())std::cout<<"Offscreen render to stream "<<path<<std::endl;}
+        std::stringstream ss;ss<<offscreen_output_dir<<"/"<<std::setfill('0')<<std::setw(4)<<wrt_frame;
+        if(!offscreen_sink->Is_Stream())std::cout<<"Offscreen render to image "<<ss.str()<<offscreen_sink->Extension()<<std::endl;
+        capture->drop_when_busy=display_offscreen_interactive&&!headless;
+        capture->Capture(0,0,win_w,win_h,ss.str(),offscreen_sink);
         if(!display_offscreen_interactive)frame_offscreen_rendered=frame_offscreen;}
-#endif
+    if(display_render_stats)texts["capture"]=capture->Stats_String();
+}
+
+void OpenGLWindow::Finish_Offscreen(const bool close)
+{
+	OpenGLFrameCapture::Instance()->Finish();
+	if(offscreen_sink==nullptr)return;
+	if(close){offscreen_sink->Close();offscreen_sink=nullptr;}
+	else offscreen_sink->Flush();
 }
 
 void OpenGLWindow::Display_Text()
 {
-	if(texts.empty())return;
+	if(texts.empty()||headless)return;	////the bitmap font comes from GLUT
 
     // Text rendering uses features that are not available on MacOSX
     // Disable it.
@@ -348,7 +468,7 @@ void OpenGLWindow::Update_Camera()
     glm::vec4& position=camera->object.position;
     glm::mat4 inv_view=glm::inverse(view);
     position=glm::vec4(inv_view[3][0],inv_view[3][1],inv_view[3][2],1.f);
-    camera->Set_Block_Attributes();
+    if(!use_ubo_ring)camera->Set_Block_Attributes();	////otherwise the ring uploads it in Update_Uniform_Blocks
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -550,12 +670,14 @@ void OpenGLWindow::Keyboard_Special_Up_Func(int key,int x,int y)
 
 void OpenGLWindow::Quit()
 {
+	Finish_Offscreen(true);
 	exit(0);
 }
 
 void OpenGLWindow::Toggle_Offscreen()
 {
 	display_offscreen=!display_offscreen;
+	if(!display_offscreen)Finish_Offscreen();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -654,6 +776,12 @@ GLuint Win_Height()
     else return OpenGLWindow::instance->win_h;
 }
 
+GLuint Default_Framebuffer()
+{
+    if(OpenGLWindow::instance==nullptr)return 0;
+    else return OpenGLWindow::instance->headless_fbo;
+}
+
 void Disable_Resize_Window()
 {
 	if (OpenGLWindow::instance == nullptr)return;
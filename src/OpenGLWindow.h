@@ -9,12 +9,15 @@
 #include <functional>
 #include <glad.h>
 #include "Common.h"
+#include "FrameSink.h"
 #include "OpenGLCommon.h"
 
 ////Forward declaration
 class OpenGLObject;
 class OpenGLArcball;
 class OpenGLViewer;
+class OpenGLRenderQueue;
+class OpenGLHeadlessContext;
 
 class OpenGLWindow
 {
@@ -26,6 +29,13 @@ public:
 	int win_w=1280,win_h=960;
 	float fovy=30.f;
 
+	//// Headless rendering, set before Init
+	bool headless=false;			////render into a framebuffer object of win_w x win_h through an EGL context instead of a GLUT window
+	int headless_frame_num=1;		////frames Run renders in headless mode before it returns
+	GLuint headless_fbo=0;
+	GLuint headless_rbo[2]={0,0};	////color and depth-stencil
+	std::shared_ptr<OpenGLHeadlessContext> headless_context;
+
 	//// Offscreen rendering
 	bool display_offscreen=false;
 	bool display_offscreen_interactive=false;
@@ -33,6 +43,11 @@ public:
 	int frame_offscreen=0;
 	int frame_offscreen_rendered=-1;
 	std::string offscreen_output_dir="offscreen_output";
+	std::string offscreen_output_format="png";	////png or qoi files in the directory, raw or y4m streamed into one file there
+	std::string offscreen_output_pipe;			////command that raw or y4m frames are written into instead, e.g., an encoder
+	int offscreen_png_level=8;
+	int offscreen_fps=30;						////frame rate in the y4m header
+	std::shared_ptr<FrameSink> offscreen_sink;	////created at the first offscreen frame; reset to apply changed settings
 
 	////Viewer
 	std::shared_ptr<OpenGLViewer> opengl_viewer;
@@ -65,6 +80,19 @@ public:
 	////Dimension
 	bool use_2d_display=false;
 
+	////Culling
+	bool use_frustum_culling=true;
+	bool display_culling_stats=false;
+	int drawn_num=0,culled_num=0;		////objects drawn and culled in the last frame
+
+	////Render queue
+	bool use_render_queue=true;			////sort the draws of objects that support it; otherwise all objects are drawn in list order
+	bool display_render_stats=false;
+	std::shared_ptr<OpenGLRenderQueue> render_queue;
+
+	////Uniform blocks
+	bool use_ubo_ring=true;				////camera, lights and per-object blocks go through the triple-buffered ring
+
 public:
 	OpenGLWindow();
 
@@ -72,14 +100,21 @@ public:
 	void Init();
 	void Run();
 	void Initialize_Window();
+	void Initialize_Headless();
 	void Initialize_OpenGL();
+	void Render_Frame(const int n=1);	////runs the callbacks and displays n frames without the GLUT main loop
+	void* Get_Proc_Address(const char* name);
 
 	////Display
 	void Display();
 	void Preprocess();
+	void Update_Culling();
+	void Update_Uniform_Blocks();
+	void Display_Objects();
 	void Update_Data_To_Render();
 	void Redisplay();
 	void Display_Offscreen();
+	void Finish_Offscreen(const bool close=false);	////waits for captured frames; close ends a stream
 
 	////Objects
 	void Add_Object(OpenGLObject* object);
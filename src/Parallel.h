@@ -0,0 +1,128 @@
+//#####################################################################
+// Parallel
+// Thread pool and data-parallel loops
+//#####################################################################
+#ifndef __Parallel_h__
+#define __Parallel_h__
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include "Common.h"
+
+namespace Parallel{
+
+inline int Thread_Num()
+{unsigned int n=std::thread::hardware_concurrency();return n==0?1:(int)n;}
+
+////Fixed set of worker threads consuming a FIFO task queue
+class ThreadPool
+{
+public:
+	ThreadPool(const int thread_num=Thread_Num())
+	{
+		for(int i=0;i<thread_num;i++)workers.emplace_back([this](){Worker_Loop();});
+	}
+
+	~ThreadPool()
+	{
+		{std::lock_guard<std::mutex> lock(mtx);stop=true;}
+		cv.notify_all();
+		for(auto& w:workers)w.join();
+	}
+
+	ThreadPool(const ThreadPool&)=delete;
+	ThreadPool& operator=(const ThreadPool&)=delete;
+
+	int Size() const {return (int)workers.size();}
+
+	void Enqueue(std::function<void()> task)
+	{
+		{std::lock_guard<std::mutex> lock(mtx);tasks.push(std::move(task));}
+		cv.notify_one();
+	}
+
+	////Tasks waiting to be picked up by a worker
+	size_type Pending() const
+	{std::lock_guard<std::mutex> lock(mtx);return tasks.size();}
+
+	////Shared pool for short data-parallel loops
+	static ThreadPool& Instance(){static ThreadPool instance;return instance;}
+
+	////True on any pool worker thread; loops started there run inline instead of waiting on their own pool
+	static bool& Is_Worker(){static thread_local bool is_worker=false;return is_worker;}
+
+protected:
+	Array<std::thread> workers;
+	std::queue<std::function<void()> > tasks;
+	mutable std::mutex mtx;
+	std::condition_variable cv;
+	bool stop=false;
+
+	void Worker_Loop()
+	{
+		Is_Worker()=true;
+		while(true){
+			std::function<void()> task;
+			{std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock,[this](){return stop||!tasks.empty();});
+			if(stop&&tasks.empty())return;
+			task=std::move(tasks.front());tasks.pop();}
+			task();}
+	}
+};
+
+////Split [begin,end) into one contiguous chunk per thread and call func(chunk_begin,chunk_end) on each.
+////The calling thread takes the first chunk and the shared pool the rest; ranges shorter than min_chunk per thread run inline.
+template<class F> void For_Chunks(const size_type begin,const size_type end,F func,const size_type min_chunk=1024)
+{
+	if(end<=begin)return;
+	size_type n=end-begin;
+	int thread_n=(int)std::min((size_type)Thread_Num(),(n+min_chunk-1)/min_chunk);
+	if(thread_n<=1||ThreadPool::Is_Worker()){func(begin,end);return;}
+	size_type chunk=(n+thread_n-1)/thread_n;
+
+	std::mutex mtx;std::condition_variable cv;int remaining=0;
+	for(int t=1;t<thread_n;t++){
+		size_type b=begin+t*chunk;size_type e=std::min(end,b+chunk);if(b>=e)break;
+		remaining++;
+		ThreadPool::Instance().Enqueue([=,&func,&mtx,&cv,&remaining](){
+			func(b,e);
+			std::lock_guard<std::mutex> lock(mtx);	////notify under the lock: the caller may return and destroy mtx and cv once remaining is 0
+			remaining--;cv.notify_one();});}
+	func(begin,std::min(end,begin+chunk));
+	std::unique_lock<std::mutex> lock(mtx);cv.wait(lock,[&remaining](){return remaining==0;});
+}
+
+////Call func(i) for every i in [begin,end)
+template<class F> void For(const size_type begin,const size_type end,F func,const size_type min_chunk=1024)
+{For_Chunks(begin,end,[&func](const size_type b,const size_type e){for(size_type i=b;i<e;i++)func(i);},min_chunk);}
+
+////Stable LSD radix sort of 64-bit keys carrying 32-bit values, 11 bits per pass, only over the low key_bits bits.
+////Each pass counts digits per chunk in parallel, prefix-sums the counts in (digit, chunk) order and scatters every chunk in parallel.
+inline void Radix_Sort(Array<std::uint64_t>& keys,Array<std::uint32_t>& values,const int key_bits=64,const size_type min_chunk=1<<14)
+{
+	const int digit_bits=11;const size_type radix=(size_type)1<<digit_bits;
+	const size_type n=keys.size();if(n<=1)return;
+	size_type chunk_num=std::max((size_type)1,std::min((size_type)Thread_Num(),n/min_chunk));
+	size_type chunk=(n+chunk_num-1)/chunk_num;
+	Array<std::uint64_t> keys_tmp(n);Array<std::uint32_t> values_tmp(n);
+	Array<size_type> counts(chunk_num*radix);
+	for(int shift=0;shift<key_bits;shift+=digit_bits){
+		std::fill(counts.begin(),counts.end(),0);
+		For(0,chunk_num,[&](const size_type c){
+			size_type* count=&counts[c*radix];size_type e=std::min(n,(c+1)*chunk);
+			for(size_type i=c*chunk;i<e;i++)count[(keys[i]>>shift)&(radix-1)]++;},1);
+		size_type sum=0;
+		for(size_type r=0;r<radix;r++)for(size_type c=0;c<chunk_num;c++){size_type t=counts[c*radix+r];counts[c*radix+r]=sum;sum+=t;}
+		For(0,chunk_num,[&](const size_type c){
+			size_type* offset=&counts[c*radix];size_type e=std::min(n,(c+1)*chunk);
+			for(size_type i=c*chunk;i<e;i++){size_type p=offset[(keys[i]>>shift)&(radix-1)]++;keys_tmp[p]=keys[i];values_tmp[p]=values[i];}},1);
+		keys.swap(keys_tmp);values.swap(values_tmp);}
+}
+
+}
+
+#endif
@@ -0,0 +1,202 @@
+//#####################################################################
+// Texture cache
+// Mip chains built on the CPU, block-compressed and stored in a versioned container loaded through mmap
+//#####################################################################
+#ifndef __TextureCache_h__
+#define __TextureCache_h__
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <memory>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include "Common.h"
+#include "File.h"
+#include "BlockCompression.h"
+
+////Layout, all little-endian:
+////  Header                      magic "TEXC", version, format, source size and modification time, base size, level count
+////  Level[level_num]            size and byte offset of each mip level, base level first
+////  payload                     compressed blocks of each level, 16-byte aligned
+////A cache is used if it is at least as new as its source, which Read checks together with the recorded source size,
+////so the source image is not decoded at all on later starts.
+namespace TextureCache{
+
+const std::uint32_t version=1;
+using BlockCompression::Format;
+
+struct Header
+{
+	char magic[4]={'T','E','X','C'};
+	std::uint32_t version=TextureCache::version;
+	Format format=Format::None;
+	std::uint32_t level_num=0;
+	std::uint32_t width=0;
+	std::uint32_t height=0;
+	std::int64_t source_size=0;
+	std::int64_t source_time=0;
+};
+
+struct Level
+{
+	std::uint32_t width=0;
+	std::uint32_t height=0;
+	std::uint64_t size=0;
+	std::uint64_t offset=0;			////byte offset of the payload from the file start
+};
+
+////Compressed mip chain; the level data points into the mapped file or into bytes
+struct Texture
+{
+	Format format=Format::None;
+	Array<Level> levels;
+	Array<const std::uint8_t*> data;
+	std::shared_ptr<File::MappedFile> file;
+	Array<Array<std::uint8_t> > bytes;
+
+	size_type Size() const {size_type n=0;for(const auto& l:levels)n+=(size_type)l.size;return n;}
+};
+
+inline std::string Cache_File_Name(const std::string& source_file){return source_file+".tcache";}
+
+////Normal maps are recognized by the file stem only, so a directory named "normals/" does not turn its images into two channels
+inline bool Is_Normal_Map(const std::string& name)
+{
+	size_type begin=name.find_last_of("/\\");begin=(begin==std::string::npos)?0:begin+1;
+	size_type end=name.find_last_of('.');if(end==std::string::npos||end<begin)end=name.size();
+	std::string stem=name.substr(begin,end-begin);std::transform(stem.begin(),stem.end(),stem.begin(),::tolower);
+	return stem.find("normal")!=std::string::npos;
+}
+
+////Normal maps keep two channels in BC5; images with any translucent texel use BC3, the others BC1
+inline Format Choose_Format(const std::string& name,const std::uint8_t* rgba,const size_type texel_num)
+{
+	if(Is_Normal_Map(name))return Format::BC5;
+	for(size_type i=0;i<texel_num;i++)if(rgba[i*4+3]!=255)return Format::BC3;
+	return Format::BC1;
+}
+
+////sRGB encoded values are averaged in linear space; lookup tables for both directions
+struct Srgb_Tables
+{
+	float to_linear[256];
+	std::uint8_t to_srgb[4096];
+	Srgb_Tables()
+	{
+		for(int i=0;i<256;i++){float c=(float)i/255.f;to_linear[i]=c<=.04045f?c/12.92f:std::pow((c+.055f)/1.055f,2.4f);}
+		for(int i=0;i<4096;i++){float l=(float)i/4095.f;float c=l<=.0031308f?12.92f*l:1.055f*std::pow(l,1.f/2.4f)-.055f;
+			to_srgb[i]=(std::uint8_t)std::min(std::max(c*255.f+.5f,0.f),255.f);}
+	}
+	static const Srgb_Tables& Instance(){static Srgb_Tables tables;return tables;}
+};
+
+////Next level by a 2x2 box filter; odd sizes repeat the last row and column. Colors average in linear space and alpha as stored;
+////normal maps average the decoded vectors and renormalize.
+////The texel loop stays scalar: the sRGB conversions are table gathers SSE2 and NEON have no instruction for; rows run in parallel instead.
+inline void Downsample(const Array<std::uint8_t>& src,const int w,const int h,Array<std::uint8_t>& dst,const bool is_normal)
+{
+	const Srgb_Tables& t=Srgb_Tables::Instance();
+	const int dw=std::max(w/2,1),dh=std::max(h/2,1);
+	dst.resize((size_type)dw*dh*4);
+	Parallel::For(0,(size_type)dh,[&](const size_type row){const int y=(int)row;
+		const std::uint8_t* r0=src.data()+(size_type)std::min(2*y,h-1)*w*4;
+		const std::uint8_t* r1=src.data()+(size_type)std::min(2*y+1,h-1)*w*4;
+		std::uint8_t* out=dst.data()+(size_type)y*dw*4;
+		for(int x=0;x<dw;x++){
+			const int x0=std::min(2*x,w-1)*4,x1=std::min(2*x+1,w-1)*4;
+			const std::uint8_t* p[4]={r0+x0,r0+x1,r1+x0,r1+x1};
+			if(is_normal){
+				float n[3]={0.f,0.f,0.f};
+				for(int k=0;k<4;k++)for(int c=0;c<3;c++)n[c]+=(float)p[k][c]/127.5f-1.f;
+				float len=std::sqrt(n[0]*n[0]+n[1]*n[1]+n[2]*n[2]);if(len<1e-6f){n[2]=1.f;len=1.f;}
+				for(int c=0;c<3;c++)out[x*4+c]=(std::uint8_t)std::min(std::max((n[c]/len+1.f)*127.5f+.5f,0.f),255.f);}
+			else for(int c=0;c<3;c++){
+				float l=.25f*(t.to_linear[p[0][c]]+t.to_linear[p[1][c]]+t.to_linear[p[2][c]]+t.to_linear[p[3][c]]);
+				out[x*4+c]=t.to_srgb[(int)(l*4095.f+.5f)];}
+			out[x*4+3]=(std::uint8_t)((p[0][3]+p[1][3]+p[2][3]+p[3][3]+2)/4);}},
+		std::max((size_type)1,(size_type)(1<<16)/(size_type)dw));
+}
+
+////Full chain down to 1x1 from an RGBA8 image, every level encoded
+inline std::shared_ptr<Texture> Build(const std::uint8_t* rgba,const int width,const int height,const Format format)
+{
+	std::shared_ptr<Texture> tex=std::make_shared<Texture>();tex->format=format;
+	Array<std::uint8_t> level(rgba,rgba+(size_type)width*height*4),next;
+	int w=width,h=height;
+	while(true){
+		tex->bytes.push_back(Array<std::uint8_t>());
+		BlockCompression::Encode(format,level.data(),w,h,tex->bytes.back());
+		Level l;l.width=w;l.height=h;l.size=tex->bytes.back().size();tex->levels.push_back(l);
+		if(w==1&&h==1)break;
+		Downsample(level,w,h,next,format==Format::BC5);level.swap(next);
+		w=std::max(w/2,1);h=std::max(h/2,1);}
+	for(const auto& b:tex->bytes)tex->data.push_back(b.data());
+	return tex;
+}
+
+inline bool Write(const std::string& file_name,const Texture& tex,const std::string& source_file)
+{
+	Header header;header.format=tex.format;header.level_num=(std::uint32_t)tex.levels.size();
+	header.width=tex.levels.empty()?0:tex.levels[0].width;header.height=tex.levels.empty()?0:tex.levels[0].height;
+	header.source_size=File::File_Size(source_file);header.source_time=File::File_Modified_Time(source_file);
+	Array<Level> levels=tex.levels;
+	auto align=[](const std::uint64_t x){return (x+15)&~(std::uint64_t)15;};
+	std::uint64_t offset=align(sizeof(Header)+levels.size()*sizeof(Level));
+	for(auto& l:levels){l.offset=offset;offset=align(offset+l.size);}
+
+	std::string tmp_name=file_name+".tmp";
+	{std::ofstream output(tmp_name,std::ios::binary);if(!output)return false;
+	output.write((const char*)&header,sizeof(Header));
+	output.write((const char*)levels.data(),levels.size()*sizeof(Level));
+	const char zeros[16]={0};std::uint64_t pos=sizeof(Header)+levels.size()*sizeof(Level);
+	for(size_type i=0;i<levels.size();i++){
+		output.write(zeros,(std::streamsize)(levels[i].offset-pos));
+		output.write((const char*)tex.data[i],(std::streamsize)levels[i].size);pos=levels[i].offset+levels[i].size;}
+	output.close();
+	if(!output){std::remove(tmp_name.c_str());return false;}}
+	////write to a temporary file first and move it over the old cache, so a reader never maps a partially written or missing one
+	if(!File::Replace_File(tmp_name,file_name)){std::remove(tmp_name.c_str());return false;}
+	return true;
+}
+
+////Null if the cache is missing, older than the source, of another version or corrupt; the levels point into the mapped file
+inline std::shared_ptr<Texture> Read(const std::string& file_name,const std::string& source_file)
+{
+	long long cache_time=File::File_Modified_Time(file_name),source_time=File::File_Modified_Time(source_file);
+	if(cache_time==0||cache_time<source_time)return nullptr;
+	std::shared_ptr<File::MappedFile> file=std::make_shared<File::MappedFile>(file_name);
+	if(!file->Is_Open()||file->size<sizeof(Header))return nullptr;
+	Header header;std::memcpy(&header,file->data,sizeof(Header));
+	if(std::memcmp(header.magic,"TEXC",4)!=0||header.version!=version||header.level_num==0)return nullptr;
+	if(header.format!=Format::BC1&&header.format!=Format::BC3&&header.format!=Format::BC5)return nullptr;
+	if(source_time!=0&&(header.source_size!=File::File_Size(source_file)||header.source_time!=source_time))return nullptr;
+	if(sizeof(Header)+(std::uint64_t)header.level_num*sizeof(Level)>file->size)return nullptr;
+
+	std::shared_ptr<Texture> tex=std::make_shared<Texture>();tex->format=header.format;tex->file=file;
+	const Level* levels=(const Level*)(file->data+sizeof(Header));
+	for(std::uint32_t i=0;i<header.level_num;i++){const Level& l=levels[i];
+		if(l.offset+l.size>file->size||l.size!=BlockCompression::Level_Bytes(header.format,(int)l.width,(int)l.height))return nullptr;
+		tex->levels.push_back(l);tex->data.push_back((const std::uint8_t*)file->data+l.offset);}
+	return tex;
+}
+
+////The cached chain of source_file, built and written on a miss; null if the source cannot be decoded either.
+////decode reads the source as RGBA8 and returns the pixels, freed with free.
+template<class F_DECODE> std::shared_ptr<Texture> Load_Or_Build(const std::string& source_file,const std::string& name,F_DECODE decode)
+{
+	std::string cache_file=Cache_File_Name(source_file);
+	std::shared_ptr<Texture> tex=Read(cache_file,source_file);
+	if(tex!=nullptr)return tex;
+	int width=0,height=0;
+	std::uint8_t* rgba=decode(source_file,width,height);
+	if(rgba==nullptr)return nullptr;
+	tex=Build(rgba,width,height,Choose_Format(name,rgba,(size_type)width*height));
+	free(rgba);
+	if(!Write(cache_file,*tex,source_file))std::cerr<<"Error: [TextureCache] Cannot write "<<cache_file<<std::endl;
+	return tex;
+}
+
+};
+
+#endif